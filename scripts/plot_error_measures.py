@@ -5,9 +5,25 @@ import re
 import pandas as pd
 import matplotlib.pyplot as plt
 import numpy as np
+import h5py
 
 test_dir =  "testoutput/"
 
+def read_error_measures(file_path):
+    """Read the output of compare_error_measures from either a text (.dat) or
+    HDF5 (.h5) file. If file_path doesn't exist, try the other format"""
+    base, ext = os.path.splitext(file_path)
+    if not os.path.exists(file_path):
+        file_path = base + (".h5" if ext == ".dat" else ".dat")
+    if file_path.endswith(".h5"):
+        with h5py.File(file_path, "r", track_order=True) as f:
+            return pd.DataFrame({name: f[name][()] for name in f.keys()})
+    return pd.read_csv(file_path, delim_whitespace = True)
+
+def error_measures_exist(file_path):
+    base, _ = os.path.splitext(file_path)
+    return os.path.exists(base + ".dat") or os.path.exists(base + ".h5")
+
 def plot_error_measure(measure):
     for dir in os.listdir(test_dir):
         if re.search("_1000ms_0_percent", dir):
@@ -15,8 +31,8 @@ def plot_error_measure(measure):
             print(dir)
             file_path = os.path.join(os.path.join(os.getcwd(), "testoutput", dir, "error_measures_1e-08.dat"))
             # apd_file_path = os.path.join(os.path.join(os.getcwd(), "testoutput", dir, "apds_using_groundtruth_1e-12.dat"))
-            if os.path.exists(file_path):
-                df = pd.read_csv(file_path, delim_whitespace = True)
+            if error_measures_exist(file_path):
+                df = read_error_measures(file_path)
                 y_vals = np.log10(df[measure])  # df[['MRMS', '2-Norm', "Trace-2-Norm", "Trace-MRMS"]].values)
                 apds = df["APD"].values
                 apd_errors = [np.log10(abs(apd - apds[-1])) for apd in apds]
@@ -40,8 +56,8 @@ def compare_scenarios(measure, model_name):
             print(dir)
             file_path = os.path.join(os.path.join(os.getcwd(), "testoutput", dir, "error_measures_1e-08.dat"))
             apd_file_path = os.path.join(os.path.join(os.getcwd(), "testoutput", dir, "apds_using_groundtruth_1e-12.dat"))
-            if os.path.exists(file_path):
-                df = pd.read_csv(file_path, delim_whitespace = True)
+            if error_measures_exist(file_path):
+                df = read_error_measures(file_path)
                 y_vals = np.log10(df[measure])  # df[['MRMS', '2-Norm', "Trace-2-Norm", "Trace-MRMS"]].values)
                 apds = df["APD"].values
                 apd_errors = [np.log10(abs(apd - apds[-1])) for apd in apds]
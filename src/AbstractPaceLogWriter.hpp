@@ -0,0 +1,31 @@
+#ifndef ABSTRACT_PACE_LOG_WRITER_HPP
+#define ABSTRACT_PACE_LOG_WRITER_HPP
+
+#include <string>
+#include <vector>
+
+/* Interface for writing one row of named columns per pace, for example the
+   error measures output by compare_error_measures */
+class AbstractPaceLogWriter{
+public:
+  AbstractPaceLogWriter(const std::vector<std::string>& column_names) : mColumnNames(column_names){
+    return;
+  }
+
+  virtual ~AbstractPaceLogWriter(){
+    return;
+  }
+
+  /* row must have one entry for each column */
+  virtual void AppendRow(const std::vector<double>& row) = 0;
+
+  /* Write any buffered rows and close the file */
+  virtual void Close() = 0;
+
+  const std::vector<std::string>& rGetColumnNames(){return mColumnNames;}
+
+protected:
+  std::vector<std::string> mColumnNames;
+};
+
+#endif
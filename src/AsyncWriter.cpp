@@ -0,0 +1,191 @@
+#include "AsyncWriter.hpp"
+#include "Exception.hpp"
+#include <iostream>
+
+static const std::size_t QUEUE_CAPACITY = 4096;
+
+AsyncWriter* AsyncWriter::Instance(){
+  static AsyncWriter instance;
+  return &instance;
+}
+
+AsyncWriter::AsyncWriter() : mQueue(QUEUE_CAPACITY), mStop(false), mQueued(0), mWritten(0), mSleeping(false){
+  mThread = std::thread(&AsyncWriter::Run, this);
+}
+
+AsyncWriter::~AsyncWriter(){
+  // A destructor mustn't throw. Errors were printed as they happened, so
+  // anything left unreported at exit is dropped
+  const unsigned long ticket = Push(FLUSH, "", "");
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mFlushed.wait(lock, [&]{return mCompletedFlushes.count(ticket) > 0;});
+  }
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mWakeUp.notify_one();
+  mThread.join();
+}
+
+std::set<std::string>& AsyncWriter::rGetThreadPaths(){
+  static thread_local std::set<std::string> paths;
+  return paths;
+}
+
+void AsyncWriter::Open(const std::string& path){
+  rGetThreadPaths().insert(path);
+  Push(OPEN, path, "");
+}
+
+void AsyncWriter::Write(const std::string& path, std::string text){
+  rGetThreadPaths().insert(path);
+  Push(WRITE, path, std::move(text));
+}
+
+void AsyncWriter::Close(const std::string& path){
+  rGetThreadPaths().insert(path);
+  Push(CLOSE, path, "");
+}
+
+void AsyncWriter::WriteToStdout(std::string text){
+  Push(STDOUT, "", std::move(text));
+}
+
+void AsyncWriter::Flush(){
+  // Wait for our own FLUSH record, which is queued after everything this
+  // thread has written
+  const unsigned long ticket = Push(FLUSH, "", "");
+  std::vector<std::string> errors;
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mFlushed.wait(lock, [&]{return mCompletedFlushes.count(ticket) > 0;});
+    mCompletedFlushes.erase(ticket);
+    for(const std::string& path : rGetThreadPaths()){
+      auto found = mErrors.find(path);
+      if(found != mErrors.end()){
+        errors.insert(errors.end(), found->second.begin(), found->second.end());
+        mErrors.erase(found);
+      }
+    }
+  }
+  if(!errors.empty()){
+    std::string message = "AsyncWriter:";
+    for(const std::string& error : errors)
+      message += " " + error + ";";
+    EXCEPTION(message);
+  }
+}
+
+unsigned long AsyncWriter::Push(RecordType type, std::string path, std::string text){
+  // Take a ticket before queueing so that the writer can't fall asleep
+  // between the record being queued and the count going up
+  const unsigned long ticket = ++mQueued;
+  Record record = {type, std::move(path), std::move(text), ticket};
+  while(!mQueue.TryPush(std::move(record))){
+    std::this_thread::yield();
+  }
+  if(mSleeping){
+    // Taking the lock means the writer is either still checking for work or
+    // already waiting, so it can't miss the notification
+    std::lock_guard<std::mutex> lock(mMutex);
+    mWakeUp.notify_one();
+  }
+  return ticket;
+}
+
+void AsyncWriter::Run(){
+  Record record;
+  while(true){
+    if(mQueue.TryPop(record)){
+      Process(record);
+      mWritten++;
+    }
+    else if(mStop){
+      break;
+    }
+    else if(mQueued > mWritten){
+      // A record has a ticket but hasn't reached the queue yet
+      std::this_thread::yield();
+    }
+    else{
+      std::unique_lock<std::mutex> lock(mMutex);
+      mSleeping = true;
+      mWakeUp.wait(lock, [&]{return mQueued > mWritten || mStop;});
+      mSleeping = false;
+    }
+  }
+  for(auto& file : mFiles){
+    file.second->close();
+  }
+}
+
+void AsyncWriter::ReportError(const std::string& path, const std::string& message){
+  std::cerr << "AsyncWriter: " << message << "\n";
+  std::lock_guard<std::mutex> lock(mMutex);
+  mErrors[path].push_back(message);
+}
+
+void AsyncWriter::Process(Record& record){
+  switch(record.type){
+  case OPEN:
+    mFailedPaths.erase(record.path);
+    mFiles[record.path].reset(new std::ofstream(record.path, std::ios::binary));
+    if(!mFiles[record.path]->is_open()){
+      ReportError(record.path, "failed to open file " + record.path);
+      mFiles.erase(record.path);
+      mFailedPaths.insert(record.path);
+    }
+    break;
+  case WRITE:{
+    // Only report the first failure for each file
+    if(mFailedPaths.count(record.path) > 0)
+      break;
+    auto found = mFiles.find(record.path);
+    if(found == mFiles.end()){
+      // Not opened explicitly so append to whatever is there
+      found = mFiles.emplace(record.path, std::unique_ptr<std::ofstream>(new std::ofstream(record.path, std::ios::binary | std::ios::app))).first;
+    }
+    *found->second << record.text;
+    if(!*found->second){
+      ReportError(record.path, "failed to write to file " + record.path);
+      mFiles.erase(found);
+      mFailedPaths.insert(record.path);
+    }
+    break;
+  }
+  case CLOSE:{
+    auto found = mFiles.find(record.path);
+    if(found != mFiles.end()){
+      found->second->close();
+      if(!*found->second)
+        ReportError(record.path, "failed to close file " + record.path);
+      mFiles.erase(found);
+    }
+    mFailedPaths.erase(record.path);
+    break;
+  }
+  case STDOUT:
+    std::cout << record.text;
+    break;
+  case FLUSH:{
+    for(auto it = mFiles.begin(); it != mFiles.end();){
+      it->second->flush();
+      if(!*it->second){
+        ReportError(it->first, "failed to write to file " + it->first);
+        mFailedPaths.insert(it->first);
+        it = mFiles.erase(it);
+      }
+      else{
+        ++it;
+      }
+    }
+    std::cout.flush();
+    std::lock_guard<std::mutex> lock(mMutex);
+    mCompletedFlushes.insert(record.ticket);
+    mFlushed.notify_all();
+    break;
+  }
+  }
+}
@@ -0,0 +1,94 @@
+#ifndef ASYNC_WRITER_HPP
+#define ASYNC_WRITER_HPP
+
+#include "BoundedQueue.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Writes diagnostic output (per-pace tables, jump parameters, state files
+   and progress messages) from a background thread, so that pacing never
+   waits on disk or terminal I/O.
+
+   Records are queued on a lock-free queue and written in the order they
+   were queued. A file is truncated by Open, appended to by Write and closed
+   by Close. Files are written byte for byte (binary mode), so the same
+   calls serve text and binary files. Call Flush before reading back
+   anything written here. A file which couldn't be opened, written or closed
+   is reported by the next call to Flush from a thread which has written to
+   that path, which throws.
+
+   If the queue fills up, callers spin until the writer catches up rather
+   than dropping output. The writer thread sleeps while the queue is empty.
+ */
+class AsyncWriter{
+public:
+  static AsyncWriter* Instance();
+  ~AsyncWriter();
+
+  void Open(const std::string& path);
+  void Write(const std::string& path, std::string text);
+  void Close(const std::string& path);
+  void WriteToStdout(std::string text);
+
+  /* Block until everything this thread has queued so far (and anything other
+     threads finished queueing before this call) has been written and
+     flushed. Throws if any file this thread has written to couldn't be
+     opened, written or closed since it was last reported */
+  void Flush();
+
+private:
+  AsyncWriter();
+  AsyncWriter(const AsyncWriter&) = delete;
+  AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+  enum RecordType {OPEN, WRITE, CLOSE, STDOUT, FLUSH};
+  struct Record{
+    RecordType type;
+    std::string path;
+    std::string text;
+    unsigned long ticket;
+  };
+
+  /* Queue a record, returning the ticket it was given */
+  unsigned long Push(RecordType type, std::string path, std::string text);
+  void Run();
+  void Process(Record& record);
+  void ReportError(const std::string& path, const std::string& message);
+
+  /* Paths the calling thread has queued records for, so that Flush only
+     reports that thread's errors */
+  static std::set<std::string>& rGetThreadPaths();
+
+  BoundedQueue<Record> mQueue;
+  std::atomic<bool> mStop;
+  std::atomic<unsigned long> mQueued;
+  std::atomic<unsigned long> mWritten;
+
+  /* The writer sleeps on mWakeUp while mSleeping is set. Producers only take
+     the mutex to wake it */
+  std::mutex mMutex;
+  std::condition_variable mWakeUp;
+  std::atomic<bool> mSleeping;
+
+  /* Tickets of FLUSH records which have been processed, and errors not yet
+     reported by Flush, keyed by path. Guarded by mMutex */
+  std::condition_variable mFlushed;
+  std::set<unsigned long> mCompletedFlushes;
+  std::map<std::string, std::vector<std::string>> mErrors;
+
+  // Only touched by the writer thread
+  std::map<std::string, std::unique_ptr<std::ofstream>> mFiles;
+  std::set<std::string> mFailedPaths;
+
+  std::thread mThread;
+};
+
+#endif
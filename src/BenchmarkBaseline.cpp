@@ -0,0 +1,110 @@
+#include "BenchmarkBaseline.hpp"
+#include "Exception.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/math/distributions/students_t.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <cmath>
+
+typedef boost::property_tree::ptree::path_type TreePath;
+
+/* Scenario names may contain dots (e.g. IKr blocks) so separate paths with '/' */
+static TreePath ScenarioPath(const std::string& scenario){
+  return TreePath("scenarios/" + scenario, '/');
+}
+
+BenchmarkMeasure SummariseMeasure(const std::vector<double>& values){
+  BenchmarkMeasure measure;
+  measure.samples = values.size();
+  if(values.empty())
+    return measure;
+  for(double value : values)
+    measure.mean += value/values.size();
+  if(values.size() > 1){
+    for(double value : values)
+      measure.variance += (value - measure.mean)*(value - measure.mean)/(values.size() - 1);
+  }
+  return measure;
+}
+
+BenchmarkBaseline::BenchmarkBaseline(std::string path) : mPath(path){
+  if(boost::filesystem::exists(path)){
+    try{
+      boost::property_tree::read_json(path, mTree);
+      mExists = true;
+    }
+    catch(const boost::property_tree::json_parser_error& e){
+      EXCEPTION("Couldn't read benchmark baseline " + path + ": " + e.what());
+    }
+  }
+}
+
+bool BenchmarkBaseline::HasScenario(const std::string& scenario) const{
+  return bool(mTree.get_child_optional(ScenarioPath(scenario)));
+}
+
+double BenchmarkBaseline::GetTolerance(const std::string& measure) const{
+  auto found = mTolerances.find(measure);
+  return found == mTolerances.end() ? mDefaultTolerance : found->second;
+}
+
+bool BenchmarkBaseline::IsSignificantIncrease(const BenchmarkMeasure& baseline, const BenchmarkMeasure& current) const{
+  const double baseline_error = baseline.samples > 0 ? baseline.variance/baseline.samples : 0;
+  const double current_error = current.samples > 0 ? current.variance/current.samples : 0;
+  const double standard_error = std::sqrt(baseline_error + current_error);
+  if(standard_error == 0 || baseline.samples < 2 || current.samples < 2){
+    // Nothing to test against, so leave it to the tolerance
+    return current.mean > baseline.mean;
+  }
+
+  // Welch-Satterthwaite degrees of freedom
+  const double degrees_of_freedom = std::pow(baseline_error + current_error, 2)/(baseline_error*baseline_error/(baseline.samples - 1) + current_error*current_error/(current.samples - 1));
+  const double t = (current.mean - baseline.mean)/standard_error;
+  boost::math::students_t distribution(degrees_of_freedom);
+  return t > boost::math::quantile(boost::math::complement(distribution, mSignificanceLevel));
+}
+
+std::vector<BaselineComparison> BenchmarkBaseline::Compare(const std::string& scenario, const std::map<std::string, BenchmarkMeasure>& measures) const{
+  std::vector<BaselineComparison> comparisons;
+  auto p_scenario_tree = mTree.get_child_optional(ScenarioPath(scenario));
+  if(!p_scenario_tree)
+    return comparisons;
+
+  for(const auto& measure : measures){
+    auto p_measure_tree = p_scenario_tree->get_child_optional(measure.first);
+    if(!p_measure_tree)
+      continue;
+    BenchmarkMeasure baseline;
+    baseline.mean = p_measure_tree->get<double>("mean");
+    baseline.variance = p_measure_tree->get<double>("variance");
+    baseline.samples = p_measure_tree->get<unsigned int>("samples");
+
+    BaselineComparison comparison;
+    comparison.scenario = scenario;
+    comparison.measure = measure.first;
+    comparison.baseline_mean = baseline.mean;
+    comparison.mean = measure.second.mean;
+    comparison.relative_change = baseline.mean != 0 ? (measure.second.mean - baseline.mean)/std::abs(baseline.mean) : (measure.second.mean > 0 ? INFINITY : 0);
+    comparison.regression = comparison.relative_change > GetTolerance(measure.first) && IsSignificantIncrease(baseline, measure.second);
+    comparisons.push_back(comparison);
+  }
+  return comparisons;
+}
+
+void BenchmarkBaseline::Update(const std::string& scenario, const std::map<std::string, BenchmarkMeasure>& measures){
+  boost::property_tree::ptree scenario_tree;
+  for(const auto& measure : measures){
+    boost::property_tree::ptree measure_tree;
+    measure_tree.put("mean", measure.second.mean);
+    measure_tree.put("variance", measure.second.variance);
+    measure_tree.put("samples", measure.second.samples);
+    scenario_tree.add_child(measure.first, measure_tree);
+  }
+  mTree.put_child(ScenarioPath(scenario), scenario_tree);
+}
+
+void BenchmarkBaseline::Save() const{
+  boost::filesystem::path path(mPath);
+  if(path.has_parent_path())
+    boost::filesystem::create_directories(path.parent_path());
+  boost::property_tree::write_json(mPath, mTree);
+}
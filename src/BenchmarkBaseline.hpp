@@ -0,0 +1,79 @@
+#ifndef BENCHMARK_BASELINE_HPP
+#define BENCHMARK_BASELINE_HPP
+
+#include <boost/property_tree/ptree.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+/* The mean and sample variance of a benchmark measure over repeated runs */
+struct BenchmarkMeasure{
+  double mean = 0;
+  double variance = 0;
+  unsigned int samples = 0;
+};
+
+BenchmarkMeasure SummariseMeasure(const std::vector<double>& values);
+
+struct BaselineComparison{
+  std::string scenario;
+  std::string measure;
+  double baseline_mean;
+  double mean;
+  double relative_change;
+  bool regression;
+};
+
+/* A store of benchmark results (scenario -> measure -> mean, variance and
+   number of samples) kept as a JSON file, used to catch performance
+   regressions.
+
+   A measure has regressed when its mean has increased by more than the
+   measure's relative tolerance and the increase is statistically significant:
+   a one-sided Welch t-test at the given significance level. Measures with
+   no variance in either the baseline or the new runs (such as the number of
+   paces, which is deterministic), or with fewer than two samples, are
+   compared on the tolerance alone.
+ */
+class BenchmarkBaseline{
+public:
+  /* Load the baseline from path if it exists */
+  BenchmarkBaseline(std::string path);
+
+  /* Whether a baseline was loaded from the file */
+  bool Exists() const {return mExists;}
+
+  bool HasScenario(const std::string& scenario) const;
+
+  /* Relative increase allowed in a measure before it counts as a regression.
+     Measures without a tolerance of their own use the default */
+  void SetTolerance(const std::string& measure, double relative_tolerance){mTolerances[measure] = relative_tolerance;}
+  void SetDefaultTolerance(double relative_tolerance){mDefaultTolerance = relative_tolerance;}
+  void SetSignificanceLevel(double significance){mSignificanceLevel = significance;}
+
+  /* Compare each measure that has a baseline. Scenarios not in the baseline
+     give no comparisons */
+  std::vector<BaselineComparison> Compare(const std::string& scenario, const std::map<std::string, BenchmarkMeasure>& measures) const;
+
+  /* Replace the baseline for a scenario. Call Save to write it out */
+  void Update(const std::string& scenario, const std::map<std::string, BenchmarkMeasure>& measures);
+
+  void Save() const;
+
+  /* Whether current's mean is significantly larger than baseline's by a
+     one-sided Welch t-test. Without enough data for the test (no variance or
+     fewer than two samples) any increase counts */
+  bool IsSignificantIncrease(const BenchmarkMeasure& baseline, const BenchmarkMeasure& current) const;
+
+private:
+  std::string mPath;
+  bool mExists = false;
+  boost::property_tree::ptree mTree;
+  std::map<std::string, double> mTolerances;
+  double mDefaultTolerance = 0.05;
+  double mSignificanceLevel = 0.01;
+
+  double GetTolerance(const std::string& measure) const;
+};
+
+#endif
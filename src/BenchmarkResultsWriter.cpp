@@ -0,0 +1,97 @@
+#include "BenchmarkResultsWriter.hpp"
+#include "Exception.hpp"
+#include <cmath>
+#include <iomanip>
+
+/* Escape a string for use in JSON */
+static std::string EscapeJson(const std::string& str){
+  std::string escaped;
+  for(char c : str){
+    if(c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
+BenchmarkResultsWriter::BenchmarkResultsWriter(std::string path, std::string list_name, const std::vector<std::pair<std::string, double>>& settings) : mFile(path){
+  if(!mFile.is_open()){
+    EXCEPTION("Failed to open file " + path);
+  }
+  mFile << std::setprecision(17);
+  mFile << "{";
+  for(const auto& setting : settings){
+    mFile << "\n  \"" << EscapeJson(setting.first) << "\": ";
+    WriteNumber(setting.second);
+    mFile << ",";
+  }
+  mFile << "\n  \"" << EscapeJson(list_name) << "\": [";
+}
+
+BenchmarkResultsWriter::~BenchmarkResultsWriter(){
+  Close();
+}
+
+void BenchmarkResultsWriter::Close(){
+  if(!mFile.is_open())
+    return;
+  mFile << "\n  ]\n}\n";
+  mFile.close();
+}
+
+void BenchmarkResultsWriter::BeginResult(){
+  mFile << (mFirstResult ? "" : ",") << "\n    {";
+  mFirstResult = false;
+  mFirstField = true;
+}
+
+void BenchmarkResultsWriter::EndResult(){
+  mFile << "}";
+  mFile.flush();
+}
+
+void BenchmarkResultsWriter::WriteName(const std::string& name){
+  mFile << (mFirstField ? "" : ", ") << "\"" << EscapeJson(name) << "\": ";
+  mFirstField = false;
+}
+
+void BenchmarkResultsWriter::WriteNumber(double value){
+  if(std::isfinite(value))
+    mFile << value;
+  else
+    mFile << "null";
+}
+
+void BenchmarkResultsWriter::WriteObject(const std::vector<std::string>& measure_names, const std::vector<double>& values){
+  mFile << "{";
+  for(unsigned int i = 0; i < measure_names.size() && i < values.size(); i++){
+    mFile << (i==0 ? "" : ", ") << "\"" << EscapeJson(measure_names[i]) << "\": ";
+    WriteNumber(values[i]);
+  }
+  mFile << "}";
+}
+
+void BenchmarkResultsWriter::WriteField(const std::string& name, const std::string& value){
+  WriteName(name);
+  mFile << "\"" << EscapeJson(value) << "\"";
+}
+
+void BenchmarkResultsWriter::WriteField(const std::string& name, double value){
+  WriteName(name);
+  WriteNumber(value);
+}
+
+void BenchmarkResultsWriter::WriteMeasures(const std::string& name, const std::vector<std::string>& measure_names, const std::vector<double>& values){
+  WriteName(name);
+  WriteObject(measure_names, values);
+}
+
+void BenchmarkResultsWriter::WriteMeasureList(const std::string& name, const std::vector<std::string>& measure_names, const std::vector<std::vector<double>>& values){
+  WriteName(name);
+  mFile << "[";
+  for(unsigned int i = 0; i < values.size(); i++){
+    mFile << (i==0 ? "" : ", ");
+    WriteObject(measure_names, values[i]);
+  }
+  mFile << "]";
+}
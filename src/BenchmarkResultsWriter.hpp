@@ -0,0 +1,48 @@
+#ifndef BENCHMARK_RESULTS_WRITER_HPP
+#define BENCHMARK_RESULTS_WRITER_HPP
+
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Writes benchmark results to a JSON file of the form
+
+     {"<setting>": value, ..., "<list_name>": [{result}, ...]}
+
+   Each result is flushed as soon as it is finished, so an interrupted
+   benchmark keeps what it got through (although the file is only complete
+   JSON after Close). A result holds labels, numbers and named groups of
+   measures (measure name -> value). Values which aren't finite are written
+   as null.
+ */
+class BenchmarkResultsWriter{
+public:
+  BenchmarkResultsWriter(std::string path, std::string list_name, const std::vector<std::pair<std::string, double>>& settings);
+  ~BenchmarkResultsWriter();
+
+  void BeginResult();
+  void WriteField(const std::string& name, const std::string& value);
+  void WriteField(const std::string& name, double value);
+
+  /* An object mapping each of measure_names to the matching value */
+  void WriteMeasures(const std::string& name, const std::vector<std::string>& measure_names, const std::vector<double>& values);
+
+  /* A list of such objects, e.g. one per repetition */
+  void WriteMeasureList(const std::string& name, const std::vector<std::string>& measure_names, const std::vector<std::vector<double>>& values);
+  void EndResult();
+
+  /* Finish the file. Called by the destructor if need be */
+  void Close();
+
+private:
+  std::ofstream mFile;
+  bool mFirstResult = true;
+  bool mFirstField = true;
+
+  void WriteName(const std::string& name);
+  void WriteNumber(double value);
+  void WriteObject(const std::vector<std::string>& measure_names, const std::vector<double>& values);
+};
+
+#endif
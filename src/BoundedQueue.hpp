@@ -0,0 +1,93 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* A fixed size, lock-free, multiple producer multiple consumer queue.
+
+   Each slot carries a sequence number which tells producers and consumers
+   whether it is free to be written or ready to be read, so neither side ever
+   takes a lock (D. Vyukov's bounded MPMC queue). TryPush and TryPop return
+   false rather than waiting when the queue is full or empty.
+
+   The capacity must be a power of two.
+ */
+template<typename T>
+class BoundedQueue{
+public:
+  BoundedQueue(std::size_t capacity) : mBuffer(capacity), mMask(capacity - 1){
+    assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+    for(std::size_t i = 0; i < capacity; i++){
+      mBuffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    mEnqueuePosition.store(0, std::memory_order_relaxed);
+    mDequeuePosition.store(0, std::memory_order_relaxed);
+  }
+
+  bool TryPush(T&& data){
+    Slot* p_slot;
+    std::size_t position = mEnqueuePosition.load(std::memory_order_relaxed);
+    while(true){
+      p_slot = &mBuffer[position & mMask];
+      const std::size_t sequence = p_slot->sequence.load(std::memory_order_acquire);
+      const std::intptr_t difference = (std::intptr_t) sequence - (std::intptr_t) position;
+      if(difference == 0){
+        if(mEnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if(difference < 0){
+        // Full
+        return false;
+      }
+      else{
+        position = mEnqueuePosition.load(std::memory_order_relaxed);
+      }
+    }
+    p_slot->data = std::move(data);
+    p_slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool TryPop(T& data){
+    Slot* p_slot;
+    std::size_t position = mDequeuePosition.load(std::memory_order_relaxed);
+    while(true){
+      p_slot = &mBuffer[position & mMask];
+      const std::size_t sequence = p_slot->sequence.load(std::memory_order_acquire);
+      const std::intptr_t difference = (std::intptr_t) sequence - (std::intptr_t) (position + 1);
+      if(difference == 0){
+        if(mDequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if(difference < 0){
+        // Empty
+        return false;
+      }
+      else{
+        position = mDequeuePosition.load(std::memory_order_relaxed);
+      }
+    }
+    data = std::move(p_slot->data);
+    p_slot->sequence.store(position + mMask + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  struct Slot{
+    std::atomic<std::size_t> sequence;
+    T data;
+  };
+
+  std::vector<Slot> mBuffer;
+  const std::size_t mMask;
+
+  // Keep the two positions on separate cache lines
+  alignas(64) std::atomic<std::size_t> mEnqueuePosition;
+  alignas(64) std::atomic<std::size_t> mDequeuePosition;
+};
+
+#endif
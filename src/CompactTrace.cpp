@@ -0,0 +1,116 @@
+#include "CompactTrace.hpp"
+#include "Exception.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+
+void CompactTrace::AddStep(double time, const double* p_state, const double* p_derivatives){
+  if(!mTimes.empty() && time < mTimes.back()){
+    EXCEPTION("CompactTrace steps must be added in order");
+  }
+  mTimes.push_back(time);
+  mStates.insert(mStates.end(), p_state, p_state + mNumberOfVariables);
+  mDerivatives.insert(mDerivatives.end(), p_derivatives, p_derivatives + mNumberOfVariables);
+}
+
+unsigned int CompactTrace::FindInterval(double time) const{
+  if(mTimes.size() < 2){
+    EXCEPTION("CompactTrace needs at least two steps to interpolate");
+  }
+  if(time < mTimes.front() || time > mTimes.back()){
+    EXCEPTION("Time " + std::to_string(time) + " is outside of the trace");
+  }
+  // First step after time, then step back to the start of the interval
+  const unsigned int upper = std::upper_bound(mTimes.begin(), mTimes.end(), time) - mTimes.begin();
+  return std::min<unsigned int>(std::max<unsigned int>(upper, 1), mTimes.size() - 1) - 1;
+}
+
+double CompactTrace::Interpolate(double time, unsigned int variable_index) const{
+  const unsigned int i = FindInterval(time);
+  const double h = mTimes[i+1] - mTimes[i];
+  const double y0 = mStates[i*mNumberOfVariables + variable_index];
+  const double y1 = mStates[(i+1)*mNumberOfVariables + variable_index];
+  if(h == 0){
+    // Repeated time point at a segment boundary
+    return y1;
+  }
+  const double f0 = mDerivatives[i*mNumberOfVariables + variable_index];
+  const double f1 = mDerivatives[(i+1)*mNumberOfVariables + variable_index];
+
+  // Cubic Hermite basis functions
+  const double s = (time - mTimes[i])/h;
+  const double s2 = s*s;
+  const double s3 = s2*s;
+  return (2*s3 - 3*s2 + 1)*y0 + (s3 - 2*s2 + s)*h*f0 + (-2*s3 + 3*s2)*y1 + (s3 - s2)*h*f1;
+}
+
+std::vector<double> CompactTrace::Interpolate(double time) const{
+  std::vector<double> state(mNumberOfVariables);
+  for(unsigned int j = 0; j < mNumberOfVariables; j++){
+    state[j] = Interpolate(time, j);
+  }
+  return state;
+}
+
+std::vector<double> CompactTrace::GetSamplingTimes(double sampling_timestep) const{
+  std::vector<double> times;
+  const double start = GetStartTime();
+  const double end = GetEndTime();
+  const unsigned int n = std::floor((end - start)/sampling_timestep + 1e-10);
+  times.reserve(n + 2);
+  for(unsigned int i = 0; i <= n; i++){
+    times.push_back(start + i*sampling_timestep);
+  }
+  if(end - times.back() > 1e-10*sampling_timestep)
+    times.push_back(end);
+  return times;
+}
+
+std::vector<std::vector<double>> CompactTrace::Resample(const std::vector<double>& times) const{
+  std::vector<std::vector<double>> states;
+  states.reserve(times.size());
+  for(double time : times){
+    states.push_back(Interpolate(time));
+  }
+  return states;
+}
+
+std::vector<std::vector<double>> CompactTrace::Resample(double sampling_timestep) const{
+  return Resample(GetSamplingTimes(sampling_timestep));
+}
+
+std::vector<double> CompactTrace::ResampleVariable(unsigned int variable_index, double sampling_timestep) const{
+  std::vector<double> values;
+  for(double time : GetSamplingTimes(sampling_timestep)){
+    values.push_back(Interpolate(time, variable_index));
+  }
+  return values;
+}
+
+void CompactTrace::WriteToFile(std::string file_path) const{
+  std::ofstream f_out(file_path);
+  if(!f_out.is_open()){
+    EXCEPTION("Failed to open file " + file_path);
+  }
+  f_out << std::setprecision(20);
+  f_out << "time ";
+  for(const std::string& name : mVariableNames){
+    f_out << name << " ";
+  }
+  f_out << "\n";
+  for(unsigned int i = 0; i < mTimes.size(); i++){
+    f_out << mTimes[i] << " ";
+    for(unsigned int j = 0; j < mNumberOfVariables; j++){
+      f_out << mStates[i*mNumberOfVariables + j] << " ";
+    }
+    f_out << "\n";
+  }
+  f_out.close();
+}
+
+void CompactTrace::Clear(){
+  mTimes.clear();
+  mStates.clear();
+  mDerivatives.clear();
+}
@@ -0,0 +1,73 @@
+#ifndef COMPACT_TRACE_HPP
+#define COMPACT_TRACE_HPP
+
+#include <string>
+#include <vector>
+
+/* A trace made up of the solver's accepted steps only. Alongside the state at
+   each step we keep its time derivative, which is enough to reconstruct the
+   state anywhere in between with a cubic Hermite interpolant. This is
+   fourth order accurate in the step size, so it adds little to the solver's
+   own error (see TestCompactTrace), while diastole (where CVODE takes very
+   long steps) only needs a handful of points.
+ */
+class CompactTrace{
+public:
+  CompactTrace(unsigned int number_of_variables = 0, std::vector<std::string> variable_names = {}) : mNumberOfVariables(number_of_variables), mVariableNames(variable_names){
+  }
+
+  /* Record a step. Times must be non-decreasing */
+  void AddStep(double time, const double* p_state, const double* p_derivatives);
+
+  unsigned int GetNumberOfSteps() const {return mTimes.size();}
+  unsigned int GetNumberOfVariables() const {return mNumberOfVariables;}
+  const std::vector<double>& rGetTimes() const {return mTimes;}
+  const std::vector<std::string>& rGetVariableNames() const {return mVariableNames;}
+
+  double GetStartTime() const {return mTimes.front();}
+  double GetEndTime() const {return mTimes.back();}
+
+  /* The state at the last step, exactly as the solver left it */
+  std::vector<double> GetFinalState() const {
+    return std::vector<double>(mStates.end() - mNumberOfVariables, mStates.end());
+  }
+
+  /* The state of every variable at time t */
+  std::vector<double> Interpolate(double time) const;
+
+  /* The value of one variable at time t */
+  double Interpolate(double time, unsigned int variable_index) const;
+
+  /* Reconstruct the trace at each of the given times. Returns one vector of
+     states per time */
+  std::vector<std::vector<double>> Resample(const std::vector<double>& times) const;
+
+  /* Reconstruct the trace at a uniform sampling timestep over the whole trace */
+  std::vector<std::vector<double>> Resample(double sampling_timestep) const;
+
+  /* Reconstruct one variable at a uniform sampling timestep */
+  std::vector<double> ResampleVariable(unsigned int variable_index, double sampling_timestep) const;
+
+  /* Uniform sampling times covering the whole trace, including the end point */
+  std::vector<double> GetSamplingTimes(double sampling_timestep) const;
+
+  /* Write the accepted steps (not their derivatives) as a space separated
+     table with a header line */
+  void WriteToFile(std::string file_path) const;
+
+  void Clear();
+
+private:
+  unsigned int mNumberOfVariables;
+  std::vector<std::string> mVariableNames;
+  std::vector<double> mTimes;
+
+  // Stored step by step: mStates[i*mNumberOfVariables + j] is variable j at step i
+  std::vector<double> mStates;
+  std::vector<double> mDerivatives;
+
+  /* Index of the step at the start of the interval containing time */
+  unsigned int FindInterval(double time) const;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "CvodeStatistics.hpp"
+#include "Exception.hpp"
+#include "VectorHelperFunctions.hpp"
+#include <cmath>
+
+#ifdef CHASTE_CVODE
+#include <cvode/cvode.h>
+#if CHASTE_SUNDIALS_VERSION >= 30000 && CHASTE_SUNDIALS_VERSION < 40000
+#include <cvode/cvode_direct.h>
+#elif CHASTE_SUNDIALS_VERSION < 30000
+#include <cvode/cvode_dense.h>
+#endif
+#endif
+
+CvodeCounters& CvodeCounters::operator+=(const CvodeCounters& other){
+  steps += other.steps;
+  rhs_evaluations += other.rhs_evaluations;
+  jacobian_evaluations += other.jacobian_evaluations;
+  error_test_failures += other.error_test_failures;
+  nonlinear_iterations += other.nonlinear_iterations;
+  nonlinear_convergence_failures += other.nonlinear_convergence_failures;
+  last_step_size = other.last_step_size;
+  wall_time += other.wall_time;
+  return *this;
+}
+
+/* mpCvodeMem, SetupCvode and RecordStoppingPoint are protected in
+   AbstractCvodeSystem. Taking their addresses through a derived class gives
+   member pointers we can apply to any model */
+struct CvodeMemoryAccessor : public AbstractCvodeCell{
+  static void* Get(AbstractCvodeCell* p_model){
+    return p_model->*(&CvodeMemoryAccessor::mpCvodeMem);
+  }
+
+  static void Setup(AbstractCvodeCell* p_model, double t_start, double max_timestep){
+    (p_model->*(&CvodeMemoryAccessor::SetupCvode))(p_model->rGetStateVariables(), t_start, max_timestep);
+  }
+
+  static void MarkStart(AbstractCvodeCell* p_model, double t_start){
+    (p_model->*(&CvodeMemoryAccessor::RecordStoppingPoint))(t_start);
+  }
+};
+
+void* GetCvodeMemory(AbstractCvodeCell* p_model){
+  return CvodeMemoryAccessor::Get(p_model);
+}
+
+void SetupCvodeWithTolerances(AbstractCvodeCell* p_model, double t_start, double max_timestep, double tol_rel, const std::vector<double>& tol_abs){
+  if(tol_abs.size() != p_model->GetNumberOfStateVariables()){
+    EXCEPTION("Expected " + std::to_string(p_model->GetNumberOfStateVariables()) + " absolute tolerances but got " + std::to_string(tol_abs.size()));
+  }
+  if(p_model->GetForceReset()){
+    EXCEPTION("Per-variable tolerances would be lost to a forced reset");
+  }
+#ifdef CHASTE_CVODE
+  // Reinitialises CVODE (with Chaste's scalar tolerances) if Solve would
+  CvodeMemoryAccessor::Setup(p_model, t_start, max_timestep);
+
+  // CVODE keeps its own copy of the tolerances
+  N_Vector tol_abs_nvector = nullptr;
+  CreateVectorIfEmpty(tol_abs_nvector, tol_abs.size());
+  CopyFromStdVector(tol_abs, tol_abs_nvector);
+  const int flag = CVodeSVtolerances(GetCvodeMemory(p_model), tol_rel, tol_abs_nvector);
+  DeleteVector(tol_abs_nvector);
+  if(flag < 0){
+    EXCEPTION("CVodeSVtolerances failed with flag " + std::to_string(flag));
+  }
+
+  // Solve now finds CVODE already set up from this state and time
+  CvodeMemoryAccessor::MarkStart(p_model, t_start);
+#endif
+}
+
+void ReinitialiseCvode(AbstractCvodeCell* p_model, double t){
+#ifdef CHASTE_CVODE
+  void* p_cvode_mem = GetCvodeMemory(p_model);
+  if(!p_cvode_mem)
+    return;
+  realtype last_step = 0;
+  CVodeGetLastStep(p_cvode_mem, &last_step);
+  const int flag = CVodeReInit(p_cvode_mem, t, p_model->rGetStateVariables());
+  if(flag < 0){
+    EXCEPTION("CVodeReInit failed with flag " + std::to_string(flag));
+  }
+  if(last_step > 0)
+    CVodeSetInitStep(p_cvode_mem, last_step);
+#endif
+}
+
+CvodeCounters ReadCvodeCounters(void* p_cvode_mem){
+  CvodeCounters counters;
+#ifdef CHASTE_CVODE
+  if(!p_cvode_mem)
+    return counters;
+  CVodeGetNumSteps(p_cvode_mem, &counters.steps);
+  CVodeGetNumRhsEvals(p_cvode_mem, &counters.rhs_evaluations);
+  CVodeGetNumErrTestFails(p_cvode_mem, &counters.error_test_failures);
+  CVodeGetNumNonlinSolvIters(p_cvode_mem, &counters.nonlinear_iterations);
+  CVodeGetNumNonlinSolvConvFails(p_cvode_mem, &counters.nonlinear_convergence_failures);
+#if CHASTE_SUNDIALS_VERSION >= 40000
+  CVodeGetNumJacEvals(p_cvode_mem, &counters.jacobian_evaluations);
+#elif CHASTE_SUNDIALS_VERSION >= 30000
+  CVDlsGetNumJacEvals(p_cvode_mem, &counters.jacobian_evaluations);
+#else
+  CVDenseGetNumJacEvals(p_cvode_mem, &counters.jacobian_evaluations);
+#endif
+  realtype last_step = 0;
+  CVodeGetLastStep(p_cvode_mem, &last_step);
+  counters.last_step_size = last_step;
+#endif
+  return counters;
+}
+
+void CvodeStatisticsRecorder::Begin(AbstractCvodeCell* p_model, double t_start){
+  mpCvodeMem = GetCvodeMemory(p_model);
+  mBefore = ReadCvodeCounters(mpCvodeMem);
+
+  // Mirror Chaste's decision about whether to reinitialise CVODE
+  mExpectReset = !mpCvodeMem || p_model->GetForceReset() || !(std::abs(t_start - mLastEndTime) <= 1e-10*std::max(1.0, std::abs(t_start)));
+  if(!mExpectReset && !p_model->GetMinimalReset())
+    mExpectReset = p_model->GetStdVecStateVariables() != mLastEndState;
+
+  mStartTime = std::chrono::steady_clock::now();
+}
+
+void CvodeStatisticsRecorder::End(AbstractCvodeCell* p_model, double t_end){
+  CvodeCounters segment;
+  segment.wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - mStartTime).count();
+
+  void* p_cvode_mem = GetCvodeMemory(p_model);
+  const CvodeCounters after = ReadCvodeCounters(p_cvode_mem);
+  const bool reset = mExpectReset || p_cvode_mem != mpCvodeMem || after.steps < mBefore.steps || after.rhs_evaluations < mBefore.rhs_evaluations;
+
+  segment.steps = after.steps - (reset ? 0 : mBefore.steps);
+  segment.rhs_evaluations = after.rhs_evaluations - (reset ? 0 : mBefore.rhs_evaluations);
+  segment.jacobian_evaluations = after.jacobian_evaluations - (reset ? 0 : mBefore.jacobian_evaluations);
+  segment.error_test_failures = after.error_test_failures - (reset ? 0 : mBefore.error_test_failures);
+  segment.nonlinear_iterations = after.nonlinear_iterations - (reset ? 0 : mBefore.nonlinear_iterations);
+  segment.nonlinear_convergence_failures = after.nonlinear_convergence_failures - (reset ? 0 : mBefore.nonlinear_convergence_failures);
+  segment.last_step_size = after.last_step_size;
+  mTotals += segment;
+
+  mLastEndTime = t_end;
+  mLastEndState = p_model->GetStdVecStateVariables();
+}
@@ -0,0 +1,84 @@
+#ifndef CVODE_STATISTICS_HPP
+#define CVODE_STATISTICS_HPP
+
+#include "AbstractCvodeCell.hpp"
+#include <chrono>
+#include <vector>
+
+/* Counters describing how much work CVODE has done */
+struct CvodeCounters{
+  long int steps = 0;
+  long int rhs_evaluations = 0;
+  long int jacobian_evaluations = 0;
+  long int error_test_failures = 0;
+  long int nonlinear_iterations = 0;
+  long int nonlinear_convergence_failures = 0;
+  double last_step_size = 0;
+  double wall_time = 0;
+
+  CvodeCounters& operator+=(const CvodeCounters& other);
+};
+
+/* CVODE's work over a single pace */
+struct PaceStatistics : public CvodeCounters{
+  unsigned int pace = 0;
+  /* The length of the pace divided by the number of steps CVODE took, which
+     includes the steps of any failed attempts that were retried. This isn't
+     measured from the step sizes themselves, which Chaste doesn't expose */
+  double time_per_step = 0;
+};
+
+/* Chaste keeps its CVODE memory to itself, so read the pointer through a
+   derived class. Returns nullptr if the model hasn't been solved yet */
+void* GetCvodeMemory(AbstractCvodeCell* p_model);
+
+/* Chaste sets CVODE up inside Solve with one absolute tolerance for every
+   state variable. This does the same setup for a solve from t_start, then
+   gives each state variable its own absolute tolerance and records the start
+   so that Solve doesn't reinitialise CVODE over them. Chaste's next reset
+   (a forced reset, a discontinuous start time or, unless minimal reset is on,
+   a modified state) restores the scalar tolerance, so call this before every
+   solve. The model must not be set to force resets */
+void SetupCvodeWithTolerances(AbstractCvodeCell* p_model, double t_start, double max_timestep, double tol_rel, const std::vector<double>& tol_abs);
+
+/* Restart the model's CVODE integration at time t from its current state,
+   as CVODE's step history is no use across a discontinuity in the right
+   hand side. Unlike a Chaste reset this keeps the CVODE memory, its
+   settings and tolerances, and starts from the last step size rather than
+   CVODE's cautious first step. The counters restart from zero. Does nothing
+   if CVODE hasn't been set up yet */
+void ReinitialiseCvode(AbstractCvodeCell* p_model, double t);
+
+/* The counters CVODE has accumulated since it was last (re)initialised */
+CvodeCounters ReadCvodeCounters(void* p_cvode_mem);
+
+/* Accumulates CVODE's work over a sequence of solves of one model.
+
+   Call Begin before and End after each call to Solve or SolveAndUpdateState.
+   CVODE's counters restart whenever Chaste reinitialises the solver (a forced
+   reset, a discontinuous start time or, unless minimal reset is on, a modified
+   state), so in that case the counters read at the end are all new work. We
+   also treat any counter going backwards as a reset.
+ */
+class CvodeStatisticsRecorder{
+public:
+  void Begin(AbstractCvodeCell* p_model, double t_start);
+  void End(AbstractCvodeCell* p_model, double t_end);
+
+  const CvodeCounters& rGetTotals() const {return mTotals;}
+  void Reset(){mTotals = CvodeCounters();}
+
+  /* Count work done by a CVODE instance other than the model's own */
+  void Add(const CvodeCounters& counters){mTotals += counters;}
+
+private:
+  CvodeCounters mTotals;
+  CvodeCounters mBefore;
+  void* mpCvodeMem = nullptr;
+  bool mExpectReset = true;
+  double mLastEndTime = NAN;
+  std::vector<double> mLastEndState;
+  std::chrono::steady_clock::time_point mStartTime;
+};
+
+#endif
@@ -0,0 +1,210 @@
+#ifdef CHASTE_CVODE
+
+#include "CvodeStepper.hpp"
+#include "Exception.hpp"
+#include "VectorHelperFunctions.hpp"
+
+#if CHASTE_SUNDIALS_VERSION >= 30000
+#include <sunlinsol/sunlinsol_dense.h>
+#include <sunmatrix/sunmatrix_dense.h>
+#endif
+#if CHASTE_SUNDIALS_VERSION >= 30000 && CHASTE_SUNDIALS_VERSION < 40000
+#include <cvode/cvode_direct.h>
+#endif
+#if CHASTE_SUNDIALS_VERSION < 30000
+#include <cvode/cvode_dense.h>
+#endif
+
+CvodeStepper::CvodeStepper(boost::shared_ptr<AbstractCvodeCell> p_model, double tol_abs, double tol_rel, double max_timestep, long int max_steps) : mpModel(p_model), mTolAbs(tol_abs), mTolRel(tol_rel), mMaxTimestep(max_timestep), mMaxSteps(max_steps){
+  mNumberOfStateVariables = mpModel->GetNumberOfStateVariables();
+#if CHASTE_SUNDIALS_VERSION >= 70000
+  const int flag = SUNContext_Create(SUN_COMM_NULL, &mSundialsContext);
+#elif CHASTE_SUNDIALS_VERSION >= 60000
+  const int flag = SUNContext_Create(nullptr, &mSundialsContext);
+#endif
+#if CHASTE_SUNDIALS_VERSION >= 60000
+  if(flag < 0){
+    EXCEPTION("SUNContext_Create failed with flag " + std::to_string(flag));
+  }
+#endif
+  mState = NewVector();
+  mDerivatives = NewVector();
+}
+
+CvodeStepper::~CvodeStepper(){
+  FreeCvode();
+  for(N_Vector vector : {mState, mDerivatives, mTolAbsNVector}){
+    if(vector)
+      N_VDestroy(vector);
+  }
+#if CHASTE_SUNDIALS_VERSION >= 60000
+  SUNContext_Free(&mSundialsContext);
+#endif
+}
+
+N_Vector CvodeStepper::NewVector(){
+#if CHASTE_SUNDIALS_VERSION >= 60000
+  N_Vector vector = N_VNew_Serial(mNumberOfStateVariables, mSundialsContext);
+#else
+  N_Vector vector = N_VNew_Serial(mNumberOfStateVariables);
+#endif
+  if(vector == nullptr){
+    EXCEPTION("Failed to create a CVODE vector");
+  }
+  return vector;
+}
+
+void CvodeStepper::SetAbsoluteTolerances(const std::vector<double>& tol_abs){
+  if(tol_abs.size() != mNumberOfStateVariables){
+    EXCEPTION("Expected " + std::to_string(mNumberOfStateVariables) + " absolute tolerances but got " + std::to_string(tol_abs.size()));
+  }
+  mTolAbsVector = tol_abs;
+}
+
+/* Throw if a CVODE setup call failed */
+static void CheckCvodeFlag(int flag, const std::string& function_name){
+  if(flag < 0){
+    EXCEPTION(function_name + " failed with flag " + std::to_string(flag));
+  }
+}
+
+int CvodeStepper::RhsAdaptor(realtype time, N_Vector y, N_Vector ydot, void* p_data){
+  AbstractCvodeCell* p_model = static_cast<AbstractCvodeCell*>(p_data);
+  try{
+    p_model->EvaluateYDerivatives(time, y, ydot);
+  }
+  catch(const Exception&){
+    // Let CVODE try a smaller step
+    return 1;
+  }
+  return 0;
+}
+
+#if CHASTE_SUNDIALS_VERSION >= 30000
+int CvodeStepper::JacobianAdaptor(realtype time, N_Vector y, N_Vector ydot, CHASTE_CVODE_DENSE_MATRIX jacobian, void* p_data, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3){
+#else
+int CvodeStepper::JacobianAdaptor(long int N, realtype time, N_Vector y, N_Vector ydot, CHASTE_CVODE_DENSE_MATRIX jacobian, void* p_data, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3){
+#endif
+  AbstractCvodeCell* p_model = static_cast<AbstractCvodeCell*>(p_data);
+  try{
+    p_model->EvaluateAnalyticJacobian(time, y, ydot, jacobian, tmp1, tmp2, tmp3);
+  }
+  catch(const Exception&){
+    return 1;
+  }
+  return 0;
+}
+
+void CvodeStepper::SetUpCvode(double t_start){
+  FreeCvode();
+
+#if CHASTE_SUNDIALS_VERSION >= 60000
+  mpCvodeMem = CVodeCreate(CV_BDF, mSundialsContext);
+#elif CHASTE_SUNDIALS_VERSION >= 40000
+  mpCvodeMem = CVodeCreate(CV_BDF);
+#else
+  mpCvodeMem = CVodeCreate(CV_BDF, CV_NEWTON);
+#endif
+  if(mpCvodeMem == nullptr){
+    EXCEPTION("Failed to create CVODE memory");
+  }
+
+  CheckCvodeFlag(CVodeSetUserData(mpCvodeMem, (void*) mpModel.get()), "CVodeSetUserData");
+  CheckCvodeFlag(CVodeInit(mpCvodeMem, RhsAdaptor, t_start, mState), "CVodeInit");
+
+  if(mTolAbsVector.empty()){
+    CheckCvodeFlag(CVodeSStolerances(mpCvodeMem, mTolRel, mTolAbs), "CVodeSStolerances");
+  }
+  else{
+    if(!mTolAbsNVector)
+      mTolAbsNVector = NewVector();
+    CopyFromStdVector(mTolAbsVector, mTolAbsNVector);
+    CheckCvodeFlag(CVodeSVtolerances(mpCvodeMem, mTolRel, mTolAbsNVector), "CVodeSVtolerances");
+  }
+
+  CheckCvodeFlag(CVodeSetMaxStep(mpCvodeMem, mMaxTimestep), "CVodeSetMaxStep");
+  CheckCvodeFlag(CVodeSetMaxNumSteps(mpCvodeMem, mMaxSteps), "CVodeSetMaxNumSteps");
+
+#if CHASTE_SUNDIALS_VERSION >= 60000
+  mpJacobianMatrix = SUNDenseMatrix(mNumberOfStateVariables, mNumberOfStateVariables, mSundialsContext);
+  mpLinearSolver = SUNLinSol_Dense(mState, mpJacobianMatrix, mSundialsContext);
+#elif CHASTE_SUNDIALS_VERSION >= 40000
+  mpJacobianMatrix = SUNDenseMatrix(mNumberOfStateVariables, mNumberOfStateVariables);
+  mpLinearSolver = SUNLinSol_Dense(mState, mpJacobianMatrix);
+#elif CHASTE_SUNDIALS_VERSION >= 30000
+  mpJacobianMatrix = SUNDenseMatrix(mNumberOfStateVariables, mNumberOfStateVariables);
+  mpLinearSolver = SUNDenseLinearSolver(mState, mpJacobianMatrix);
+#endif
+#if CHASTE_SUNDIALS_VERSION >= 30000
+  if(mpJacobianMatrix == nullptr || mpLinearSolver == nullptr){
+    EXCEPTION("Failed to create CVODE's dense linear solver");
+  }
+#endif
+#if CHASTE_SUNDIALS_VERSION >= 40000
+  CheckCvodeFlag(CVodeSetLinearSolver(mpCvodeMem, mpLinearSolver, mpJacobianMatrix), "CVodeSetLinearSolver");
+#elif CHASTE_SUNDIALS_VERSION >= 30000
+  CheckCvodeFlag(CVDlsSetLinearSolver(mpCvodeMem, mpLinearSolver, mpJacobianMatrix), "CVDlsSetLinearSolver");
+#else
+  CheckCvodeFlag(CVDense(mpCvodeMem, mNumberOfStateVariables), "CVDense");
+#endif
+
+  if(mpModel->GetUseAnalyticJacobian()){
+#if CHASTE_SUNDIALS_VERSION >= 40000
+    CheckCvodeFlag(CVodeSetJacFn(mpCvodeMem, JacobianAdaptor), "CVodeSetJacFn");
+#elif CHASTE_SUNDIALS_VERSION >= 30000
+    CheckCvodeFlag(CVDlsSetJacFn(mpCvodeMem, JacobianAdaptor), "CVDlsSetJacFn");
+#else
+    CheckCvodeFlag(CVDlsSetDenseJacFn(mpCvodeMem, JacobianAdaptor), "CVDlsSetDenseJacFn");
+#endif
+  }
+}
+
+void CvodeStepper::FreeCvode(){
+  if(mpCvodeMem){
+    CVodeFree(&mpCvodeMem);
+    mpCvodeMem = nullptr;
+  }
+#if CHASTE_SUNDIALS_VERSION >= 30000
+  if(mpLinearSolver){
+    SUNLinSolFree(mpLinearSolver);
+    mpLinearSolver = nullptr;
+  }
+  if(mpJacobianMatrix){
+    SUNMatDestroy(mpJacobianMatrix);
+    mpJacobianMatrix = nullptr;
+  }
+#endif
+}
+
+void CvodeStepper::Solve(double t_start, double t_end, CompactTrace* p_trace){
+  CopyFromStdVector(mpModel->GetStdVecStateVariables(), mState);
+
+  // Start afresh each time, like Chaste does when the time is discontinuous
+  SetUpCvode(t_start);
+  CheckCvodeFlag(CVodeSetStopTime(mpCvodeMem, t_end), "CVodeSetStopTime");
+
+  if(p_trace){
+    mpModel->EvaluateYDerivatives(t_start, mState, mDerivatives);
+    p_trace->AddStep(t_start, NV_DATA_S(mState), NV_DATA_S(mDerivatives));
+  }
+
+  realtype time = t_start;
+  while(time < t_end){
+    const int flag = CVode(mpCvodeMem, t_end, mState, &time, CV_ONE_STEP);
+    if(flag < 0){
+      EXCEPTION("CVODE failed with flag " + std::to_string(flag) + " at time " + std::to_string(time));
+    }
+    if(p_trace){
+      CheckCvodeFlag(CVodeGetDky(mpCvodeMem, time, 1, mDerivatives), "CVodeGetDky");
+      p_trace->AddStep(time, NV_DATA_S(mState), NV_DATA_S(mDerivatives));
+    }
+    if(flag == CV_TSTOP_RETURN)
+      break;
+  }
+
+  std::vector<double> state;
+  CopyToStdVector(mState, state);
+  mpModel->SetStateVariables(state);
+}
+
+#endif // CHASTE_CVODE
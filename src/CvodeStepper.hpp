@@ -0,0 +1,86 @@
+#ifndef CVODE_STEPPER_HPP
+#define CVODE_STEPPER_HPP
+
+#ifdef CHASTE_CVODE
+
+#include "AbstractCvodeCell.hpp"
+#include "CompactTrace.hpp"
+#include <cvode/cvode.h>
+#include <nvector/nvector_serial.h>
+#include <vector>
+
+/* Integrates a model with our own CVODE instance, one internal step at a
+   time, so that every accepted step can be recorded.
+
+   Chaste's Compute only gives us the solution at fixed sampling times. This
+   drives CVODE in CV_ONE_STEP mode instead, using the model's right hand side
+   (EvaluateYDerivatives), and records each step's state and derivative (from
+   CVODE's interpolating polynomial, so no extra right hand side evaluations
+   are needed). As in Chaste's solver, the model's analytic Jacobian is used
+   unless it has none or it has been switched off, in which case CVODE
+   approximates it by difference quotients.
+
+   With SUNDIALS 6 or later each stepper has a SUNContext of its own rather
+   than Chaste's shared one, as contexts aren't thread safe. Steppers for
+   different models can then be used on different threads at once.
+
+   The model's state is read at the start of Solve and updated at the end.
+ */
+class CvodeStepper{
+public:
+  CvodeStepper(boost::shared_ptr<AbstractCvodeCell> p_model, double tol_abs, double tol_rel, double max_timestep = 1000, long int max_steps = 100000);
+
+  ~CvodeStepper();
+
+  /* Integrate from t_start to t_end, appending the initial point and every
+     accepted step to p_trace if it isn't null */
+  void Solve(double t_start, double t_end, CompactTrace* p_trace = nullptr);
+
+  /* Use a separate absolute tolerance for each state variable */
+  void SetAbsoluteTolerances(const std::vector<double>& tol_abs);
+
+  /* The CVODE instance used by the last call to Solve */
+  void* GetCvodeMemory(){return mpCvodeMem;}
+
+private:
+  CvodeStepper(const CvodeStepper&) = delete;
+  CvodeStepper& operator=(const CvodeStepper&) = delete;
+
+  static int RhsAdaptor(realtype time, N_Vector y, N_Vector ydot, void* p_data);
+
+#if CHASTE_SUNDIALS_VERSION >= 30000
+  static int JacobianAdaptor(realtype time, N_Vector y, N_Vector ydot, CHASTE_CVODE_DENSE_MATRIX jacobian, void* p_data, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3);
+#else
+  static int JacobianAdaptor(long int N, realtype time, N_Vector y, N_Vector ydot, CHASTE_CVODE_DENSE_MATRIX jacobian, void* p_data, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3);
+#endif
+
+  void SetUpCvode(double t_start);
+  void FreeCvode();
+
+  /* A new serial vector in this stepper's context */
+  N_Vector NewVector();
+
+  boost::shared_ptr<AbstractCvodeCell> mpModel;
+  unsigned int mNumberOfStateVariables;
+  double mTolAbs;
+  double mTolRel;
+  std::vector<double> mTolAbsVector;
+  double mMaxTimestep;
+  long int mMaxSteps;
+
+#if CHASTE_SUNDIALS_VERSION >= 60000
+  SUNContext mSundialsContext = nullptr;
+#endif
+  void* mpCvodeMem = nullptr;
+  N_Vector mState = nullptr;
+  N_Vector mDerivatives = nullptr;
+  N_Vector mTolAbsNVector = nullptr;
+#if CHASTE_SUNDIALS_VERSION >= 30000
+  SUNMatrix mpJacobianMatrix = nullptr;
+  SUNLinearSolver mpLinearSolver = nullptr;
+#endif
+};
+
+#endif // CHASTE_CVODE
+
+#endif
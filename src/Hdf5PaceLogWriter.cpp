@@ -0,0 +1,122 @@
+#include "Hdf5PaceLogWriter.hpp"
+#include "Exception.hpp"
+#include <cassert>
+#include <iostream>
+
+Hdf5PaceLogWriter::Hdf5PaceLogWriter(std::string file_path, const std::vector<std::string>& column_names, unsigned int chunk_size, unsigned int compression_level) : AbstractPaceLogWriter(column_names), mChunkSize(chunk_size){
+  // Keep track of the order in which the datasets are created
+  hid_t file_creation_properties = H5Pcreate(H5P_FILE_CREATE);
+  H5Pset_link_creation_order(file_creation_properties, H5P_CRT_ORDER_TRACKED | H5P_CRT_ORDER_INDEXED);
+  mFileId = H5Fcreate(file_path.c_str(), H5F_ACC_TRUNC, file_creation_properties, H5P_DEFAULT);
+  H5Pclose(file_creation_properties);
+  if(mFileId < 0){
+    EXCEPTION("Failed to create HDF5 file " + file_path);
+  }
+
+  const hsize_t initial_size = 0;
+  const hsize_t max_size = H5S_UNLIMITED;
+  const hsize_t chunk_dims = mChunkSize;
+
+  hid_t dataspace = H5Screate_simple(1, &initial_size, &max_size);
+  hid_t dataset_properties = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dataset_properties, 1, &chunk_dims);
+  H5Pset_shuffle(dataset_properties);
+  H5Pset_deflate(dataset_properties, compression_level);
+
+  for(const std::string& name : mColumnNames){
+    hid_t dataset = H5Dcreate2(mFileId, name.c_str(), H5T_NATIVE_DOUBLE, dataspace, H5P_DEFAULT, dataset_properties, H5P_DEFAULT);
+    if(dataset < 0){
+      // The destructor won't run, so release everything created so far
+      H5Pclose(dataset_properties);
+      H5Sclose(dataspace);
+      for(hid_t created_dataset : mDatasetIds){
+        H5Dclose(created_dataset);
+      }
+      mDatasetIds.clear();
+      H5Fclose(mFileId);
+      mFileId = -1;
+      EXCEPTION("Failed to create dataset " + name + " in " + file_path);
+    }
+    mDatasetIds.push_back(dataset);
+  }
+
+  H5Pclose(dataset_properties);
+  H5Sclose(dataspace);
+
+  mBuffer.resize(mColumnNames.size());
+  for(auto& column : mBuffer){
+    column.reserve(mChunkSize);
+  }
+}
+
+Hdf5PaceLogWriter::~Hdf5PaceLogWriter(){
+  // A destructor mustn't throw, so report a failure to write the last rows
+  try{
+    Close();
+  }
+  catch(const Exception& e){
+    std::cerr << "Hdf5PaceLogWriter: " << e.GetMessage() << "\n";
+  }
+}
+
+void Hdf5PaceLogWriter::AppendRow(const std::vector<double>& row){
+  assert(row.size()==mColumnNames.size());
+  for(unsigned int i = 0; i < row.size(); i++){
+    mBuffer[i].push_back(row[i]);
+  }
+  if(mBuffer[0].size() >= mChunkSize)
+    Flush();
+}
+
+void Hdf5PaceLogWriter::Flush(){
+  if(mBuffer.size()==0 || mBuffer[0].size()==0)
+    return;
+
+  const hsize_t rows = mBuffer[0].size();
+  const hsize_t new_size = mRowsWritten + rows;
+  hid_t memspace = H5Screate_simple(1, &rows, nullptr);
+
+  for(unsigned int i = 0; i < mDatasetIds.size(); i++){
+    if(H5Dset_extent(mDatasetIds[i], &new_size) < 0){
+      H5Sclose(memspace);
+      EXCEPTION("Failed to extend column " + mColumnNames[i]);
+    }
+    hid_t filespace = H5Dget_space(mDatasetIds[i]);
+    H5Sselect_hyperslab(filespace, H5S_SELECT_SET, &mRowsWritten, nullptr, &rows, nullptr);
+    if(H5Dwrite(mDatasetIds[i], H5T_NATIVE_DOUBLE, memspace, filespace, H5P_DEFAULT, mBuffer[i].data()) < 0){
+      H5Sclose(filespace);
+      H5Sclose(memspace);
+      EXCEPTION("Failed to write column " + mColumnNames[i]);
+    }
+    H5Sclose(filespace);
+    mBuffer[i].clear();
+  }
+
+  H5Sclose(memspace);
+  mRowsWritten = new_size;
+}
+
+void Hdf5PaceLogWriter::Close(){
+  if(mFileId < 0)
+    return;
+  // Release the file even if the last rows can't be written
+  std::string error;
+  try{
+    Flush();
+  }
+  catch(const Exception& e){
+    error = e.GetShortMessage();
+  }
+  for(hid_t dataset : mDatasetIds){
+    H5Dclose(dataset);
+  }
+  mDatasetIds.clear();
+  const herr_t status = H5Fclose(mFileId);
+  mFileId = -1;
+  if(error != ""){
+    EXCEPTION(error);
+  }
+  if(status < 0){
+    EXCEPTION("Failed to close HDF5 file");
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef HDF5_PACE_LOG_WRITER_HPP
+#define HDF5_PACE_LOG_WRITER_HPP
+
+#include <hdf5.h>
+#include "AbstractPaceLogWriter.hpp"
+
+/* Write each column to its own chunked, compressed and extendible HDF5
+   dataset of doubles, named after the column. Rows are buffered in memory
+   and written a chunk at a time.
+
+   Datasets are stored in creation order, so the column order can be
+   recovered when reading the file back (e.g. with h5py, using
+   track_order=True).
+ */
+class Hdf5PaceLogWriter : public AbstractPaceLogWriter{
+public:
+  Hdf5PaceLogWriter(std::string file_path, const std::vector<std::string>& column_names, unsigned int chunk_size = 1024, unsigned int compression_level = 6);
+
+  ~Hdf5PaceLogWriter();
+
+  void AppendRow(const std::vector<double>& row);
+
+  void Close();
+
+private:
+  hid_t mFileId = -1;
+  std::vector<hid_t> mDatasetIds;
+
+  unsigned int mChunkSize;
+  hsize_t mRowsWritten = 0;
+
+  /* Rows which haven't yet been written, stored by column */
+  std::vector<std::vector<double>> mBuffer;
+
+  void Flush();
+};
+
+#endif
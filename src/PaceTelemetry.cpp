@@ -0,0 +1,32 @@
+#include "PaceTelemetry.hpp"
+#include "Exception.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+std::vector<PaceRecord> PaceTelemetry::GetRecords() const{
+  std::vector<PaceRecord> records;
+  const unsigned int N = GetNumberOfRecords();
+  records.reserve(N);
+  for(unsigned long i = mNumberRecorded - N; i < mNumberRecorded; i++){
+    records.push_back(mRecords[i % mRecords.size()]);
+  }
+  return records;
+}
+
+void PaceTelemetry::Dump(std::ostream& out) const{
+  out << std::setprecision(12);
+  out << "pace event mrms apd state_norm steps rhs_evaluations error_test_failures nonlinear_convergence_failures wall_time\n";
+  for(const PaceRecord& record : GetRecords()){
+    out << record.pace << " " << (record.failed ? "failed" : (record.jump ? "jump" : "pace")) << " " << record.mrms << " " << record.apd << " " << record.state_norm << " " << record.steps << " " << record.rhs_evaluations << " " << record.error_test_failures << " " << record.nonlinear_convergence_failures << " " << record.wall_time << "\n";
+  }
+}
+
+void PaceTelemetry::Dump(std::string file_path) const{
+  std::ofstream f_out(file_path);
+  if(!f_out.is_open()){
+    EXCEPTION("Failed to open file " + file_path);
+  }
+  Dump(f_out);
+  f_out.close();
+}
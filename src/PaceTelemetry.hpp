@@ -0,0 +1,99 @@
+#ifndef PACE_TELEMETRY_HPP
+#define PACE_TELEMETRY_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include "Exception.hpp"
+#include "ChasteSerialization.hpp"
+#include <boost/serialization/vector.hpp>
+#include <string>
+#include <vector>
+
+/* What happened during one pace, or an extrapolation jump */
+struct PaceRecord{
+  unsigned int pace = 0;
+  double mrms = NAN;
+  double apd = NAN;
+  double state_norm = NAN;
+  long int steps = 0;
+  long int rhs_evaluations = 0;
+  long int error_test_failures = 0;
+  long int nonlinear_convergence_failures = 0;
+  double wall_time = 0;
+  bool jump = false;
+  bool failed = false;
+
+  template<class Archive>
+  void serialize(Archive & archive, const unsigned int version){
+    archive & pace;
+    archive & mrms;
+    archive & apd;
+    archive & state_norm;
+    archive & steps;
+    archive & rhs_evaluations;
+    archive & error_test_failures;
+    archive & nonlinear_convergence_failures;
+    archive & wall_time;
+    archive & jump;
+    archive & failed;
+  }
+};
+
+/* Keeps the last few pace records in a fixed size ring so that the history
+   leading up to a failure can be written out afterwards. Recording just
+   copies a record into preallocated storage.
+ */
+class PaceTelemetry{
+public:
+  PaceTelemetry(unsigned int capacity = 256) : mRecords(capacity){
+  }
+
+  void Record(const PaceRecord& record){
+    mRecords[mNumberRecorded % mRecords.size()] = record;
+    mNumberRecorded++;
+  }
+
+  /* The most recent record, to fill in anything only known after the pace
+     has been recorded. Only valid if GetNumberOfRecords() > 0 */
+  PaceRecord& rGetLatest(){
+    return mRecords[(mNumberRecorded - 1) % mRecords.size()];
+  }
+
+  unsigned int GetNumberOfRecords() const {
+    return std::min<unsigned long>(mNumberRecorded, mRecords.size());
+  }
+
+  /* Records in the order they were made, oldest first */
+  std::vector<PaceRecord> GetRecords() const;
+
+  /* Discards existing records */
+  void SetCapacity(unsigned int capacity){
+    if(capacity == 0){
+      EXCEPTION("Telemetry capacity must be at least 1");
+    }
+    mRecords.assign(capacity, PaceRecord());
+    mNumberRecorded = 0;
+  }
+
+  void Clear(){mNumberRecorded = 0;}
+
+  void Dump(std::ostream& out) const;
+
+  void Dump(std::string file_path) const;
+
+private:
+  std::vector<PaceRecord> mRecords;
+  unsigned long mNumberRecorded = 0;
+
+  /* Archived with a Simulation so that a resumed run's telemetry carries on
+     from the checkpoint */
+  friend class boost::serialization::access;
+  template<class Archive>
+  void serialize(Archive & archive, const unsigned int version){
+    archive & mRecords;
+    archive & mNumberRecorded;
+  }
+};
+
+#endif
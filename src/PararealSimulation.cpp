@@ -0,0 +1,203 @@
+#include "PararealSimulation.hpp"
+#include "AsyncWriter.hpp"
+#include "TraceRecorder.hpp"
+#include "CvodeStepper.hpp"
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <utility>
+
+PararealSimulation::PararealSimulation(boost::shared_ptr<AbstractCvodeCell> _p_model, ModelFactory model_factory, double _period, unsigned int threads, std::string input_path, double _tol_abs, double _tol_rel) : Simulation(_p_model, _period, input_path, _tol_abs, _tol_rel), mModelFactory(model_factory), mThreads(threads){
+  if(mThreads < 2){
+    EXCEPTION("Parareal needs at least two threads");
+  }
+  mpCoarseModel = MakeModel();
+  for(unsigned int i = 0; i < mThreads; i++){
+    mFineModels.push_back(MakeModel());
+  }
+}
+
+boost::shared_ptr<AbstractCvodeCell> PararealSimulation::MakeModel(){
+  boost::shared_ptr<AbstractCvodeCell> p_model = mModelFactory();
+  if(p_model->GetSystemInformation()->GetSystemName() != mpModel->GetSystemInformation()->GetSystemName()){
+    EXCEPTION("Parareal model factory made a " + p_model->GetSystemInformation()->GetSystemName() + " model instead of " + mpModel->GetSystemInformation()->GetSystemName());
+  }
+  // Stimulate the same way as the simulation's model (see Simulation::Simulation)
+  boost::shared_ptr<RegularStimulus> p_stimulus = p_model->UseCellMLDefaultStimulus();
+  p_stimulus->SetStartTime(0);
+  p_stimulus->SetPeriod(2*mPeriod);
+  return p_model;
+}
+
+std::vector<double> PararealSimulation::PaceFrom(boost::shared_ptr<AbstractCvodeCell> p_model, const std::vector<double>& state, double tol_abs, double tol_rel, std::vector<double>* p_trace_times, std::vector<std::vector<double>>* p_trace){
+  p_model->SetStateVariables(state);
+  /* Each stepper has its own SUNDIALS context, so unlike Chaste's solver
+     (which shares one) it can run alongside the other threads' */
+  CvodeStepper stepper(p_model, tol_abs, tol_rel, mMaxTimestep, mMaxSteps);
+  if(!p_trace_times){
+    /*Solve in two parts*/
+    stepper.Solve(0, mpStimulus->GetDuration());
+    stepper.Solve(mpStimulus->GetDuration(), mPeriod);
+    return p_model->GetStdVecStateVariables();
+  }
+
+  // Sample the pace at the same times as Simulation::SolveSegment
+  CompactTrace trace(p_model->GetNumberOfStateVariables());
+  stepper.Solve(0, mpStimulus->GetDuration(), &trace);
+  stepper.Solve(mpStimulus->GetDuration(), mPeriod, &trace);
+  p_trace_times->clear();
+  p_trace->clear();
+  for(double time : trace.GetSamplingTimes(mPaceTraceSamplingTimestep)){
+    p_trace_times->push_back(time);
+    p_trace->push_back(trace.Interpolate(time));
+  }
+  return p_model->GetStdVecStateVariables();
+}
+
+std::vector<std::vector<double>> PararealSimulation::FinePaces(const std::vector<std::vector<double>>& starts){
+  TRACE_SCOPE("FinePaces");
+  std::vector<std::vector<double>> ends(starts.size());
+  std::vector<std::exception_ptr> errors(starts.size());
+  const bool record_traces = mPaceTraceSamplingTimestep != DOUBLE_UNSET;
+  mFineTraceTimes.assign(starts.size(), {});
+  mFineTraces.assign(starts.size(), {});
+  std::vector<std::thread> threads;
+  for(unsigned int n = 0; n < starts.size(); n++){
+    threads.emplace_back([&, n](){
+      try{
+        ends[n] = record_traces ? PaceFrom(mFineModels[n], starts[n], mTolAbs, mTolRel, &mFineTraceTimes[n], &mFineTraces[n]) : PaceFrom(mFineModels[n], starts[n], mTolAbs, mTolRel);
+      }
+      catch(...){
+        errors[n] = std::current_exception();
+      }
+    });
+  }
+  for(std::thread& thread : threads)
+    thread.join();
+  for(const std::exception_ptr& error : errors){
+    if(error)
+      std::rethrow_exception(error);
+  }
+  return ends;
+}
+
+bool PararealSimulation::RunPaces(int max_paces){
+  try{
+    /* Each window runs several paces, so count paces rather than calls to
+       RunPace, and don't let a window run past max_paces */
+    mMaxPaces = max_paces;
+    while(mPaces < mMaxPaces){
+      const unsigned int paces_before = mPaces;
+      const bool finished = RunPace();
+      // A window can step over a multiple of the checkpoint interval
+      if(mCheckpointInterval > 0 && mPaces/mCheckpointInterval != paces_before/mCheckpointInterval)
+        SaveCheckpoint(mCheckpointPath);
+      if(finished || mFinished){
+        mMaxPaces = UINT_MAX;
+        return true;
+      }
+    }
+  }
+  catch(const Exception& e){
+    mMaxPaces = UINT_MAX;
+    // Keep the history leading up to the failure
+    if(mTelemetryDumpPath != "")
+      mTelemetry.Dump(mTelemetryDumpPath);
+    throw;
+  }
+  mMaxPaces = UINT_MAX;
+  return false;
+}
+
+bool PararealSimulation::RunPace(){
+  TRACE_SCOPE("PararealSimulation::RunPace");
+  if(mFinished)
+    return true;
+  if(mPaceStatisticsLogPath != ""){
+    EXCEPTION("Parareal doesn't record per-pace statistics - don't set a pace statistics log");
+  }
+  if(!mToleranceProfile.empty()){
+    EXCEPTION("Parareal doesn't support tolerance profiles");
+  }
+
+  // A pace already solved by GetMrms is the first pace of the window, so use it
+  if(HasLookAheadPace())
+    return Simulation::RunPace();
+
+  std::vector<std::vector<double>> starts;
+  std::vector<std::vector<double>> fine;
+  try{
+    SolveWindow(starts, fine);
+  }
+  catch(const Exception& e){
+    if(mMaxRetries == 0)
+      throw;
+    // Solve the first pace serially, where it can be retried
+    AsyncWriter::Instance()->WriteToStdout("Parareal window from pace " + std::to_string(mPaces + 1) + " failed (" + e.GetShortMessage() + ") - solving the pace serially\n");
+    return Simulation::RunPace();
+  }
+
+  /* Accept the window pace by pace, using the fine solution from each start,
+     so that we stop at the first pace where we've converged */
+  for(unsigned int n = 0; n < starts.size(); n++){
+    mPaces++;
+    mCurrentMrms = mrms(starts[n], fine[n]);
+    SetStateVariables(fine[n]);
+    mPaceTraceTimes = mFineTraceTimes[n];
+    mPaceTrace = mFineTraces[n];
+
+    PaceRecord record;
+    record.pace = mPaces;
+    record.mrms = mCurrentMrms;
+    record.state_norm = GetStateNorm();
+    mTelemetry.Record(record);
+
+    if(CompletePace(starts[n]))
+      return true;
+  }
+  return false;
+}
+
+void PararealSimulation::SolveWindow(std::vector<std::vector<double>>& starts, std::vector<std::vector<double>>& fine){
+  // The models may have been modified (e.g. SetIKrBlock) since the last window
+  std::vector<boost::shared_ptr<AbstractCvodeCell>> models = mFineModels;
+  models.push_back(mpCoarseModel);
+  for(auto p_model : models){
+    for(unsigned int i = 0; i < mpModel->GetNumberOfParameters(); i++){
+      p_model->SetParameter(i, mpModel->GetParameter(i));
+    }
+  }
+
+  // U[n] is the predicted state at the start of pace n of the window
+  const unsigned int K = std::min(mThreads, mMaxPaces - mPaces);
+  std::vector<std::vector<double>> U(K + 1);
+  std::vector<std::vector<double>> coarse(K);
+  U[0] = mpModel->GetStdVecStateVariables();
+  for(unsigned int n = 0; n < K; n++){
+    coarse[n] = PaceFrom(mpCoarseModel, U[n], mCoarseTolAbs, mCoarseTolRel);
+    U[n+1] = coarse[n];
+  }
+
+  unsigned int iterations = 0;
+  for(unsigned int k = 0; k < K; k++){
+    iterations++;
+    starts.assign(U.begin(), U.end() - 1);
+    fine = FinePaces(starts);
+
+    // Paces before k have already been solved exactly, so start correcting from k
+    double change = 0;
+    for(unsigned int n = k; n < K; n++){
+      std::vector<double> next_coarse = PaceFrom(mpCoarseModel, U[n], mCoarseTolAbs, mCoarseTolRel);
+      std::vector<double> next = fine[n];
+      for(unsigned int i = 0; i < next.size(); i++){
+        next[i] += next_coarse[i] - coarse[n][i];
+      }
+      change = std::max(change, mrms(U[n+1], next));
+      coarse[n] = next_coarse;
+      U[n+1] = next;
+    }
+    if(change < mPararealTolerance)
+      break;
+  }
+  mIterations.push_back(iterations);
+}
@@ -0,0 +1,98 @@
+#ifndef PARAREAL_SIMULATION_HPP
+#define PARAREAL_SIMULATION_HPP
+
+#include <climits>
+#include <functional>
+#include <string>
+#include "Simulation.hpp"
+
+/* Pace in parallel across a window of consecutive paces using the Parareal
+   iteration.
+
+   A coarse propagator G (one pace at loose tolerances) first predicts the
+   state at the start of each pace in the window. Each iteration then solves
+   every pace of the window with the fine propagator F (the simulation's own
+   tolerances) in parallel, one thread per pace, and corrects the predictions
+   in order:
+
+     U_{n+1} <- G(U_n new) + F(U_n old) - G(U_n old)
+
+   This is repeated until no boundary state changes by more than the Parareal
+   tolerance. After k iterations the first k paces are exactly those of
+   serial pacing, so a window never takes more iterations than it has paces.
+
+   Each thread needs a model of its own, so the simulation is given a factory
+   making new instances of the same model. Their parameters are copied from
+   the simulation's model before each window. The paces are solved with
+   CvodeStepper, which gives each CVODE instance its own SUNDIALS context, as
+   Chaste's solver shares one context between every model and contexts
+   aren't thread safe. A window is cut short rather than run past the
+   max_paces given to RunPaces.
+
+   Accepted paces go through the same checks as serial pacing (stopping
+   criteria, including those needing a pace trace, and periodicity
+   detection), and RunPaces checkpoints and dumps telemetry in the same way.
+   A pace solved ahead by GetMrms is committed serially before the next
+   window. If a window fails, that pace is solved serially instead so that it
+   can be retried with escalated settings. The fine models don't record
+   per-pace CVODE statistics or use a tolerance profile, so setting a pace
+   statistics log or a tolerance profile is an error.
+ */
+class PararealSimulation : public Simulation{
+public:
+  typedef std::function<boost::shared_ptr<AbstractCvodeCell>()> ModelFactory;
+
+  PararealSimulation(boost::shared_ptr<AbstractCvodeCell> _p_model, ModelFactory model_factory, double _period, unsigned int threads, std::string input_path = "", double _tol_abs=1e-8, double _tol_rel=1e-8);
+
+  /* Pace one window of paces (one per thread), or a single pace serially
+     (see above) */
+  bool RunPace();
+
+  bool RunPaces(int max_paces);
+
+  void SetCoarseTolerances(double atol, double rtol){
+    mCoarseTolAbs = atol;
+    mCoarseTolRel = rtol;
+  }
+
+  /* Stop iterating once no boundary state changes by more than this (as an mrms) */
+  void SetPararealTolerance(double tolerance){mPararealTolerance = tolerance;}
+
+  /* Parareal iterations taken by each window so far */
+  const std::vector<unsigned int>& rGetIterations(){return mIterations;}
+
+private:
+  ModelFactory mModelFactory;
+  unsigned int mThreads;
+  double mCoarseTolAbs = 1e-4;
+  double mCoarseTolRel = 1e-4;
+  double mPararealTolerance = 1e-9;
+
+  boost::shared_ptr<AbstractCvodeCell> mpCoarseModel;
+  std::vector<boost::shared_ptr<AbstractCvodeCell>> mFineModels;
+  std::vector<unsigned int> mIterations;
+
+  /* The pace count RunPaces stops at */
+  unsigned int mMaxPaces = UINT_MAX;
+
+  boost::shared_ptr<AbstractCvodeCell> MakeModel();
+
+  /* The pace trace of each fine pace in the last iteration, when the
+     stopping criterion needs one */
+  std::vector<std::vector<double>> mFineTraceTimes;
+  std::vector<std::vector<std::vector<double>>> mFineTraces;
+
+  /* Solve one pace of model starting from state at the given tolerances and
+     return the final state. If p_trace_times is given the pace is also
+     sampled every mPaceTraceSamplingTimestep into it and p_trace */
+  std::vector<double> PaceFrom(boost::shared_ptr<AbstractCvodeCell> p_model, const std::vector<double>& state, double tol_abs, double tol_rel, std::vector<double>* p_trace_times = nullptr, std::vector<std::vector<double>>* p_trace = nullptr);
+
+  /* Apply the fine propagator to each of starts in parallel */
+  std::vector<std::vector<double>> FinePaces(const std::vector<std::vector<double>>& starts);
+
+  /* Iterate Parareal over one window, giving the start of each pace and
+     its fine solution from there */
+  void SolveWindow(std::vector<std::vector<double>>& starts, std::vector<std::vector<double>>& fine);
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "ScenarioSweep.hpp"
+#include "AsyncWriter.hpp"
+#include "Exception.hpp"
+#include "PetscTools.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+// MPI message tags used by the master/worker queue
+static const int WORK_REQUEST_TAG = 1;
+static const int WORK_ASSIGNMENT_TAG = 2;
+static const int NO_MORE_WORK = -1;
+
+ScenarioSweep::ScenarioSweep(const std::vector<std::string>& model_names, const std::vector<double>& periods, const std::vector<double>& IKrBlocks, std::string output_dir) : mOutputDir(output_dir){
+  unsigned int index = 0;
+  for(unsigned int i = 0; i < model_names.size(); i++){
+    for(double period : periods){
+      for(double IKrBlock : IKrBlocks){
+        mScenarios.push_back({index++, i, model_names[i], period, IKrBlock});
+      }
+    }
+  }
+}
+
+void ScenarioSweep::Run(std::function<std::string(const Scenario&)> run_scenario){
+  const unsigned int rank = PetscTools::GetMyRank();
+  if(PetscTools::AmMaster())
+    boost::filesystem::create_directories(mOutputDir);
+  PetscTools::Barrier("ScenarioSweep::Run");
+
+  const boost::filesystem::path index_path = mOutputDir / ("index_rank_" + std::to_string(rank) + ".dat");
+  mIndexFile.open(index_path.string());
+  if(!mIndexFile.is_open()){
+    EXCEPTION("Failed to open file " + index_path.string());
+  }
+  mIndexFile << std::setprecision(20);
+
+  if(!PetscTools::IsParallel()){
+    for(const Scenario& scenario : mScenarios){
+      RunScenario(scenario, run_scenario);
+    }
+  }
+  else if(PetscTools::GetNumProcs() == 2){
+    RunShare(run_scenario);
+  }
+  else if(PetscTools::AmMaster()){
+    RunMaster();
+  }
+  else{
+    RunWorker(run_scenario);
+  }
+
+  mIndexFile.close();
+  PetscTools::Barrier("ScenarioSweep::Run");
+  if(PetscTools::AmMaster())
+    MergeIndexFiles();
+}
+
+void ScenarioSweep::RunScenario(const Scenario& scenario, std::function<std::string(const Scenario&)>& run_scenario){
+  std::string output;
+  std::string status = "ok";
+  const auto start = std::chrono::steady_clock::now();
+  try{
+    output = run_scenario(scenario);
+  }
+  catch(const Exception& e){
+    AsyncWriter::Instance()->WriteToStdout("Scenario " + std::to_string(scenario.index) + " failed: " + e.GetMessage() + "\n");
+    status = "failed";
+    mFailures++;
+  }
+  const double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  mIndexFile << scenario.index << " " << scenario.model_name << " " << scenario.period << " " << scenario.IKrBlock << " " << PetscTools::GetMyRank() << " " << status << " " << wall_time << " " << (output==""?"-":output) << "\n";
+  mIndexFile.flush();
+}
+
+void ScenarioSweep::RunMaster(){
+  /* Hand out scenarios in order until there are none left, then tell each
+     worker to stop the next time it asks for work */
+  unsigned int next_scenario = 0;
+  unsigned int active_workers = PetscTools::GetNumProcs() - 1;
+  while(active_workers > 0){
+    int request;
+    MPI_Status status;
+    MPI_Recv(&request, 1, MPI_INT, MPI_ANY_SOURCE, WORK_REQUEST_TAG, PetscTools::GetWorld(), &status);
+
+    int assignment = NO_MORE_WORK;
+    if(next_scenario < mScenarios.size()){
+      assignment = next_scenario++;
+      AsyncWriter::Instance()->WriteToStdout("Sending scenario " + std::to_string(assignment) + " to process " + std::to_string(status.MPI_SOURCE) + "\n");
+    }
+    else{
+      active_workers--;
+    }
+    MPI_Send(&assignment, 1, MPI_INT, status.MPI_SOURCE, WORK_ASSIGNMENT_TAG, PetscTools::GetWorld());
+  }
+}
+
+void ScenarioSweep::RunShare(std::function<std::string(const Scenario&)>& run_scenario){
+  // Neither process waits on the other until the final barrier
+  PetscTools::IsolateProcesses(true);
+  for(unsigned int i = PetscTools::GetMyRank(); i < mScenarios.size(); i += PetscTools::GetNumProcs()){
+    RunScenario(mScenarios[i], run_scenario);
+  }
+  PetscTools::IsolateProcesses(false);
+}
+
+void ScenarioSweep::RunWorker(std::function<std::string(const Scenario&)>& run_scenario){
+  while(true){
+    int request = 0;
+    int assignment;
+    MPI_Send(&request, 1, MPI_INT, 0, WORK_REQUEST_TAG, PetscTools::GetWorld());
+    MPI_Recv(&assignment, 1, MPI_INT, 0, WORK_ASSIGNMENT_TAG, PetscTools::GetWorld(), MPI_STATUS_IGNORE);
+    if(assignment == NO_MORE_WORK)
+      break;
+
+    // Other processes are busy with their own scenarios, so don't synchronise with them
+    PetscTools::IsolateProcesses(true);
+    RunScenario(mScenarios[assignment], run_scenario);
+    PetscTools::IsolateProcesses(false);
+  }
+}
+
+void ScenarioSweep::MergeIndexFiles(){
+  std::vector<std::pair<unsigned int, std::string>> lines;
+  for(unsigned int rank = 0; rank < PetscTools::GetNumProcs(); rank++){
+    std::ifstream index_file((mOutputDir / ("index_rank_" + std::to_string(rank) + ".dat")).string());
+    std::string line;
+    while(std::getline(index_file, line)){
+      if(line=="")
+        continue;
+      std::stringstream line_ss(line);
+      unsigned int index;
+      line_ss >> index;
+      lines.push_back({index, line});
+    }
+  }
+  std::sort(lines.begin(), lines.end());
+
+  std::ofstream merged_file((mOutputDir / "index.dat").string());
+  merged_file << "scenario model_name period IKrBlock rank status wall_time output_dir\n";
+  for(auto line : lines){
+    merged_file << line.second << "\n";
+  }
+  merged_file.close();
+  AsyncWriter::Instance()->WriteToStdout("Completed " + std::to_string(lines.size()) + " of " + std::to_string(mScenarios.size()) + " scenarios\n");
+}
@@ -0,0 +1,62 @@
+#ifndef SCENARIO_SWEEP_HPP
+#define SCENARIO_SWEEP_HPP
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+/* A single model/period/IKr block combination */
+struct Scenario{
+  unsigned int index;
+  unsigned int model_index;
+  std::string model_name;
+  double period;
+  double IKrBlock;
+};
+
+/* Run a list of scenarios, distributing them across MPI processes if more
+   than one is available.
+
+   When running on three or more processes, process 0 hands out scenarios one
+   at a time to the other processes as they become free, so that long
+   scenarios don't hold up the rest of the sweep. Process 0 only hands out
+   work, so N processes run N-1 scenarios at a time. With exactly two
+   processes a dedicated master would leave the sweep serial, so instead the
+   scenarios are split between the two processes in turn (even indices on
+   process 0, odd on process 1). Each process runs its scenarios in isolation
+   (see PetscTools::IsolateProcesses) and writes its own index file listing
+   the scenarios it ran. These are merged into a single index by the master
+   process once every scenario has finished.
+
+   With a single process the scenarios are simply run in order.
+ */
+class ScenarioSweep{
+public:
+  ScenarioSweep(const std::vector<std::string>& model_names, const std::vector<double>& periods, const std::vector<double>& IKrBlocks, std::string output_dir);
+
+  /* Run every scenario. run_scenario should return the directory its output
+     was written to. Exceptions thrown by run_scenario are recorded in the
+     index and the sweep carries on with the next scenario. */
+  void Run(std::function<std::string(const Scenario&)> run_scenario);
+
+  const std::vector<Scenario>& rGetScenarios(){return mScenarios;}
+
+  /* The number of scenarios which failed on this process */
+  unsigned int GetNumberOfFailures(){return mFailures;}
+
+private:
+  std::vector<Scenario> mScenarios;
+  boost::filesystem::path mOutputDir;
+  std::ofstream mIndexFile;
+  unsigned int mFailures = 0;
+
+  void RunScenario(const Scenario& scenario, std::function<std::string(const Scenario&)>& run_scenario);
+  void RunMaster();
+  void RunShare(std::function<std::string(const Scenario&)>& run_scenario);
+  void RunWorker(std::function<std::string(const Scenario&)>& run_scenario);
+  void MergeIndexFiles();
+};
+
+#endif
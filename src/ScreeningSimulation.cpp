@@ -0,0 +1,155 @@
+#include "ScreeningSimulation.hpp"
+#include "AsyncWriter.hpp"
+#include "TraceRecorder.hpp"
+#include "VectorHelperFunctions.hpp"
+#include <cmath>
+
+ScreeningSimulation::ScreeningSimulation(boost::shared_ptr<AbstractCvodeCell> _p_model, double _period, std::string input_path, double screening_timestep, double _tol_abs, double _tol_rel) : Simulation(_p_model, _period, input_path, _tol_abs, _tol_rel), mScreeningTimestep(screening_timestep){
+  if(screening_timestep <= 0 || screening_timestep > mpStimulus->GetDuration()){
+    EXCEPTION("The screening timestep must be positive and resolve the stimulus");
+  }
+  FindGates();
+}
+
+void ScreeningSimulation::FindGates(){
+  const unsigned int N = mpModel->GetNumberOfStateVariables();
+  const std::vector<std::string>& units = mpModel->GetSystemInformation()->rGetStateVariableUnits();
+  std::vector<unsigned int> dimensionless;
+  for(unsigned int i = 0; i < units.size(); i++){
+    if(units[i] == "dimensionless")
+      dimensionless.push_back(i);
+  }
+
+  /* Nudge each dimensionless variable in turn and see which of the others'
+     derivatives move. A Markov chain occupancy (or anything else driven by
+     another dimensionless variable) moves, so isn't treated as a gate */
+  N_Vector y = nullptr, dy = nullptr, dy_nudged = nullptr;
+  CreateVectorIfEmpty(y, N);
+  CreateVectorIfEmpty(dy, N);
+  CreateVectorIfEmpty(dy_nudged, N);
+  CopyFromStdVector(mpModel->GetStdVecStateVariables(), y);
+  mpModel->EvaluateYDerivatives(0, y, dy);
+  std::vector<bool> coupled(N, false);
+  for(unsigned int j : dimensionless){
+    const double value = NV_Ith_S(y, j);
+    NV_Ith_S(y, j) += mNudge;
+    mpModel->EvaluateYDerivatives(0, y, dy_nudged);
+    NV_Ith_S(y, j) = value;
+    for(unsigned int i : dimensionless){
+      if(i != j && NV_Ith_S(dy_nudged, i) != NV_Ith_S(dy, i))
+        coupled[i] = true;
+    }
+  }
+  DeleteVector(y);
+  DeleteVector(dy);
+  DeleteVector(dy_nudged);
+
+  mGateIndices.clear();
+  for(unsigned int i : dimensionless){
+    if(!coupled[i])
+      mGateIndices.push_back(i);
+  }
+}
+
+void ScreeningSimulation::ScreenPace(){
+  TRACE_SCOPE("ScreenPace");
+  const unsigned int N = mpModel->GetNumberOfStateVariables();
+
+  N_Vector y = nullptr, dy = nullptr, dy_nudged = nullptr;
+  CreateVectorIfEmpty(y, N);
+  CreateVectorIfEmpty(dy, N);
+  CreateVectorIfEmpty(dy_nudged, N);
+  CopyFromStdVector(mpModel->GetStdVecStateVariables(), y);
+  std::vector<double> decay_rates(N, 0);
+  std::vector<double> gates(mGateIndices.size());
+
+  const unsigned int steps = std::round(mPeriod/mScreeningTimestep);
+  const double dt = mPeriod/steps;
+  for(unsigned int n = 0; n < steps; n++){
+    mpModel->EvaluateYDerivatives(n*dt, y, dy);
+
+    /* Each gate's rate is linear in the gate and independent of the other
+       gates (see FindGates), so one nudge of them all finds every slope */
+    if(!mGateIndices.empty()){
+      for(unsigned int j = 0; j < mGateIndices.size(); j++){
+        gates[j] = NV_Ith_S(y, mGateIndices[j]);
+        NV_Ith_S(y, mGateIndices[j]) += mNudge;
+      }
+      mpModel->EvaluateYDerivatives(n*dt, y, dy_nudged);
+      for(unsigned int j = 0; j < mGateIndices.size(); j++){
+        const unsigned int i = mGateIndices[j];
+        NV_Ith_S(y, i) = gates[j];
+        decay_rates[i] = (NV_Ith_S(dy_nudged, i) - NV_Ith_S(dy, i))/mNudge;
+      }
+    }
+
+    for(unsigned int i = 0; i < N; i++){
+      // Rush-Larsen where the variable decays towards a steady state, otherwise forward Euler
+      const double rate = decay_rates[i];
+      NV_Ith_S(y, i) += rate < 0 ? std::expm1(rate*dt)/rate*NV_Ith_S(dy, i) : dt*NV_Ith_S(dy, i);
+    }
+  }
+
+  std::vector<double> final_state;
+  CopyToStdVector(y, final_state);
+  DeleteVector(y);
+  DeleteVector(dy);
+  DeleteVector(dy_nudged);
+
+  for(double value : final_state){
+    if(!std::isfinite(value)){
+      EXCEPTION("Screening pace " + std::to_string(mPaces) + " diverged - try a smaller screening timestep");
+    }
+  }
+  mpModel->SetStateVariables(final_state);
+}
+
+bool ScreeningSimulation::RunPace(){
+  if(mScreened){
+    if(!mPromoted)
+      return true;
+    return Simulation::RunPace();
+  }
+
+  TRACE_SCOPE("ScreeningSimulation::RunPace");
+  mPaces++;
+  mScreeningPaces++;
+  const std::vector<double> previous_state = mpModel->GetStdVecStateVariables();
+  ScreenPace();
+  mStateVariables = mpModel->GetStdVecStateVariables();
+  mCurrentMrms = mrms(previous_state, mStateVariables);
+
+  PaceRecord record;
+  record.pace = mPaces;
+  record.mrms = mCurrentMrms;
+  record.state_norm = GetStateNorm();
+  mTelemetry.Record(record);
+
+  if(mCurrentMrms < mScreeningThreshold){
+    FinishScreening(!mPromotionCriterion || mPromotionCriterion(*this));
+    return mFinished;
+  }
+
+  if(mCurrentMrms < 0.9*mBestScreeningMrms){
+    mBestScreeningMrms = mCurrentMrms;
+    mStalledPaces = 0;
+  }
+  else if(++mStalledPaces >= mMaxStalledPaces){
+    // The screened state isn't converged enough to judge, so let CVODE finish it
+    AsyncWriter::Instance()->WriteToStdout("Screening stalled at mrms " + std::to_string(mCurrentMrms) + "\n");
+    FinishScreening(true);
+  }
+  return false;
+}
+
+void ScreeningSimulation::FinishScreening(bool promoted){
+  mScreened = true;
+  mPromoted = promoted;
+  AsyncWriter::Instance()->WriteToStdout("Screening finished after " + std::to_string(mPaces) + " paces - " + (mPromoted ? "refining with CVODE\n" : "not refining\n"));
+  if(!mPromoted){
+    mFinished = true;
+    return;
+  }
+  // CVODE starts afresh from the screened state
+  mpModel->ResetSolver();
+}
@@ -0,0 +1,85 @@
+#ifndef SCREENING_SIMULATION_HPP
+#define SCREENING_SIMULATION_HPP
+
+#include <cmath>
+#include <functional>
+#include <string>
+#include "Simulation.hpp"
+
+/* A cheap first pass for large parameter scans.
+
+   Paces are first integrated at a fixed timestep (0.05ms by default), which
+   costs far fewer right hand side evaluations than CVODE at tight
+   tolerances. Gating variables are stepped with Rush-Larsen, which is stable
+   however fast the gate is: one extra evaluation of the right hand side,
+   with every gate nudged, gives each gate's decay rate, as a gate's rate
+   depends only on itself and the voltage. The gates are the dimensionless
+   state variables whose derivatives don't depend on any other dimensionless
+   variable, which leaves out Markov chain occupancies. The other variables
+   use forward Euler. Screening stops when the mrms between paces falls below
+   the screening threshold (1e-5 by default), as the fixed step only gets
+   close to the limit cycle anyway.
+
+   The screened state is then passed to the promotion criterion. If the
+   parameter set is of interest, pacing carries on from the screened state
+   with CVODE in double precision until the usual convergence criterion is
+   met. Otherwise the simulation finishes without ever using CVODE. If
+   rounding (or alternans) stops screening from reaching its threshold, so
+   that the mrms hasn't fallen by 10% over the last SetMaxStalledPaces paces,
+   the parameter set is refined with CVODE without consulting the criterion.
+ */
+class ScreeningSimulation : public Simulation{
+public:
+  ScreeningSimulation(boost::shared_ptr<AbstractCvodeCell> _p_model, double _period, std::string input_path = "", double screening_timestep = 0.05, double _tol_abs=1e-8, double _tol_rel=1e-8);
+
+  bool RunPace();
+
+  void SetScreeningThreshold(double threshold){mScreeningThreshold = threshold;}
+
+  /* Decide whether a screened parameter set is worth refining. By default
+     every one is */
+  void SetPromotionCriterion(std::function<bool(ScreeningSimulation&)> criterion){mPromotionCriterion = criterion;}
+
+  bool IsScreening(){return !mScreened;}
+
+  bool IsPromoted(){return mPromoted;}
+
+  /* Paces run in screening mode */
+  unsigned int GetScreeningPaces(){return mScreeningPaces;}
+
+  /* The state variables stepped with Rush-Larsen */
+  const std::vector<unsigned int>& rGetGateIndices(){return mGateIndices;}
+
+  /* Give up screening if the mrms hasn't fallen by 10% in this many paces
+     (100 by default) */
+  void SetMaxStalledPaces(unsigned int paces){mMaxStalledPaces = paces;}
+
+private:
+  double mScreeningTimestep;
+  double mScreeningThreshold = 1e-5;
+  std::function<bool(ScreeningSimulation&)> mPromotionCriterion;
+  bool mScreened = false;
+  bool mPromoted = false;
+  unsigned int mScreeningPaces = 0;
+
+  /* The lowest mrms so far, and the paces since it last fell by 10% */
+  double mBestScreeningMrms = INFINITY;
+  unsigned int mStalledPaces = 0;
+  unsigned int mMaxStalledPaces = 100;
+
+  std::vector<unsigned int> mGateIndices;
+
+  /* The change in each gate used to find its decay rate */
+  const double mNudge = 1e-6;
+
+  /* Set mGateIndices from the model's current state */
+  void FindGates();
+
+  /* Integrate one pace at the screening timestep */
+  void ScreenPace();
+
+  /* Stop screening, refining with CVODE if promoted */
+  void FinishScreening(bool promoted);
+};
+
+#endif
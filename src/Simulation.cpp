@@ -1,6 +1,13 @@
 #include "Simulation.hpp"
+#include "CheckpointArchiveTypes.hpp"
+#include "StateFile.hpp"
+#include "AsyncWriter.hpp"
+#include "CvodeStepper.hpp"
+#include "VectorHelperFunctions.hpp"
+#include "TraceRecorder.hpp"
 #include <iomanip>
 #include <algorithm>
+#include <boost/functional/hash.hpp>
 
 Simulation::Simulation(boost::shared_ptr<AbstractCvodeCell> _p_model, double _period, std::string input_path, double _tol_abs, double _tol_rel) : mpModel(_p_model), mPeriod(_period), mTolAbs(_tol_abs), mTolRel(_tol_rel){
   mFinished = false;
@@ -9,8 +16,8 @@ Simulation::Simulation(boost::shared_ptr<AbstractCvodeCell> _p_model, double _pe
   //There's no need to be near the second stimulus because Solve is called for
   //each pace
   mpStimulus->SetPeriod(2*mPeriod);
-  mpModel->SetMaxSteps(1e5);
-  mpModel->SetMaxTimestep(1000);
+  mpModel->SetMaxSteps(mMaxSteps);
+  mpModel->SetMaxTimestep(mMaxTimestep);
   mpModel->SetTolerances(mTolAbs, mTolRel);
   mNumberOfStateVariables = mpModel->GetSystemInformation()->rGetStateVariableNames().size();
   if(input_path.length()>=1){
@@ -18,6 +25,13 @@ Simulation::Simulation(boost::shared_ptr<AbstractCvodeCell> _p_model, double _pe
   }
   mStateVariables = mpModel->GetStdVecStateVariables();
   SetTolerances(_tol_abs, _tol_rel);
+  SetDefaultTelemetryDumpPath();
+}
+
+void Simulation::SetDefaultTelemetryDumpPath(){
+  if(const char* output_dir = getenv("CHASTE_TEST_OUTPUT")){
+    mTelemetryDumpPath = (boost::filesystem::path(output_dir) / "telemetry" / (mpModel->GetSystemInformation()->GetSystemName() + "_" + std::to_string(int(mPeriod)) + "ms.dat")).string();
+  }
 }
 
 Simulation::~Simulation(){
@@ -25,66 +39,579 @@ Simulation::~Simulation(){
   mpStimulus->SetPeriod(mPeriod);
   mpModel->SetForceReset(true);
 
+  if(mPaceStatisticsLogPath != "")
+    AsyncWriter::Instance()->Close(mPaceStatisticsLogPath);
+
   // Return IKr block to its original value
   if(mDefaultGKr!=DOUBLE_UNSET)
     SetIKrBlock(mDefaultGKr);
 }
 
 bool Simulation::RunPaces(int max_paces){
-  RunPace();
-  mpModel->SetForceReset(false);
-  for(int i = 1; i < max_paces; i++){
-    if(RunPace() || mFinished)
-      return true;
+  try{
+    RunPace();
+    CheckpointIfDue();
+    mpModel->SetForceReset(false);
+    for(int i = 1; i < max_paces; i++){
+      const bool finished = RunPace();
+      CheckpointIfDue();
+      if(finished || mFinished)
+        return true;
+    }
+  }
+  catch(const Exception& e){
+    // Keep the history leading up to the failure. This mustn't throw, so
+    // any problem writing the file is reported by the next Flush
+    if(mTelemetryDumpPath != ""){
+      std::ostringstream telemetry;
+      mTelemetry.Dump(telemetry);
+      boost::system::error_code error;
+      boost::filesystem::create_directories(boost::filesystem::path(mTelemetryDumpPath).parent_path(), error);
+      AsyncWriter::Instance()->Open(mTelemetryDumpPath);
+      AsyncWriter::Instance()->Write(mTelemetryDumpPath, telemetry.str());
+      AsyncWriter::Instance()->Close(mTelemetryDumpPath);
+      AsyncWriter::Instance()->WriteToStdout("Wrote the last " + std::to_string(mTelemetry.GetNumberOfRecords()) + " paces to " + mTelemetryDumpPath + "\n");
+    }
+    throw;
   }
   return false;
 }
 
+bool Simulation::RunToleranceLadder(const std::vector<double>& tolerances, int max_paces_per_rung, std::vector<double> thresholds){
+  TRACE_SCOPE("RunToleranceLadder");
+  if(tolerances.empty()){
+    EXCEPTION("The tolerance ladder needs at least one tolerance");
+  }
+  if(thresholds.empty()){
+    for(double tolerance : tolerances)
+      thresholds.push_back(std::max(tolerance, mThreshold));
+  }
+  else if(thresholds.size() != tolerances.size()){
+    EXCEPTION("The tolerance ladder needs one threshold per tolerance");
+  }
+
+  const double threshold = mThreshold;
+  mToleranceLadderPaces.clear();
+  bool converged = false;
+  for(unsigned int i = 0; i < tolerances.size(); i++){
+    SetTolerances(tolerances[i], tolerances[i]);
+    // Don't let CVODE carry its history over from the looser tolerance
+    mpModel->ResetSolver();
+    mPersistentEndState.clear();
+    mThreshold = thresholds[i];
+    mFinished = false;
+    mPaceEndStates.clear();
+    if(mpStoppingCriterion)
+      mpStoppingCriterion->Reset();
+
+    const unsigned int paces_before = mPaces;
+    converged = RunPaces(max_paces_per_rung);
+    mToleranceLadderPaces.push_back(mPaces - paces_before);
+    std::ostringstream message;
+    message << "Tolerance " << tolerances[i] << (converged ? " converged after " : " stopped after ") << mPaces - paces_before << " paces\n";
+    AsyncWriter::Instance()->WriteToStdout(message.str());
+  }
+  mThreshold = threshold;
+  return converged;
+}
+
+void Simulation::CheckpointIfDue(){
+  if(mCheckpointInterval > 0 && mPaces % mCheckpointInterval == 0)
+    SaveCheckpoint(mCheckpointPath);
+}
+
+void Simulation::SaveCheckpoint(std::string path){
+  TRACE_SCOPE("SaveCheckpoint");
+  // Write to a temporary file first so that an interruption can't leave a partial checkpoint
+  const std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream ofs(tmp_path, std::ios::binary);
+    if(!ofs.is_open()){
+      EXCEPTION("Failed to open file " + tmp_path);
+    }
+    boost::archive::binary_oarchive output_arch(ofs);
+    WriteCheckpoint(output_arch);
+  }
+  boost::filesystem::rename(tmp_path, path);
+}
+
+void Simulation::LoadCheckpoint(std::string path){
+  std::ifstream ifs(path, std::ios::binary);
+  if(!ifs.is_open()){
+    EXCEPTION("Couldn't open file " + path);
+  }
+  boost::archive::binary_iarchive input_arch(ifs);
+  ReadCheckpoint(input_arch);
+  AsyncWriter::Instance()->WriteToStdout("Resuming from pace " + std::to_string(mPaces) + "\n");
+}
+
+void Simulation::WriteCheckpoint(boost::archive::binary_oarchive& rArchive) const{
+  rArchive << *this;
+}
+
+void Simulation::ReadCheckpoint(boost::archive::binary_iarchive& rArchive){
+  rArchive >> *this;
+}
+
 bool Simulation::RunPace(){
+  TRACE_SCOPE("Simulation::RunPace");
   mPaces++;
   if(mFinished)
     return false;
-  if(mTerminateOnConvergence){
+  const std::vector<double> previous_state = mpModel->GetStdVecStateVariables();
+  SolvePace();
+  return CompletePace(previous_state);
+}
+
+bool Simulation::CompletePace(const std::vector<double>& previous_state){
+  mStateVariables = mpModel->GetStdVecStateVariables();
+  if(!mTerminateOnConvergence){
+    DetectPeriodicity(mStateVariables);
+    return false;
+  }
+  mCurrentMrms = mrms(previous_state, mStateVariables);
+  mTelemetry.rGetLatest().mrms = mCurrentMrms;
+  if(HasConverged(previous_state, mStateVariables)){
+    mFinished = true;
+    AsyncWriter::Instance()->WriteToStdout("finished after " + std::to_string(mPaces) + " paces \n");
+    return true;
+  }
+  if(DetectPeriodicity(mStateVariables) > 1){
+    mFinished = true;
+    AsyncWriter::Instance()->WriteToStdout("finished after " + std::to_string(mPaces) + " paces on a period " + std::to_string(mPeriodicity) + " orbit\n");
+    return true;
+  }
+  return false;
+}
+
+void Simulation::SolvePace(){
+  TRACE_SCOPE("SolvePace");
+  if(!CommitLookAheadPace())
+    mLastPaceStats = MeasurePace();
+  mLastPaceStats.pace = mPaces;
+
+  PaceRecord record;
+  record.pace = mPaces;
+  record.state_norm = GetStateNorm();
+  record.steps = mLastPaceStats.steps;
+  record.rhs_evaluations = mLastPaceStats.rhs_evaluations;
+  record.error_test_failures = mLastPaceStats.error_test_failures;
+  record.nonlinear_convergence_failures = mLastPaceStats.nonlinear_convergence_failures;
+  record.wall_time = mLastPaceStats.wall_time;
+  mTelemetry.Record(record);
+
+  if(mPaceStatisticsLogPath != ""){
+    std::ostringstream row;
+    row << std::setprecision(20);
+    row << mLastPaceStats.pace << " " << mLastPaceStats.steps << " " << mLastPaceStats.rhs_evaluations << " " << mLastPaceStats.jacobian_evaluations << " " << mLastPaceStats.error_test_failures << " " << mLastPaceStats.nonlinear_iterations << " " << mLastPaceStats.nonlinear_convergence_failures << " " << mLastPaceStats.last_step_size << " " << mLastPaceStats.time_per_step << " " << mLastPaceStats.wall_time << "\n";
+    AsyncWriter::Instance()->Write(mPaceStatisticsLogPath, row.str());
+  }
+}
+
+PaceStatistics Simulation::MeasurePace(){
+  const CvodeCounters totals_before = mCvodeStatistics.rGetTotals();
+  const std::vector<double> start_state = mpModel->GetStdVecStateVariables();
+  unsigned int retry = 0;
+  while(true){
+    try{
+      SolvePaceSegments();
+      break;
+    }
+    catch(const Exception& e){
+      PaceRecord record;
+      record.pace = mPaces;
+      record.state_norm = GetStateNorm();
+      record.failed = true;
+      mTelemetry.Record(record);
+
+      mpModel->SetStateVariables(start_state);
+      mpStimulus->SetStartTime(0);
+      if(retry >= mMaxRetries){
+        if(retry > 0)
+          SetRetryLevel(0);
+        throw;
+      }
+      retry++;
+      mRetries++;
+      AsyncWriter::Instance()->WriteToStdout("Pace " + std::to_string(mPaces) + " failed (" + e.GetShortMessage() + ") - retrying with " + SetRetryLevel(retry) + "\n");
+    }
+  }
+  if(retry > 0){
+    SetRetryLevel(0);
+    AsyncWriter::Instance()->WriteToStdout("Pace " + std::to_string(mPaces) + " succeeded after " + std::to_string(retry) + " retries - returning to normal solver settings\n");
+  }
+
+  // Work out this pace's share of the totals
+  const CvodeCounters& totals = mCvodeStatistics.rGetTotals();
+  PaceStatistics statistics;
+  statistics.steps = totals.steps - totals_before.steps;
+  statistics.rhs_evaluations = totals.rhs_evaluations - totals_before.rhs_evaluations;
+  statistics.jacobian_evaluations = totals.jacobian_evaluations - totals_before.jacobian_evaluations;
+  statistics.error_test_failures = totals.error_test_failures - totals_before.error_test_failures;
+  statistics.nonlinear_iterations = totals.nonlinear_iterations - totals_before.nonlinear_iterations;
+  statistics.nonlinear_convergence_failures = totals.nonlinear_convergence_failures - totals_before.nonlinear_convergence_failures;
+  statistics.last_step_size = totals.last_step_size;
+  statistics.wall_time = totals.wall_time - totals_before.wall_time;
+  statistics.time_per_step = statistics.steps > 0 ? mPeriod/statistics.steps : 0;
+  return statistics;
+}
+
+std::string Simulation::SetRetryLevel(unsigned int level){
+  std::string description = "normal settings";
+  mRetryLevel = level;
+  mpModel->SetMaxSteps(mMaxSteps);
+  mpModel->SetTolerances(mTolAbs, mTolRel);
+  mpModel->SetMaxTimestep(mMaxTimestep);
+  if(level >= 1){
+    mpModel->SetMaxSteps(GetRetryMaxSteps());
+    description = "10x max steps";
+  }
+  if(level >= 2){
+    mpModel->SetTolerances(GetRetryToleranceFactor()*mTolAbs, GetRetryToleranceFactor()*mTolRel);
+    description += ", 100x tighter tolerances";
+  }
+  if(level >= 3){
+    mpModel->SetMaxTimestep(GetRetryMaxTimestep());
+    description += ", maximum timestep " + std::to_string(GetRetryMaxTimestep()) + "ms";
+  }
+  // Make sure CVODE picks up the new settings
+  mpModel->ResetSolver();
+  mPersistentEndState.clear();
+  return description;
+}
+
+void Simulation::SetMaxRetries(unsigned int max_retries){
+  if(max_retries > 3){
+    EXCEPTION("The maximum number of retries must be at most 3");
+  }
+  mMaxRetries = max_retries;
+}
+
+void Simulation::SetMaxSteps(long max_steps){
+  if(max_steps < 1){
+    EXCEPTION("The maximum number of steps must be positive");
+  }
+  mMaxSteps = max_steps;
+  mLookAheadPace.valid = false;
+  SetRetryLevel(mRetryLevel);
+}
+
+std::vector<double> Simulation::GetParameters(){
+  std::vector<double> parameters;
+  for(unsigned int i = 0; i < mpModel->GetNumberOfParameters(); i++){
+    parameters.push_back(mpModel->GetParameter(i));
+  }
+  return parameters;
+}
+
+bool Simulation::HasLookAheadPace(){
+  // Compare everything the pace depends on exactly, so a committed pace is
+  // identical to solving it again
+  return mLookAheadPace.valid && mLookAheadPace.period == mPeriod && mLookAheadPace.tol_abs == mTolAbs && mLookAheadPace.tol_rel == mTolRel && mLookAheadPace.trace_sampling_timestep == mPaceTraceSamplingTimestep && mLookAheadPace.retry_level == mRetryLevel && mLookAheadPace.start_state == mpModel->GetStdVecStateVariables() && mLookAheadPace.parameters == GetParameters();
+}
+
+bool Simulation::CommitLookAheadPace(){
+  if(!HasLookAheadPace())
+    return false;
+  mLookAheadPace.valid = false;
+  mpModel->SetStateVariables(mLookAheadPace.end_state);
+  mLastPaceStats = mLookAheadPace.statistics;
+  mPaceTraceTimes = mLookAheadPace.trace_times;
+  mPaceTrace = mLookAheadPace.trace;
+  if(mPersistentIntegrator){
+    // CVODE was left at the end of the look-ahead pace, so carry on from there
+    mPersistentPaces = mLookAheadPace.persistent_paces;
+    mPersistentEndState = mLookAheadPace.end_state;
+  }
+  return true;
+}
+
+unsigned int Simulation::DetectPeriodicity(const std::vector<double>& state){
+  mPeriodicity = 1;
+  if(mMaxPeriodicity < 2)
+    return 0;
+  if(mPaceEndStates.capacity() != GetPaceEndStatesCapacity())
+    mPaceEndStates.set_capacity(GetPaceEndStatesCapacity());
+  mPaceEndStates.push_back(state);
+
+  const unsigned int n = mPaceEndStates.size();
+  // A period 1 orbit matches every k
+  if(n >= 2 && mrms(mPaceEndStates[n-2], mPaceEndStates[n-1]) < mThreshold)
+    return 0;
+  for(unsigned int k = 2; k <= mMaxPeriodicity; k++){
+    const unsigned int checked = mPeriodicityCycles*k;
+    // Each state checked is compared with the state k paces before it
+    if(checked + k > n)
+      break;
+
+    // Check several whole cycles so that a near miss isn't mistaken for an orbit
+    bool periodic = true;
+    for(unsigned int j = 0; j < checked && periodic; j++){
+      periodic = mrms(mPaceEndStates[n-1-j-k], mPaceEndStates[n-1-j]) < mThreshold;
+    }
+
+    // Damped alternans has a consecutive difference which shrinks every cycle
+    bool shrinking = true;
+    for(unsigned int c = 0; c < mPeriodicityCycles && periodic && shrinking; c++){
+      const unsigned int later = n - 1 - c*k;
+      const unsigned int earlier = later - k;
+      shrinking = mrms(mPaceEndStates[later-1], mPaceEndStates[later]) < mrms(mPaceEndStates[earlier-1], mPaceEndStates[earlier]);
+    }
+
+    if(periodic && !shrinking){
+      mPeriodicity = k;
+      return k;
+    }
+  }
+  return 0;
+}
+
+void Simulation::SetMaxPeriodicity(unsigned int max_periodicity){
+  if(max_periodicity < 1 || max_periodicity > 4){
+    EXCEPTION("The maximum periodicity must be between 1 and 4");
+  }
+  mMaxPeriodicity = max_periodicity;
+  mPaceEndStates.clear();
+}
+
+std::vector<double> Simulation::GetPerBeatApds(double percentage){
+  const std::vector<double> state = mpModel->GetStdVecStateVariables();
+  std::vector<double> apds;
+  for(unsigned int i = 0; i < mPeriodicity; i++){
+    apds.push_back(GetApd(percentage, true));
+  }
+  SetStateVariables(state);
+  return apds;
+}
+
+void Simulation::RecordJump(){
+  // Paces before the jump aren't part of any orbit
+  mPaceEndStates.clear();
+  PaceRecord record;
+  record.pace = mPaces;
+  record.state_norm = GetStateNorm();
+  record.jump = true;
+  mTelemetry.Record(record);
+}
+
+double Simulation::GetStateNorm(){
+  // Read the state in place to avoid copying it
+  const N_Vector& r_state = mpModel->rGetStateVariables();
+  double sum = 0;
+  for(unsigned int i = 0; i < mpModel->GetNumberOfStateVariables(); i++){
+    const double value = GetVectorComponent(r_state, i);
+    sum += value*value;
+  }
+  return sqrt(sum);
+}
+
+void Simulation::SetPaceStatisticsLog(std::string path){
+  if(mPaceStatisticsLogPath != "")
+    AsyncWriter::Instance()->Close(mPaceStatisticsLogPath);
+  mPaceStatisticsLogPath = path;
+  if(path != ""){
+    AsyncWriter::Instance()->Open(path);
+    AsyncWriter::Instance()->Write(path, "pace steps rhs_evaluations jacobian_evaluations error_test_failures nonlinear_iterations nonlinear_convergence_failures last_step_size time_per_step wall_time\n");
+  }
+}
+
+bool Simulation::HasConverged(const std::vector<double>& previous_state, const std::vector<double>& current_state){
+  if(!mpStoppingCriterion)
+    return mCurrentMrms < mThreshold;
+  const PaceObservation observation = {mPaces, previous_state, current_state, mPaceTraceTimes, mPaceTrace, mpModel};
+  return mpStoppingCriterion->Update(observation);
+}
+
+void Simulation::SolvePaceSegments(){
+  mPaceTraceTimes.clear();
+  mPaceTrace.clear();
+  if(!mPersistentIntegrator){
     /*Solve in two parts*/
-    std::vector<double> tmp_state_variables = mpModel->GetStdVecStateVariables();
-    mpModel->SolveAndUpdateState(0, mpStimulus->GetDuration());
-    mpModel->SolveAndUpdateState(mpStimulus->GetDuration(), mPeriod);
-    std::vector<double> mStateVariables = mpModel->GetStdVecStateVariables();
-    mCurrentMrms = mrms(tmp_state_variables, mStateVariables);
-    if(mCurrentMrms < mThreshold){
-       mFinished = true;
-       mStateVariables = mpModel->GetStdVecStateVariables();
-       std::cout << "finished after " << mPaces << " paces \n";
-      return true;
+    SolveSegment(0, mpStimulus->GetDuration());
+    SolveSegment(mpStimulus->GetDuration(), mPeriod);
+    return;
+  }
+
+  /* Minimal reset stops Chaste reinitialising CVODE unless the time is
+     discontinuous, so we have to check for modified states ourselves */
+  mpModel->SetMinimalReset(true);
+  if(mpModel->GetStdVecStateVariables() != mPersistentEndState)
+    mpModel->ResetSolver();
+
+  /* Compute both ends of the pace the same way so that consecutive paces are
+     exactly contiguous in time. Each call to SolveAndUpdateState sets the
+     CVODE stop time, so the stimulus switching on and off never falls inside
+     a step. CVODE is also reinitialised at each switch, as its step history
+     from before it would spoil the error estimates after it, but keeps its
+     step size */
+  const double pace_start = mPersistentPaces*mPeriod;
+  const double pace_end = (mPersistentPaces+1)*mPeriod;
+  mpStimulus->SetStartTime(pace_start);
+  ReinitialiseCvode(mpModel.get(), pace_start);
+  SolveSegment(pace_start, pace_start + mpStimulus->GetDuration(), pace_start);
+  ReinitialiseCvode(mpModel.get(), pace_start + mpStimulus->GetDuration());
+  SolveSegment(pace_start + mpStimulus->GetDuration(), pace_end, pace_start);
+
+  // Other methods assume that paces start at t=0
+  mpStimulus->SetStartTime(0);
+  mPersistentPaces++;
+  mPersistentEndState = mpModel->GetStdVecStateVariables();
+}
+
+void Simulation::SolveSegment(double t_start, double t_end, double pace_start){
+  mCvodeStatistics.Begin(mpModel.get(), t_start);
+  const bool force_reset = mpModel->GetForceReset();
+  if(!mToleranceProfile.empty()){
+    /* A forced reset inside Solve would undo the per-variable tolerances,
+       so reset here instead */
+    if(force_reset){
+      mpModel->ResetSolver();
+      mpModel->SetForceReset(false);
     }
+    SetupCvodeWithTolerances(mpModel.get(), t_start, GetRetryMaxTimestep(), GetRetryToleranceFactor()*mTolRel, GetRetryAbsoluteTolerances());
+  }
+
+  try{
+    if(mPaceTraceSamplingTimestep == DOUBLE_UNSET){
+      mpModel->SolveAndUpdateState(t_start, t_end);
+    }
+    else{
+      OdeSolution solution = mpModel->Solve(t_start, t_end, GetRetryMaxTimestep(), mPaceTraceSamplingTimestep);
+      // The segments share an end point, which only needs recording once
+      const unsigned int first = mPaceTraceTimes.empty() ? 0 : 1;
+      for(unsigned int i = first; i < solution.rGetTimes().size(); i++){
+        mPaceTraceTimes.push_back(solution.rGetTimes()[i] - pace_start);
+        mPaceTrace.push_back(solution.rGetSolutions()[i]);
+      }
+    }
+  }
+  catch(const Exception&){
+    // A failed solve may be retried, so leave the model as we found it
+    if(force_reset)
+      mpModel->SetForceReset(true);
+    throw;
+  }
+  if(force_reset)
+    mpModel->SetForceReset(true);
+  mCvodeStatistics.End(mpModel.get(), t_end);
+}
+
+void Simulation::SetToleranceProfile(const std::vector<double>& profile){
+  if(!profile.empty() && profile.size() != mpModel->GetNumberOfStateVariables()){
+    EXCEPTION("Expected a tolerance profile with " + std::to_string(mpModel->GetNumberOfStateVariables()) + " entries but got " + std::to_string(profile.size()));
+  }
+  for(double scale : profile){
+    if(!(scale > 0)){
+      EXCEPTION("Tolerance profile entries must be positive");
+    }
+  }
+  mToleranceProfile = profile;
+  mLookAheadPace.valid = false;
+}
+
+std::vector<double> Simulation::GetAbsoluteTolerances(){
+  std::vector<double> tolerances(mpModel->GetNumberOfStateVariables(), mTolAbs);
+  for(unsigned int i = 0; i < mToleranceProfile.size(); i++){
+    tolerances[i] *= mToleranceProfile[i];
+  }
+  return tolerances;
+}
+
+std::vector<double> Simulation::GetRetryAbsoluteTolerances(){
+  std::vector<double> tolerances = GetAbsoluteTolerances();
+  for(double& tolerance : tolerances)
+    tolerance *= GetRetryToleranceFactor();
+  return tolerances;
+}
+
+std::vector<double> Simulation::ComputeToleranceProfile(){
+  const CompactTrace trace = GetCompactPace();
+  const std::vector<std::vector<double>> states = trace.Resample(trace.rGetTimes());
+  std::vector<double> profile;
+  for(unsigned int i = 0; i < trace.GetNumberOfVariables(); i++){
+    double min = INFINITY, max = -INFINITY, magnitude = 0;
+    for(const std::vector<double>& state : states){
+      min = std::min(min, state[i]);
+      max = std::max(max, state[i]);
+      magnitude = std::max(magnitude, std::abs(state[i]));
+    }
+    const double scale = std::max(max - min, 1e-3*magnitude);
+    // A variable which is always zero keeps the plain absolute tolerance
+    profile.push_back(scale > 0 ? scale : 1);
+  }
+  return profile;
+}
+
+void Simulation::WriteToleranceProfile(boost::filesystem::path dir, std::string filename){
+  TRACE_SCOPE("WriteToleranceProfile");
+  boost::filesystem::create_directories(dir);
+  const boost::filesystem::path filepath = dir / boost::filesystem::path(filename);
+  const std::vector<double> profile = ComputeToleranceProfile();
+
+  std::ostringstream f_out;
+  f_out << std::setprecision(20);
+  for(const std::string& var_name : mpModel->GetSystemInformation()->rGetStateVariableNames()){
+    f_out << var_name << " ";
+  }
+  f_out << "\n";
+  for(double scale : profile){
+    f_out << scale << " ";
+  }
+  f_out << "\n";
+
+  AsyncWriter::Instance()->Open(filepath.string());
+  AsyncWriter::Instance()->Write(filepath.string(), f_out.str());
+  AsyncWriter::Instance()->Close(filepath.string());
+}
+
+void Simulation::LoadToleranceProfile(std::string path){
+  // The file may still be queued for writing
+  AsyncWriter::Instance()->Flush();
+  if(!boost::filesystem::exists(path)){
+    EXCEPTION("Couldn't open file " + path);
+  }
+  const StateFileContents contents = ReadTextStateFile(path);
+  const std::vector<std::string>& names = mpModel->GetSystemInformation()->rGetStateVariableNames();
+  std::vector<double> profile(names.size(), 1);
+  for(unsigned int i = 0; i < contents.names.size() && i < contents.values.size(); i++){
+    const auto it = std::find(names.begin(), names.end(), contents.names[i]);
+    if(it != names.end())
+      profile[it - names.begin()] = contents.values[i];
+  }
+  SetToleranceProfile(profile);
+}
+
+void Simulation::SetPersistentIntegrator(bool persistent){
+  mPersistentIntegrator = persistent;
+  mLookAheadPace.valid = false;
+  mPersistentPaces = 0;
+  mPersistentEndState.clear();
+  if(persistent){
+    mpModel->SetForceReset(false);
+    mpModel->SetMinimalReset(true);
   }
   else{
-    mpModel->SolveAndUpdateState(0, mpStimulus->GetDuration());
-    mpModel->SolveAndUpdateState(mpStimulus->GetDuration(), mPeriod);
+    mpModel->SetMinimalReset(false);
   }
-  mStateVariables = mpModel->GetStdVecStateVariables();
-  return false;
+  mpModel->ResetSolver();
 }
 
 void Simulation::WritePaceToFile(std::string dirname, std::string filename, double sampling_timestep, bool update_vars){
-  mpModel->SetForceReset(true);
-  OdeSolution solution = mpModel->Compute(0, mPeriod, 1);
+  TRACE_SCOPE("WritePaceToFile");
+  OdeSolution solution = GetPace(sampling_timestep, update_vars);
   solution.CalculateDerivedQuantitiesAndParameters(mpModel.get());
   solution.WriteToFile(dirname, filename, "ms", 1, false, 20, true);
-  if(!update_vars)
-    mpModel->SetStateVariables(mStateVariables);
-  else
-    mStateVariables = mpModel->GetStdVecStateVariables();
 }
 
 void Simulation::WriteStatesToFile(boost::filesystem::path dir, std::string filename){
+  TRACE_SCOPE("WriteStatesToFile");
   boost::filesystem::create_directories(dir);
   boost::filesystem::path filepath = (dir / boost::filesystem::path(filename));
-  std::cout << filepath.string() << "\n";
-  std::ofstream f_out(filepath.string());
+  AsyncWriter::Instance()->WriteToStdout(filepath.string() + "\n");
   std::vector<double> states = GetStateVariables();
   std::vector<std::string> var_names = mpModel->GetSystemInformation()->rGetStateVariableNames();
 
+  std::ostringstream f_out;
   f_out << std::setprecision(20);
 
   for(std::string var_name : var_names){
@@ -96,17 +623,49 @@ void Simulation::WriteStatesToFile(boost::filesystem::path dir, std::string file
     f_out << state_var << " ";
   }
   f_out << "\n";
-  f_out.close();
+
+  AsyncWriter::Instance()->Open(filepath.string());
+  AsyncWriter::Instance()->Write(filepath.string(), f_out.str());
+  AsyncWriter::Instance()->Close(filepath.string());
+}
+
+void Simulation::WriteStatesToBinaryFile(boost::filesystem::path dir, std::string filename){
+  TRACE_SCOPE("WriteStatesToBinaryFile");
+  boost::filesystem::create_directories(dir);
+  const boost::filesystem::path filepath = (dir / boost::filesystem::path(filename));
+  AsyncWriter::Instance()->WriteToStdout(filepath.string() + "\n");
+  ::WriteStatesToBinaryFile(mpModel, filepath.string());
 }
 
 double Simulation::GetMrms(bool update){
+  TRACE_SCOPE("GetMrms");
   if(!mTerminateOnConvergence){
     std::vector<double> last_variables = mpModel->GetStdVecStateVariables();
-    mpModel->SolveAndUpdateState(0, mpStimulus->GetDuration());
-    mpModel->SolveAndUpdateState(mpStimulus->GetDuration(), mPeriod);
-    std::vector<double> new_variables = mpModel->GetStdVecStateVariables();
+    if(HasLookAheadPace())
+      return mrms(last_variables, mLookAheadPace.end_state);
+
+    // Solve the next pace and keep it for RunPace
+    const unsigned int persistent_paces = mPersistentPaces;
+    const std::vector<double> persistent_end_state = mPersistentEndState;
+    const unsigned int retry_level = mRetryLevel;
+    mLookAheadPace.statistics = MeasurePace();
+    mLookAheadPace.start_state = last_variables;
+    mLookAheadPace.parameters = GetParameters();
+    mLookAheadPace.period = mPeriod;
+    mLookAheadPace.tol_abs = mTolAbs;
+    mLookAheadPace.tol_rel = mTolRel;
+    mLookAheadPace.trace_sampling_timestep = mPaceTraceSamplingTimestep;
+    mLookAheadPace.retry_level = retry_level;
+    mLookAheadPace.end_state = mpModel->GetStdVecStateVariables();
+    mLookAheadPace.persistent_paces = mPersistentPaces;
+    mLookAheadPace.trace_times = mPaceTraceTimes;
+    mLookAheadPace.trace = mPaceTrace;
+    mLookAheadPace.valid = true;
+
     mpModel->SetStateVariables(last_variables);
-    return mrms(last_variables, new_variables);
+    mPersistentPaces = persistent_paces;
+    mPersistentEndState = persistent_end_state;
+    return mrms(last_variables, mLookAheadPace.end_state);
   }
   else
     return mCurrentMrms;
@@ -117,13 +676,127 @@ bool Simulation::IsFinished(){
 }
 
 OdeSolution Simulation::GetPace(double sampling_timestep, bool update_vars){
+  TRACE_SCOPE("GetPace");
+  const CompactTrace trace = GetCompactPace(update_vars);
+
+  OdeSolution solution;
+  solution.rGetTimes() = trace.GetSamplingTimes(sampling_timestep);
+  solution.rGetSolutions() = trace.Resample(solution.rGetTimes());
+  solution.SetNumberOfTimeSteps(solution.rGetTimes().size() - 1);
+  solution.SetOdeSystemInformation(mpModel->GetSystemInformation());
+  return solution;
+}
+
+std::vector<double> Simulation::GetPaceCacheKey(){
+  std::vector<double> key = mpModel->GetStdVecStateVariables();
+  const std::vector<double> parameters = GetParameters();
+  key.insert(key.end(), parameters.begin(), parameters.end());
+  key.push_back(mPeriod);
+  key.push_back(mTolAbs);
+  key.push_back(mTolRel);
+  key.insert(key.end(), mToleranceProfile.begin(), mToleranceProfile.end());
+  key.push_back(GetRetryMaxSteps());
+  key.push_back(GetRetryToleranceFactor());
+  key.push_back(GetRetryMaxTimestep());
+  key.push_back(mpModel->GetUseAnalyticJacobian());
+  return key;
+}
+
+CompactTrace Simulation::GetCompactPace(bool update_vars){
+  TRACE_SCOPE("GetCompactPace");
   mStateVariables = mpModel->GetStdVecStateVariables();
-  const OdeSolution solution = mpModel->Compute(0, mPeriod, sampling_timestep);
+
+  const std::vector<double> key = GetPaceCacheKey();
+  const std::size_t hash = boost::hash_range(key.begin(), key.end());
+  auto it = mPaceCache.find(hash);
+  if(it == mPaceCache.end() || it->second.key != key){
+    CompactTrace trace(mpModel->GetNumberOfStateVariables(), mpModel->rGetStateVariableNames());
+
+    /*Solve in two parts so that no step crosses the end of the stimulus*/
+    // Solve with the same settings as the pace itself would be
+    CvodeStepper stepper(mpModel, GetRetryToleranceFactor()*mTolAbs, GetRetryToleranceFactor()*mTolRel, GetRetryMaxTimestep(), GetRetryMaxSteps());
+    if(!mToleranceProfile.empty())
+      stepper.SetAbsoluteTolerances(GetRetryAbsoluteTolerances());
+    stepper.Solve(0, mpStimulus->GetDuration(), &trace);
+    stepper.Solve(mpStimulus->GetDuration(), mPeriod, &trace);
+
+    // Evict the oldest pace (or a colliding one) to make room
+    if(it != mPaceCache.end()){
+      mPaceCache.erase(it);
+      mPaceCacheOrder.erase(std::find(mPaceCacheOrder.begin(), mPaceCacheOrder.end(), hash));
+    }
+    else if(mPaceCache.size() >= mPaceCacheCapacity){
+      mPaceCache.erase(mPaceCacheOrder.front());
+      mPaceCacheOrder.pop_front();
+    }
+    it = mPaceCache.insert({hash, {key, trace}}).first;
+    mPaceCacheOrder.push_back(hash);
+  }
+  const CompactTrace& trace = it->second.trace;
+
   if(update_vars)
-    mStateVariables=mpModel->GetStdVecStateVariables();
+    SetStateVariables(trace.GetFinalState());
   else
     mpModel->SetStateVariables(mStateVariables);
-  return solution;
+  return trace;
+}
+
+std::vector<std::vector<double>> Simulation::GetTrace(const std::vector<std::string>& variable_names, double sampling_timestep, bool update_vars, std::vector<double>* p_times){
+  boost::shared_ptr<const AbstractOdeSystemInformation> p_info = mpModel->GetSystemInformation();
+
+  // Work out where each column comes from before solving
+  std::vector<int> state_indices;
+  std::vector<int> derived_indices;
+  bool need_derived = false;
+  for(const std::string& name : variable_names){
+    if(p_info->HasStateVariable(name)){
+      state_indices.push_back(p_info->GetStateVariableIndex(name));
+      derived_indices.push_back(-1);
+    }
+    else if(p_info->HasDerivedQuantity(name)){
+      state_indices.push_back(-1);
+      derived_indices.push_back(p_info->GetDerivedQuantityIndex(name));
+      need_derived = true;
+    }
+    else{
+      EXCEPTION("Model " + p_info->GetSystemName() + " has no state variable or derived quantity named " + name);
+    }
+  }
+
+  const CompactTrace trace = GetCompactPace(update_vars);
+  const std::vector<double> times = trace.GetSamplingTimes(sampling_timestep);
+
+  std::vector<std::vector<double>> columns(variable_names.size());
+  for(auto& column : columns)
+    column.reserve(times.size());
+
+  // Only reconstruct the full state when a derived quantity is needed
+  N_Vector state = nullptr;
+  if(need_derived)
+    CreateVectorIfEmpty(state, trace.GetNumberOfVariables());
+  for(double time : times){
+    std::vector<double> derived_quantities;
+    if(need_derived){
+      CopyFromStdVector(trace.Interpolate(time), state);
+      derived_quantities = mpModel->ComputeDerivedQuantities(time, state);
+    }
+    for(unsigned int j = 0; j < variable_names.size(); j++){
+      if(state_indices[j] >= 0)
+        columns[j].push_back(trace.Interpolate(time, state_indices[j]));
+      else
+        columns[j].push_back(derived_quantities[derived_indices[j]]);
+    }
+  }
+  DeleteVector(state);
+
+  if(p_times)
+    *p_times = times;
+  return columns;
+}
+
+void Simulation::WriteCompactPaceToFile(boost::filesystem::path dir, std::string filename, bool update_vars){
+  boost::filesystem::create_directories(dir);
+  GetCompactPace(update_vars).WriteToFile((dir / filename).string());
 }
 
 std::vector<double> Simulation::GetStateVariables(){
@@ -138,41 +811,31 @@ void Simulation::SetStateVariables(std::vector<double> states){
 void Simulation::SetThreshold(double threshold){
   /* The threshold must be non-negative */
   if(threshold<0){
-    throw std::exception();
+    EXCEPTION("The threshold must be non-negative");
   }
   mThreshold = threshold;
 }
 
 double Simulation::GetApd(double percentage, bool update_vars){
-  // Need to use fine sampling timestep to be accurate, but has the effect of increasing
-  // the solver tolerance and thus the shape of the action potential compared to lower tolerances
+  TRACE_SCOPE("GetApd");
+  // Need to use fine sampling timestep to be accurate. The pace is solved
+  // independently of the sampling so this doesn't affect the solution itself
   if(!mpModel)
     return DOUBLE_UNSET;
-  mpModel->SetMinimalReset(false);
-  mStateVariables = mpModel->GetStdVecStateVariables();
-  OdeSolution solution = mpModel->Compute(0, mPeriod, 0.01);
-  mpStimulus->SetStartTime(0);
-  solution.CalculateDerivedQuantitiesAndParameters(mpModel.get());
-  const std::vector<double> times = solution.rGetTimes();
-  const std::vector<double> voltages = solution.GetAnyVariable("membrane_voltage");
+  std::vector<double> times;
+  const std::vector<double> voltages = GetTrace({"membrane_voltage"}, 0.01, update_vars, &times).front();
   if(times.size()==0)
     return DOUBLE_UNSET;
   CellProperties cell_props(voltages, times);
 
-  if(update_vars)
-    mStateVariables = mpModel->GetStdVecStateVariables();
-  else
-    mpModel->SetStateVariables(mStateVariables);
-  const double return_val = cell_props.GetAllActionPotentialDurations(90).front();
+  const double return_val = cell_props.GetAllActionPotentialDurations(percentage).front();
+  if(mTelemetry.GetNumberOfRecords() > 0 && mTelemetry.rGetLatest().pace == mPaces)
+    mTelemetry.rGetLatest().apd = return_val;
   return return_val;
 }
 
 std::vector<double> Simulation::GetVoltageTrace(double sampling_timestep, bool update_vars){
-  OdeSolution solution = GetPace();
-  solution.CalculateDerivedQuantitiesAndParameters(mpModel.get());
-  if(!update_vars)
-    mpModel->SetStateVariables(mStateVariables);
-  return solution.GetAnyVariable("membrane_voltage");
+  return GetTrace({"membrane_voltage"}, sampling_timestep, update_vars).front();
 }
 
 void Simulation::SetIKrBlock(double block){
@@ -10,8 +10,24 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <algorithm>
+#include <deque>
+#include "ChasteSerialization.hpp"
+#include <boost/serialization/vector.hpp>
+#include <boost/circular_buffer.hpp>
 #include "SimulationTools.hpp"
+#include "CompactTrace.hpp"
+#include "CvodeStatistics.hpp"
+#include "PaceTelemetry.hpp"
+#include "StoppingCriteria.hpp"
 
+namespace boost{
+  namespace archive{
+    class binary_oarchive;
+    class binary_iarchive;
+  }
+}
 
 class Simulation
 {
@@ -20,7 +36,6 @@ protected:
   boost::shared_ptr<AbstractCvodeCell> mpModel;
   unsigned int mNumberOfStateVariables;
   std::vector<double> mStateVariables;
-  std::ofstream mOutputFile;
   double mPeriod = 1000;
   double mTolAbs;
   double mTolRel;
@@ -31,6 +46,219 @@ protected:
   unsigned int mPaces = 0;
 
   double mDefaultGKr = DOUBLE_UNSET;
+
+  /* States at the end of the last few paces, used to spot orbits which
+     repeat every k paces (see SetMaxPeriodicity) */
+  boost::circular_buffer<std::vector<double>> mPaceEndStates;
+  unsigned int mMaxPeriodicity = 4;
+  unsigned int mPeriodicity = 1;
+
+  /* Full cycles of an orbit that must match before it counts as periodic */
+  const unsigned int mPeriodicityCycles = 3;
+  unsigned int GetPaceEndStatesCapacity() const {return (mPeriodicityCycles + 1)*mMaxPeriodicity;}
+
+  /* Record the state at the end of a pace. Returns k if each of the last
+     mPeriodicityCycles*k states matches the state k paces before it (for the
+     smallest such k > 1) and the orbit is stationary, and 0 otherwise.
+     Damped alternans also nearly repeats every 2 paces, but the difference
+     between consecutive paces shrinks every cycle, so an orbit only counts
+     as stationary if that difference hasn't shrunk over every one of the
+     cycles checked */
+  unsigned int DetectPeriodicity(const std::vector<double>& state);
+
+  /* Paces run on each rung of the last tolerance ladder */
+  std::vector<unsigned int> mToleranceLadderPaces;
+
+  /* Keep one CVODE instance alive across paces (see SetPersistentIntegrator) */
+  bool mPersistentIntegrator = false;
+  unsigned int mPersistentPaces = 0;
+  std::vector<double> mPersistentEndState;
+
+  /* Integrate the model over one pace, updating its state */
+  void SolvePace();
+
+  void SolvePaceSegments();
+
+  /* Call SolvePaceSegments and return CVODE's work over the pace. A failed
+     pace is retried from its starting state up to mMaxRetries times, each
+     time escalating the solver settings (see SetRetryLevel) */
+  PaceStatistics MeasurePace();
+
+  long mMaxSteps = 1e5;
+  double mMaxTimestep = 1000;
+  unsigned int mMaxRetries = 3;
+  unsigned int mRetries = 0;
+
+  /* Level 1 raises the maximum number of steps, level 2 also tightens the
+     tolerances and level 3 also shrinks the maximum timestep. Level 0
+     restores the normal settings. Returns a description of the settings */
+  std::string SetRetryLevel(unsigned int level);
+  unsigned int mRetryLevel = 0;
+
+  /* The solver settings at the current retry level, for solves that don't
+     go through the model's own CVODE settings */
+  long GetRetryMaxSteps(){return mRetryLevel >= 1 ? 10*mMaxSteps : mMaxSteps;}
+  double GetRetryToleranceFactor(){return mRetryLevel >= 2 ? 0.01 : 1;}
+  double GetRetryMaxTimestep(){return mRetryLevel >= 3 ? std::min(mMaxTimestep, 1.0) : mMaxTimestep;}
+  std::vector<double> GetRetryAbsoluteTolerances();
+
+  /* Each state variable's typical size, which its absolute tolerance is
+     scaled by (see SetToleranceProfile). Empty when every variable has the
+     same absolute tolerance */
+  std::vector<double> mToleranceProfile;
+
+  /* A pace solved ahead of time by GetMrms. It's kept, with everything its
+     result depends on, so that the next SolvePace from the same state can
+     commit the result rather than solving the pace again */
+  struct LookAheadPace{
+    bool valid = false;
+    std::vector<double> start_state;
+    std::vector<double> parameters;
+    double period;
+    double tol_abs;
+    double tol_rel;
+    double trace_sampling_timestep;
+    unsigned int retry_level;
+    std::vector<double> end_state;
+    unsigned int persistent_paces;
+    PaceStatistics statistics;
+    std::vector<double> trace_times;
+    std::vector<std::vector<double>> trace;
+  };
+  LookAheadPace mLookAheadPace;
+
+  std::vector<double> GetParameters();
+  bool HasLookAheadPace();
+  bool CommitLookAheadPace();
+
+  /* Call SolveAndUpdateState, keeping count of the work CVODE does. When a
+     stopping criterion needs a pace trace, the segment is sampled into
+     mPaceTrace instead (with times relative to pace_start) */
+  void SolveSegment(double t_start, double t_end, double pace_start = 0);
+  CvodeStatisticsRecorder mCvodeStatistics;
+  PaceStatistics mLastPaceStats;
+  std::string mPaceStatisticsLogPath;
+
+  /* The last few paces, written to mTelemetryDumpPath (unless it's empty)
+     when RunPaces throws */
+  PaceTelemetry mTelemetry;
+  std::string mTelemetryDumpPath;
+  void SetDefaultTelemetryDumpPath();
+
+  /* Recently solved paces, keyed by a hash of the state, parameters, period
+     and tolerances they were solved with. Each holds the solver's steps, so
+     any sampling of the pace can be served without solving it again (see
+     GetCompactPace) */
+  struct PaceCacheEntry{
+    std::vector<double> key;
+    CompactTrace trace;
+  };
+  std::map<std::size_t, PaceCacheEntry> mPaceCache;
+  std::deque<std::size_t> mPaceCacheOrder;
+  const unsigned int mPaceCacheCapacity = 8;
+  std::vector<double> GetPaceCacheKey();
+
+  /* Replaces the mrms threshold when set (see SetStoppingCriterion) */
+  boost::shared_ptr<AbstractStoppingCriterion> mpStoppingCriterion;
+  double mPaceTraceSamplingTimestep = DOUBLE_UNSET;
+  std::vector<double> mPaceTraceTimes;
+  std::vector<std::vector<double>> mPaceTrace;
+
+  /* Everything that follows solving a pace, whichever way it was solved:
+     check for convergence (when terminating on convergence) and for a
+     periodic orbit. Returns true if pacing has finished */
+  bool CompletePace(const std::vector<double>& previous_state);
+
+  /* Whether we've converged, given the states before and after the last pace */
+  bool HasConverged(const std::vector<double>& previous_state, const std::vector<double>& current_state);
+
+  /* Record an extrapolation or Newton jump to the current state */
+  void RecordJump();
+  double GetStateNorm();
+
+  /* Periodically save the simulation to mCheckpointPath (see SetCheckpointing) */
+  std::string mCheckpointPath;
+  unsigned int mCheckpointInterval = 0;
+  void CheckpointIfDue();
+
+  friend class boost::serialization::access;
+  /* Archive everything needed to carry on pacing from where we left off, so
+     that a resumed run is identical to one which was never interrupted. The
+     model's state and parameters are archived by value, so a checkpoint is
+     loaded into a Simulation constructed with the same type of model. A
+     stopping criterion isn't archived itself, only its history, so the same
+     criterion must be set before loading */
+  template<class Archive>
+  void serialize(Archive & archive, const unsigned int version){
+    std::string model_name = mpModel->GetSystemInformation()->GetSystemName();
+    std::vector<double> state_variables;
+    std::vector<double> parameters;
+    if(!Archive::is_loading::value){
+      state_variables = mpModel->GetStdVecStateVariables();
+      for(unsigned int i = 0; i < mpModel->GetNumberOfParameters(); i++){
+        parameters.push_back(mpModel->GetParameter(i));
+      }
+    }
+
+    archive & model_name;
+    if(Archive::is_loading::value && model_name != mpModel->GetSystemInformation()->GetSystemName()){
+      EXCEPTION("Checkpoint was created using model " + model_name);
+    }
+
+    archive & state_variables;
+    archive & parameters;
+    archive & mPeriod;
+    archive & mTolAbs;
+    archive & mTolRel;
+    archive & mCurrentMrms;
+    archive & mThreshold;
+    archive & mFinished;
+    archive & mTerminateOnConvergence;
+    archive & mPaces;
+    archive & mDefaultGKr;
+    archive & mPersistentIntegrator;
+    archive & mPersistentPaces;
+
+    archive & mMaxSteps;
+
+    std::vector<std::vector<double>> pace_end_states(mPaceEndStates.begin(), mPaceEndStates.end());
+    std::string criterion_name = mpStoppingCriterion ? mpStoppingCriterion->GetName() : "";
+    std::vector<double> criterion_history;
+    if(!Archive::is_loading::value && mpStoppingCriterion)
+      criterion_history = mpStoppingCriterion->GetHistory();
+    archive & mMaxPeriodicity;
+    archive & mPeriodicity;
+    archive & pace_end_states;
+    archive & criterion_name;
+    archive & criterion_history;
+    archive & mTelemetry;
+    archive & mMaxRetries;
+    archive & mRetries;
+
+    std::vector<double> tolerance_profile = mToleranceProfile;
+    archive & tolerance_profile;
+
+    if(Archive::is_loading::value){
+      for(unsigned int i = 0; i < parameters.size(); i++){
+        mpModel->SetParameter(i, parameters[i]);
+      }
+      SetTolerances(mTolAbs, mTolRel);
+      SetMaxSteps(mMaxSteps);
+      // The CVODE history isn't archived, so a persistent integrator starts afresh
+      const unsigned int persistent_paces = mPersistentPaces;
+      SetPersistentIntegrator(mPersistentIntegrator);
+      mPersistentPaces = persistent_paces;
+      SetStateVariables(state_variables);
+
+      mPaceEndStates.assign(GetPaceEndStatesCapacity(), pace_end_states.begin(), pace_end_states.end());
+      if(criterion_name != (mpStoppingCriterion ? mpStoppingCriterion->GetName() : "")){
+        EXCEPTION("Checkpoint was created with stopping criterion '" + criterion_name + "' - set the same criterion before loading it");
+      }
+      if(mpStoppingCriterion)
+        mpStoppingCriterion->SetHistory(criterion_history);
+      SetToleranceProfile(tolerance_profile);
+    }
+  }
 public:
   Simulation(){
     return;
@@ -38,13 +266,22 @@ public:
 
   Simulation(boost::shared_ptr<AbstractCvodeCell> _p_model, double _period, std::string input_path = "", double _tol_abs=1e-8, double _tol_rel=1e-8);
 
-  ~Simulation();
+  virtual ~Simulation();
 
   /* Run paces until max_paces is exceeded or the model reaches a steady state */
-  bool RunPaces(int);
+  virtual bool RunPaces(int);
 
   unsigned int GetPaces(){return mPaces;}
 
+  /* Converge at each tolerance in turn (e.g. 1e-6, 1e-8, 1e-10, 1e-12), each
+     rung starting from the limit cycle found by the last. Rung i stops when
+     the mrms falls below thresholds[i] or after max_paces_per_rung paces. By
+     default a rung's threshold is its tolerance, or the simulation's threshold
+     if that is larger. Returns whether the last rung converged */
+  bool RunToleranceLadder(const std::vector<double>& tolerances, int max_paces_per_rung, std::vector<double> thresholds = {});
+
+  const std::vector<unsigned int>& rGetToleranceLadderPaces(){return mToleranceLadderPaces;}
+
   void SetTolerances(double atol, double rtol){
     if(mpModel)
       mpModel->SetTolerances(atol, rtol);
@@ -52,15 +289,81 @@ public:
     mTolRel = rtol;
   }
 
-  bool RunPace();
+  virtual bool RunPace();
+
+  /* Integrate successive paces in absolute time without resetting CVODE so
+     that the step size and Jacobian are reused from one pace to the next. The
+     solver is only reinitialised when the state is modified between paces */
+  void SetPersistentIntegrator(bool persistent);
+
+  bool GetPersistentIntegrator(){return mPersistentIntegrator;}
+
+  /* How many times to retry a pace which CVODE fails to solve before giving
+     up (3 by default, which uses every level of escalation, and at most 3) */
+  void SetMaxRetries(unsigned int max_retries);
+
+  /* The most steps CVODE may take to solve each part of a pace (1e5 by
+     default). Retries raise this (see SetRetryLevel) */
+  void SetMaxSteps(long max_steps);
+
+  long GetMaxSteps(){return mMaxSteps;}
+
+  /* The number of retries needed so far */
+  unsigned int GetRetries(){return mRetries;}
+
+  /* CVODE's work (steps, right hand side evaluations etc.) summed over every
+     pace solved since construction or the last reset */
+  const CvodeCounters& GetCvodeStatistics() const {return mCvodeStatistics.rGetTotals();}
+
+  void ResetCvodeStatistics(){mCvodeStatistics.Reset();}
+
+  /* CVODE's work over the most recently solved pace. A pace solved ahead by
+     GetMrms is counted when RunPace commits it */
+  const PaceStatistics& GetLastPaceStats() const {return mLastPaceStats;}
+
+  /* Keep records of the last capacity paces (256 by default) */
+  void SetTelemetryCapacity(unsigned int capacity){mTelemetry.SetCapacity(capacity);}
+
+  const PaceTelemetry& GetTelemetry() const {return mTelemetry;}
+
+  /* Where to write the telemetry if RunPaces throws. The default is
+     telemetry/<model>_<period>ms.dat in $CHASTE_TEST_OUTPUT, so the history
+     of a failed run is kept even if the caller catches the exception. An
+     empty path turns the dump off */
+  void SetTelemetryDumpPath(std::string path){mTelemetryDumpPath = path;}
+
+  std::string GetTelemetryDumpPath() const {return mTelemetryDumpPath;}
+
+  void DumpTelemetry(std::string path){mTelemetry.Dump(path);}
+
+  /* Append the statistics for every pace solved to a space separated file.
+     An empty path turns logging off */
+  void SetPaceStatisticsLog(std::string path);
 
   /**Output a pace to file*/
   void WritePaceToFile(std::string dirname, std::string filename, double sampling_timestep = 1, bool update_variables=false);
 
   void WriteStatesToFile(boost::filesystem::path dirname, std::string filename);
 
+  /* Write the current state in the binary format described in StateFile.hpp.
+     Like WriteStatesToFile, the file is written in the background */
+  void WriteStatesToBinaryFile(boost::filesystem::path dirname, std::string filename);
+
   OdeSolution GetPace(double sampling_timestep = 1, bool update_vars=false);
 
+  /* Record one pace as the solver's accepted steps, which can be resampled at
+     any time points afterwards (see CompactTrace). Paces are cached, so
+     GetPace, GetTrace, GetApd, GetVoltageTrace and WritePaceToFile solve a
+     pace from a given state once between them */
+  CompactTrace GetCompactPace(bool update_vars=false);
+
+  /* Record only the named state variables or derived quantities over one
+     pace, sampled every sampling_timestep ms. Returns one vector of values per
+     name. The sampling times are stored in p_times if it isn't null */
+  std::vector<std::vector<double>> GetTrace(const std::vector<std::string>& variable_names, double sampling_timestep = 1, bool update_vars=false, std::vector<double>* p_times=nullptr);
+
+  void WriteCompactPaceToFile(boost::filesystem::path dirname, std::string filename, bool update_vars=false);
+
   std::vector<double> GetStateVariables();
 
  // Setters and getters
@@ -74,15 +377,83 @@ public:
 
   void SetTerminateOnConvergence(bool b){mTerminateOnConvergence=b;}
 
+  /* Treat the model as converged if it settles into an orbit repeating
+     every k paces for some k up to max_periodicity (at most 4). Use 1 to only
+     accept ordinary period 1 convergence */
+  void SetMaxPeriodicity(unsigned int max_periodicity);
+
+  /* The number of paces after which the orbit repeats, as detected at the
+     last pace (1 unless alternans or a similar rhythm has been found) */
+  unsigned int GetPeriodicity(){return mPeriodicity;}
+
+  /* The APD of each of the next GetPeriodicity() paces, leaving the state
+     unchanged */
+  std::vector<double> GetPerBeatApds(double percentage = 90);
+
+  /* Give state variable i an absolute tolerance of atol*profile[i] rather
+     than atol, so that each variable is solved to a similar accuracy whatever
+     its size. Only the tolerances of the model's own CVODE instance change,
+     so a persistent integrator still carries CVODE over between paces. An
+     empty profile returns to a single absolute tolerance */
+  void SetToleranceProfile(const std::vector<double>& profile);
+
+  const std::vector<double>& rGetToleranceProfile(){return mToleranceProfile;}
+
+  /* The absolute tolerance of each state variable */
+  std::vector<double> GetAbsoluteTolerances();
+
+  /* Work out a tolerance profile from one pace from the current state (which
+     should be on the limit cycle): the range of each variable over the pace,
+     or a thousandth of its magnitude if that's larger */
+  std::vector<double> ComputeToleranceProfile();
+
+  /* Save the profile computed from the current state in the same format as
+     WriteStatesToFile */
+  void WriteToleranceProfile(boost::filesystem::path dirname, std::string filename);
+
+  /* Load a profile saved by WriteToleranceProfile. Variables missing from
+     the file keep the plain absolute tolerance */
+  void LoadToleranceProfile(std::string path);
+
+  /* Decide convergence with this criterion instead of comparing the mrms
+     with the threshold. If the criterion needs a pace trace, each pace is
+     sampled as it is solved rather than solved again */
+  void SetStoppingCriterion(boost::shared_ptr<AbstractStoppingCriterion> p_criterion){
+    mpStoppingCriterion = p_criterion;
+    mPaceTraceSamplingTimestep = p_criterion ? p_criterion->GetSamplingTimestep() : DOUBLE_UNSET;
+  }
+
+  boost::shared_ptr<AbstractStoppingCriterion> GetStoppingCriterion(){return mpStoppingCriterion;}
+
   bool IsFinished();
 
+  /* The mrms between the states at the start and end of the last pace. If
+     we aren't terminating on convergence, the next pace is solved instead and
+     kept for the next call to RunPace */
   double GetMrms(bool update=false);
 
   boost::shared_ptr<AbstractCvodeCell> GetModel(){return mpModel;}
 
   void SetIKrBlock(double block);
 
-};
+  /* Save a checkpoint to path every interval paces during RunPaces. An
+     interval of 0 turns checkpointing off */
+  void SetCheckpointing(std::string path, unsigned int interval){
+    mCheckpointPath = path;
+    mCheckpointInterval = interval;
+  }
 
+  /* Checkpoints are written through WriteCheckpoint and read through
+     ReadCheckpoint, so they hold the whole of a derived simulation */
+  void SaveCheckpoint(std::string path);
+
+  void LoadCheckpoint(std::string path);
+
+protected:
+  /* Archive this simulation as its most derived type. Subclasses which
+     archive members of their own override both */
+  virtual void WriteCheckpoint(boost::archive::binary_oarchive& rArchive) const;
+  virtual void ReadCheckpoint(boost::archive::binary_iarchive& rArchive);
+};
 
 #endif
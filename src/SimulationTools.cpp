@@ -1,6 +1,12 @@
 #include "SimulationTools.hpp"
 #include <boost/filesystem.hpp>
+#include <cmath>
 #include "Simulation.hpp"
+#include "StateFile.hpp"
+#include "TextPaceLogWriter.hpp"
+#include "Hdf5PaceLogWriter.hpp"
+#include "AsyncWriter.hpp"
+#include "TraceRecorder.hpp"
 
 #include "CommandLineArguments.hpp"
 
@@ -42,29 +48,27 @@ void RunSimulation(boost::shared_ptr<AbstractCvodeCell> p_model, unsigned int pa
 }
 
 int LoadStatesFromFile(boost::shared_ptr<AbstractCvodeCell> p_model, std::string file_path){
-  std::ifstream file_in;
-  file_in.open(file_path);
-  if(!file_in.is_open()){
-    std::cout << "Couldn't open file! " + file_path + " \n";
+  TRACE_SCOPE("LoadStatesFromFile");
+  // The file may still be queued for writing
+  AsyncWriter::Instance()->Flush();
+
+  if(!boost::filesystem::exists(file_path)){
     EXCEPTION("Couldn't open file " + file_path);
     return -1;
   }
-  std::string line;
-  std::vector<std::string> state_variables_str;
-  std::vector<double> state_variables;
-
-  // Get second line
-  std::getline(file_in, line);
-  std::getline(file_in, line);
-
-  boost::split(state_variables_str, line, boost::is_any_of(" "), boost::token_compress_on);
-  for(auto state_var : state_variables_str){
-    if(state_var!="")
-      state_variables.push_back(std::stod(state_var));
-  }
 
-  file_in.close();
-  p_model->SetStateVariables(state_variables);
+  StateFileContents contents = IsBinaryStateFile(file_path) ? ReadBinaryStateFile(file_path) : ReadTextStateFile(file_path);
+
+  const std::vector<std::string>& names = p_model->GetSystemInformation()->rGetStateVariableNames();
+  const bool any_names_match = std::any_of(contents.names.begin(), contents.names.end(), [&](const std::string& name) -> bool {return std::find(names.begin(), names.end(), name) != names.end();});
+
+  if(!any_names_match && contents.values.size() == names.size()){
+    // Old text files may not have a meaningful header so fall back to the order of the variables
+    p_model->SetStateVariables(contents.values);
+  }
+  else{
+    p_model->SetStateVariables(MapStatesByName(p_model, contents));
+  }
   return 0;
 }
 
@@ -102,7 +106,7 @@ double mrms(std::vector<double> A, std::vector<double> B, unsigned int starting_
   for(unsigned int i=starting_index; i < A.size(); i++){
     double a = A[i];
     double b = B[i];
-    norm += pow((a - b)/(1 + abs(a)), 2);
+    norm += pow((a - b)/(1 + std::abs(a)), 2);
   }
   const double return_val = sqrt(norm/A.size());
   return return_val;
@@ -124,7 +128,7 @@ double mrmsTrace(std::vector<std::vector<double>> A, std::vector<std::vector<dou
     for(unsigned int j = starting_index; j < A[0].size(); j++){
       double a = A[i][j];
       double b = B[i][j];
-      norm += pow((a - b)/(1+abs(a)), 2);
+      norm += pow((a - b)/(1+std::abs(a)), 2);
     }
   }
   return sqrt(norm/(A.size() * A[0].size()));
@@ -225,6 +229,7 @@ void compare_error_measures(int paces, boost::shared_ptr<AbstractCvodeCell> mode
      forward one pace with fine tolerances. This is very slow and involves a lot
      of work.
    */
+  TRACE_SCOPE("compare_error_measures");
 
   if(paces == INT_UNSET)
     EXCEPTION("Invalid number of paces");
@@ -234,7 +239,7 @@ void compare_error_measures(int paces, boost::shared_ptr<AbstractCvodeCell> mode
   const std::string model_name = model->GetSystemInformation()->GetSystemName();
   const unsigned int starting_index = 0;
 
-  std::cout << "For model " << model_name << " using starting_index " << starting_index << "\n";
+  AsyncWriter::Instance()->WriteToStdout("For model " + model_name + " using starting_index " + std::to_string(starting_index) + "\n");
 
   const double starting_period = period==1000?500:1000;
   const double starting_block  = period==0?0.5:0;
@@ -245,7 +250,9 @@ void compare_error_measures(int paces, boost::shared_ptr<AbstractCvodeCell> mode
   std::stringstream input_dirname_ss;
   input_dirname_ss << model_name+"_" << std::to_string(int(starting_period)) << "ms_" << int(100*starting_block)<<"_percent_block/";
   const std::string input_dirname = (test_dir / boost::filesystem::path(input_dirname_ss.str())).string();
-  std::cout << "Testing model: " << model_name << " with period " << period << "ms and IKrBlock " << IKrBlock << " and tolerances " << tolerance << "\n";
+  std::stringstream message;
+  message << "Testing model: " << model_name << " with period " << period << "ms and IKrBlock " << IKrBlock << " and tolerances " << tolerance << "\n";
+  AsyncWriter::Instance()->WriteToStdout(message.str());
 
   const std::string input_path = (test_dir / boost::filesystem::path(input_dirname_ss.str()) / boost::filesystem::path("final_states.dat")).string();
 
@@ -258,29 +265,29 @@ void compare_error_measures(int paces, boost::shared_ptr<AbstractCvodeCell> mode
 
   const std::vector<std::string> state_variable_names = model->rGetStateVariableNames();
 
+  const std::string output_format = get_output_format();
+
   std::stringstream output_file_name;
-  output_file_name << filename_suffix << "_" << tolerance << ".dat";
+  output_file_name << filename_suffix << "_" << tolerance << (output_format=="hdf5"?".h5":".dat");
   const std::string output_file_path = (test_dir / boost::filesystem::path(dirname.str()) / boost::filesystem::path(output_file_name.str())).string();
 
-  std::cout << "outputting to " << output_file_path << "\n";
-
-  std::ofstream output_file(output_file_path);
-  if(!output_file.is_open()){
-    EXCEPTION("Failed to open file " + output_file_path);
-  }
-
-  output_file.precision(18);
-
-  output_file << "APD 2-Norm MRMS Trace-2-Norm Trace-MRMS ";
+  AsyncWriter::Instance()->WriteToStdout("outputting to " + output_file_path + "\n");
 
+  std::vector<std::string> column_names = {"APD", "2-Norm", "MRMS", "Trace-2-Norm", "Trace-MRMS"};
   std::vector<std::string> names = model->GetSystemInformation()->rGetStateVariableNames();
-  for(std::string name : names){
-    output_file << name << " ";
-  }
-  output_file << "\n";
+  column_names.insert(column_names.end(), names.begin(), names.end());
+
+  boost::shared_ptr<AbstractPaceLogWriter> p_output_writer;
+  if(output_format=="hdf5")
+    p_output_writer = boost::make_shared<Hdf5PaceLogWriter>(output_file_path, column_names);
+  else
+    p_output_writer = boost::make_shared<TextPaceLogWriter>(output_file_path, column_names, 18);
 
   std::vector<double> times;
+  std::vector<double> row;
+  row.reserve(column_names.size());
   for(int j = 0; j < paces; j++){
+    TRACE_SCOPE("compare_error_measures pace");
     OdeSolution current_solution = simulation.GetPace(1, false);
     const std::vector<std::vector<double>> previous_pace = current_solution.rGetSolutions();
     bool failed = false;
@@ -298,22 +305,24 @@ void compare_error_measures(int paces, boost::shared_ptr<AbstractCvodeCell> mode
     const std::vector<double> current_states = current_pace.back();
     const std::vector<double> previous_states = previous_pace.back();
 
-    output_file << simulation.GetApd(90, false) << " ";
-    output_file << TwoNorm(current_states, previous_states, starting_index) << " ";
-    output_file << mrms(current_states,  previous_states, starting_index) << " ";
-    output_file << TwoNormTrace(current_pace, previous_pace, starting_index) << " ";
-    output_file << mrmsTrace(current_pace, previous_pace, starting_index) << " ";
+    row.clear();
+    row.push_back(simulation.GetApd(90, false));
+    row.push_back(TwoNorm(current_states, previous_states, starting_index));
+    row.push_back(mrms(current_states,  previous_states, starting_index));
+    row.push_back(TwoNormTrace(current_pace, previous_pace, starting_index));
+    row.push_back(mrmsTrace(current_pace, previous_pace, starting_index));
     //Print state variables
-    for(unsigned int k = 0; k < current_states.size(); k++){
-      output_file << current_states[k] << " ";
+    row.insert(row.end(), current_states.begin(), current_states.end());
+    {
+      TRACE_SCOPE("AppendRow");
+      p_output_writer->AppendRow(row);
     }
-    output_file << "\n";
     if(failed){
-      std::cout << "Terminated early after " << j  << " paces";
+      AsyncWriter::Instance()->WriteToStdout("Terminated early after " + std::to_string(j) + " paces\n");
       break;
     }
   }
-  output_file.close();
+  p_output_writer->Close();
 }
 
 std::vector<boost::shared_ptr<AbstractCvodeCell>> get_models(const std::string& type){
@@ -396,6 +405,21 @@ std::vector<double> get_periods(){
   return periods;
 }
 
+std::string get_output_format(){
+  const std::string option = "--output-format";
+  /* Get the format to write per-pace logs in, either "text" (the default) or "hdf5" */
+  std::string format = "text";
+
+  if(CommandLineArguments::Instance()->OptionExists(option)){
+    format = CommandLineArguments::Instance()->GetStringCorrespondingToOption(option);
+  }
+
+  if(format!="text" && format!="hdf5"){
+    EXCEPTION("Unknown output format " + format);
+  }
+  return format;
+}
+
 double get_max_paces(){
   double paces = INT_UNSET;
   const std::string option = "--paces";
@@ -408,6 +432,32 @@ double get_max_paces(){
   return paces;
 }
 
+std::string get_trace_path(){
+  const std::string option = "--trace";
+  /* Get the path to write a Chrome trace of the run to. If no argument is given, return "" (no tracing) */
+  std::string path = "";
+
+  if(CommandLineArguments::Instance()->OptionExists(option)){
+    path = CommandLineArguments::Instance()->GetStringCorrespondingToOption(option);
+  }
+  return path;
+}
+
+unsigned int get_benchmark_repetitions(){
+  const std::string option = "--repetitions";
+  /* Get the number of times to repeat each benchmark scenario. If no argument is given, default to 3 */
+  unsigned int repetitions = 3;
+
+  if(CommandLineArguments::Instance()->OptionExists(option)){
+    repetitions = CommandLineArguments::Instance()->GetUnsignedCorrespondingToOption(option);
+  }
+
+  if(repetitions == 0){
+    EXCEPTION("--repetitions must be at least 1");
+  }
+  return repetitions;
+}
+
 std::vector<boost::shared_ptr<AbstractCvodeCell>> get_analytic_models(){
 
   boost::shared_ptr<RegularStimulus> p_stimulus;
@@ -78,4 +78,10 @@ std::vector<double> get_IKr_blocks();
 
 double get_max_paces();
 
+std::string get_output_format();
+
+unsigned int get_benchmark_repetitions();
+
+std::string get_trace_path();
+
 #endif
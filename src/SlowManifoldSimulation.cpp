@@ -0,0 +1,197 @@
+#include "SlowManifoldSimulation.hpp"
+#include "AsyncWriter.hpp"
+#include <boost/numeric/ublas/lu.hpp>
+#include <boost/numeric/ublas/vector.hpp>
+#include <algorithm>
+
+namespace ublas = boost::numeric::ublas;
+
+bool SlowManifoldSimulation::RunPaces(int max_paces){
+  /* Newton iterations can use several paces each, so count paces rather than
+     calls to RunPace, and stop computing a Jacobian when they run out */
+  mMaxPaces = max_paces;
+  bool finished = false;
+  while(!finished && mPaces < mMaxPaces){
+    finished = RunPace() || mFinished;
+    mpModel->SetForceReset(false);
+  }
+  mMaxPaces = UINT_MAX;
+  return finished;
+}
+
+bool SlowManifoldSimulation::RunPace(){
+  if(mFinished)
+    return true;
+
+  if(!mClassified){
+    // Pace normally whilst collecting states to classify the variables with
+    if(mClassificationStates.empty())
+      mClassificationStates.push_back(mpModel->GetStdVecStateVariables());
+    const bool finished = Simulation::RunPace();
+    mClassificationStates.push_back(mpModel->GetStdVecStateVariables());
+    if(!finished && mClassificationStates.size() > mClassificationPaces)
+      ClassifyVariables();
+    return finished;
+  }
+
+  if(mSlowIndices.size()==0)
+    return Simulation::RunPace();
+
+  return NewtonStep();
+}
+
+bool SlowManifoldSimulation::PaceFrom(const std::vector<double>& state){
+  mPaces++;
+  mpModel->SetStateVariables(state);
+  SolvePace();
+  return CompletePace(state);
+}
+
+std::vector<double> SlowManifoldSimulation::GetSlowResidual(const std::vector<double>& start, const std::vector<double>& end){
+  std::vector<double> residual;
+  residual.reserve(mSlowIndices.size());
+  for(unsigned int index : mSlowIndices){
+    residual.push_back(end[index] - start[index]);
+  }
+  return residual;
+}
+
+void SlowManifoldSimulation::ClassifyVariables(){
+  /* Use the median ratio of consecutive (normalised) pace-to-pace changes as
+     the contraction rate of each variable. The gates relax within a pace so
+     their changes collapse almost immediately, whereas the changes in slow
+     variables shrink by a factor close to one each pace */
+  const std::vector<std::string> names = mpModel->GetSystemInformation()->rGetStateVariableNames();
+  const unsigned int N = mClassificationStates.size();
+  mSlowIndices.clear();
+
+  for(unsigned int i = 0; i < mNumberOfStateVariables; i++){
+    std::vector<double> ratios;
+    double previous_change = 0;
+    for(unsigned int j = 0; j + 1 < N; j++){
+      const double change = std::abs(mClassificationStates[j+1][i] - mClassificationStates[j][i])/(1 + std::abs(mClassificationStates[j][i]));
+      if(previous_change > 0)
+        ratios.push_back(change/previous_change);
+      previous_change = change;
+    }
+
+    // Variables which don't change don't need to be solved for
+    if(ratios.size()==0)
+      continue;
+
+    std::nth_element(ratios.begin(), ratios.begin() + ratios.size()/2, ratios.end());
+    const double rate = ratios[ratios.size()/2];
+    if(rate > mSlowRateThreshold){
+      AsyncWriter::Instance()->WriteToStdout(names[i] + " is slow: contraction rate is " + std::to_string(rate) + "\n");
+      mSlowIndices.push_back(i);
+    }
+  }
+  AsyncWriter::Instance()->WriteToStdout("Solving for " + std::to_string(mSlowIndices.size()) + " slow variables out of " + std::to_string(mNumberOfStateVariables) + "\n");
+
+  mClassificationStates.clear();
+  mClassified = true;
+  mJacobianValid = false;
+}
+
+bool SlowManifoldSimulation::ComputeJacobian(const std::vector<double>& state, const std::vector<double>& residual){
+  /* Approximate the Jacobian of residual(s) = P(s) - s by forward differences,
+     where P is the pace map restricted to the slow variables */
+  const unsigned int k = mSlowIndices.size();
+  mJacobian.resize(k, k, false);
+  for(unsigned int j = 0; j < k; j++){
+    if(mPaces >= mMaxPaces)
+      return false;
+    const unsigned int index = mSlowIndices[j];
+    const double h = mRelativePerturbation*std::max(std::abs(state[index]), 1e-8);
+    std::vector<double> perturbed_state = state;
+    perturbed_state[index] += h;
+    if(PaceFrom(perturbed_state))
+      return true;
+    const std::vector<double> perturbed_residual = GetSlowResidual(perturbed_state, mStateVariables);
+    for(unsigned int i = 0; i < k; i++){
+      mJacobian(i, j) = (perturbed_residual[i] - residual[i])/h;
+    }
+  }
+  mJacobianValid = true;
+  return false;
+}
+
+bool SlowManifoldSimulation::NewtonStep(){
+  const unsigned int k = mSlowIndices.size();
+  const std::vector<double> start = mpModel->GetStdVecStateVariables();
+  if(PaceFrom(start))
+    return true;
+  const std::vector<double> end = mStateVariables;
+
+  const std::vector<double> residual = GetSlowResidual(start, end);
+  const std::vector<double> zeros(k, 0);
+
+  if(mJacobianValid && mLastStep.size()==k){
+    if(TwoNorm(residual, zeros) < TwoNorm(mLastResidual, zeros)){
+      // Broyden update: J += ((dr - J ds) ds^T) / (ds^T ds)
+      double step_norm2 = 0;
+      for(unsigned int i = 0; i < k; i++)
+        step_norm2 += mLastStep[i]*mLastStep[i];
+      for(unsigned int i = 0; i < k; i++){
+        double predicted = 0;
+        for(unsigned int j = 0; j < k; j++)
+          predicted += mJacobian(i, j)*mLastStep[j];
+        const double correction = (residual[i] - mLastResidual[i] - predicted)/step_norm2;
+        for(unsigned int j = 0; j < k; j++)
+          mJacobian(i, j) += correction*mLastStep[j];
+      }
+    }
+    else{
+      // The last step didn't reduce the residual so start again from a fresh Jacobian
+      mJacobianValid = false;
+    }
+  }
+
+  if(!mJacobianValid){
+    if(ComputeJacobian(start, residual))
+      return true;
+    if(!mJacobianValid){
+      // Out of paces part way through, so leave the model at the end of the last full pace
+      SetStateVariables(end);
+      return false;
+    }
+  }
+
+  // Solve J ds = -residual
+  ublas::matrix<double> lu = mJacobian;
+  ublas::permutation_matrix<std::size_t> permutation(k);
+  ublas::vector<double> step(k);
+  for(unsigned int i = 0; i < k; i++)
+    step(i) = -residual[i];
+
+  if(ublas::lu_factorize(lu, permutation) != 0){
+    AsyncWriter::Instance()->WriteToStdout("Singular Jacobian - taking a normal pace instead\n");
+    mJacobianValid = false;
+    mLastStep.clear();
+    SetStateVariables(end);
+    return false;
+  }
+  ublas::lu_substitute(lu, permutation, step);
+
+  // Don't allow any slow variable to change sign
+  double scale = 1;
+  for(unsigned int i = 0; i < k; i++){
+    const double value = start[mSlowIndices[i]];
+    if(value*(value + step(i)) <= 0 && step(i) != 0)
+      scale = std::min(scale, 0.5*std::abs(value/step(i)));
+  }
+
+  /* Take the fast variables from the end of the pace, where they have had a
+     chance to equilibrate */
+  std::vector<double> next_state = end;
+  mLastStep.resize(k);
+  for(unsigned int i = 0; i < k; i++){
+    mLastStep[i] = scale*step(i);
+    next_state[mSlowIndices[i]] = start[mSlowIndices[i]] + mLastStep[i];
+  }
+  mLastResidual = residual;
+
+  SetStateVariables(next_state);
+  RecordJump();
+  return false;
+}
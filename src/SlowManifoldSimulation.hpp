@@ -0,0 +1,76 @@
+#ifndef SLOW_MANIFOLD_SIMULATION_HPP
+#define SLOW_MANIFOLD_SIMULATION_HPP
+
+#include <boost/numeric/ublas/matrix.hpp>
+#include <climits>
+#include <string>
+#include "Simulation.hpp"
+
+/* Find the limit cycle by solving for the fixed point of the pace map on the
+   slowly varying state variables only.
+
+   The first few paces are run as normal and used to estimate how quickly the
+   pace-to-pace change in each variable decays. Variables whose changes
+   contract slowly (ion concentrations, CaMK, drug-bound states) are treated
+   as slow, everything else is left to re-equilibrate during each pace.
+
+   Each call to RunPace then performs one Newton iteration on the slow
+   variables. The Jacobian of the pace map is computed by finite differences
+   (one pace per slow variable) and then updated using Broyden's method so
+   that later iterations only cost a single pace.
+
+   Every pace, including those used for finite differences, goes through the
+   same convergence checks (stopping criterion and periodicity) as
+   Simulation::RunPace.
+ */
+class SlowManifoldSimulation : public Simulation{
+public:
+  SlowManifoldSimulation(boost::shared_ptr<AbstractCvodeCell> _p_model, double _period, std::string input_path = "", double _tol_abs=1e-8, double _tol_rel=1e-8) : Simulation(_p_model, _period, input_path, _tol_abs, _tol_rel){
+    return;
+  }
+
+  bool RunPace();
+
+  bool RunPaces(int max_paces);
+
+  // Getters and Setters
+
+  void SetClassificationPaces(unsigned int paces){mClassificationPaces = paces;}
+
+  void SetSlowRateThreshold(double threshold){mSlowRateThreshold = threshold;}
+
+  std::vector<unsigned int> GetSlowVariables(){return mSlowIndices;}
+
+private:
+  unsigned int mClassificationPaces = 10;
+  double mSlowRateThreshold = 0.5;
+  double mRelativePerturbation = 1e-4;
+
+  std::vector<std::vector<double>> mClassificationStates;
+  std::vector<unsigned int> mSlowIndices;
+  bool mClassified = false;
+
+  boost::numeric::ublas::matrix<double> mJacobian;
+  bool mJacobianValid = false;
+  std::vector<double> mLastStep;
+  std::vector<double> mLastResidual;
+
+  /* The pace count RunPaces stops at */
+  unsigned int mMaxPaces = UINT_MAX;
+
+  /* Run one pace starting from state, leaving the end state in
+     mStateVariables. Returns true if the pace finished the simulation */
+  bool PaceFrom(const std::vector<double>& state);
+
+  std::vector<double> GetSlowResidual(const std::vector<double>& start, const std::vector<double>& end);
+
+  void ClassifyVariables();
+
+  /* Returns true if one of the paces finished the simulation. The Jacobian
+     is left invalid if the paces ran out first */
+  bool ComputeJacobian(const std::vector<double>& state, const std::vector<double>& residual);
+
+  bool NewtonStep();
+};
+
+#endif
@@ -7,8 +7,14 @@
 #include <string>
 #include <sstream>
 #include <iostream>
-#include <iomanip> 
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
 #include "SmartSimulation.hpp"
+#include "CheckpointArchiveTypes.hpp"
+#include "AsyncWriter.hpp"
+#include "TraceRecorder.hpp"
+#include "VectorHelperFunctions.hpp"
 
 bool SmartSimulation::ExtrapolateState(unsigned int state_index, bool& stop_extrapolation){
   /* Calculate the log absolute differences of the state and store these in y_vals. Store the corresponding x values in x_vals*/
@@ -28,7 +34,9 @@ bool SmartSimulation::ExtrapolateState(unsigned int state_index, bool& stop_extr
   const double pmcc = CalculatePMCC(x_vals, y_vals);
 
   if(pmcc>-0.8 && std::isfinite(pmcc)){  //keep the unchanged value if there is no negative correlation (PMCC > -0.9 or PMCC = NAN)
-    std::cout <<  mpModel->GetSystemInformation()->rGetStateVariableNames()[state_index]<< ": PMCC was " << pmcc << " Ignoring. \n";
+    std::ostringstream message;
+    message << mpModel->GetSystemInformation()->rGetStateVariableNames()[state_index]<< ": PMCC was " << pmcc << " Ignoring. \n";
+    AsyncWriter::Instance()->WriteToStdout(message.str());
     return false;
   }
 
@@ -55,7 +63,7 @@ bool SmartSimulation::ExtrapolateState(unsigned int state_index, bool& stop_extr
 
   if(beta > 0){
     //The difference is increasing or
-    std::cout << mpModel->GetSystemInformation()->rGetStateVariableNames()[state_index] << ": Beta is positive\n";
+    AsyncWriter::Instance()->WriteToStdout(mpModel->GetSystemInformation()->rGetStateVariableNames()[state_index] + ": Beta is positive\n");
     return false;
   }
 
@@ -79,13 +87,13 @@ bool SmartSimulation::ExtrapolateState(unsigned int state_index, bool& stop_extr
   const double check_val = std::abs((state.front() - predicted_v0)/ V_total_difference);
 
   if(check_val > 0.5){
-    std::cout << "Not extrapolating - first residual too high \t" << check_val << "\n";
+    AsyncWriter::Instance()->WriteToStdout("Not extrapolating - first residual too high \t" + std::to_string(check_val) + "\n");
     return false;
   }
 
   // Check timescale isn't too big
   if(tau > mBufferSize * 50){
-    std::cout << "timescale too long, ignoring: tau = \t" << tau << "\n";
+    AsyncWriter::Instance()->WriteToStdout("timescale too long, ignoring: tau = \t" + std::to_string(tau) + "\n");
     return false;
   }
   // std::cout << "Change in " << p_model->GetSystemInformation()->rGetStateVariableNames()[state_index] << " is: " << change_in_variable << "\n" << "New value is " << new_value << "\n";
@@ -93,8 +101,7 @@ bool SmartSimulation::ExtrapolateState(unsigned int state_index, bool& stop_extr
   //std::cout << "Old value: " << state.back() << "\n"
 if(std::isfinite(new_value)){
     mStateVariables[state_index] = new_value;
-    const std::string var_name = mpModel->GetSystemInformation()->rGetStateVariableNames()[state_index];
-    mOutputFile << state_index << " " << var_name << " " << beta << " " << alpha <<  " " << state.back()+change_in_variable << "\n";
+    mExtrapolationFits.push_back({state_index, beta, alpha});
     return true;
   }
   else{
@@ -104,6 +111,7 @@ if(std::isfinite(new_value)){
 
 
 bool SmartSimulation::RunPace(){
+  TRACE_SCOPE("SmartSimulation::RunPace");
   mPaces++;
   bool extrapolated = false;
 
@@ -114,21 +122,21 @@ bool SmartSimulation::RunPace(){
   if(!extrapolated){
     /*Solve in two parts*/
     try{
-      mpModel->SolveAndUpdateState(0, mpStimulus->GetDuration());
-      mpModel->SolveAndUpdateState(mpStimulus->GetDuration(), mPeriod);
+      SolvePace();
     }
     catch(Exception &e){
       if(mSafeStateVariables.size()==0){
         // We can't recover so throw an exception
-        throw std::exception();
+        EXCEPTION("Pace " + std::to_string(mPaces) + " failed with no safe state to return to: " + e.GetShortMessage());
       }
-      std::cout << "RunPace failed - returning to old mStateVariables\n";
+      AsyncWriter::Instance()->WriteToStdout("RunPace failed - returning to old mStateVariables\n");
       mStateVariables = mSafeStateVariables;
       mSafeStateVariables.clear();
       mpModel->SetStateVariables(mStateVariables);
       std::ofstream errors;
       mMrmsBuffer.clear();
       mStatesBuffer.clear();
+      mPaceEndStates.clear();
 
       // The solver has been crashed so maybe don't do any more extrapolations?
       // mMaxJumps=0;
@@ -137,12 +145,19 @@ bool SmartSimulation::RunPace(){
     std::vector<double> new_state_variables = GetStateVariables();
     mStatesBuffer.push_back(new_state_variables);
     mCurrentMrms = mrms(new_state_variables, mStateVariables);
+    mTelemetry.rGetLatest().mrms = mCurrentMrms;
     mMrmsBuffer.push_back(mCurrentMrms);
+    const bool converged = HasConverged(mStateVariables, new_state_variables);
     mStateVariables = new_state_variables;
-    if(mCurrentMrms < mThreshold && mTerminateOnConvergence){
+    if(converged && mTerminateOnConvergence){
       mFinished = true;
       return true;
     }
+    if(DetectPeriodicity(new_state_variables) > 1 && mTerminateOnConvergence){
+      mFinished = true;
+      AsyncWriter::Instance()->WriteToStdout("finished after " + std::to_string(mPaces) + " paces on a period " + std::to_string(mPeriodicity) + " orbit\n");
+      return true;
+    }
   }
   else{
     mCurrentMrms = 0;
@@ -151,8 +166,12 @@ bool SmartSimulation::RunPace(){
 }
 
 bool SmartSimulation::ExtrapolateStates(){
+    TRACE_SCOPE("ExtrapolateStates");
     if(mJumps>=mMaxJumps)
       return false;
+    // Wait a few paces after a rejected jump so the fit has new data
+    if(mPaces < mNextExtrapolationPace)
+      return false;
     if(!mMrmsBuffer.full())
       return false;
     double mrms_pmcc = CalculatePMCC(mMrmsBuffer);
@@ -162,11 +181,11 @@ bool SmartSimulation::ExtrapolateStates(){
     boost::filesystem::create_directory(dir_name);
     if(true){// if(mrms_pmcc < -0.90){
       mSafeStateVariables = mStateVariables;
-      std::cout << "Extrapolating - start of buffer is " << mPaces - mBufferSize + 1<< "\n";
+      AsyncWriter::Instance()->WriteToStdout("Extrapolating - start of buffer is " + std::to_string(mPaces - mBufferSize + 1) + "\n");
 
-      mOutputFile.open(dir_name + "/" + std::to_string(int(mPeriod)) + "JumpParameters" + std::to_string(mJumps) + ".dat");
-      mOutputFile << std::setprecision(20);
-      mOutputFile << mPaces << " " << mBufferSize << " " << mExtrapolationConstant << "\n";
+      // Written out once the jump has been checked, so that it records what was used
+      const std::string jump_parameters_path = dir_name + "/" + std::to_string(int(mPeriod)) + "JumpParameters" + std::to_string(mJumps) + ".dat";
+      mExtrapolationFits.clear();
 
       bool stop_extrapolation = false;
       for(unsigned int i = 0; i < mStateVariables.size(); i++){
@@ -178,23 +197,50 @@ bool SmartSimulation::ExtrapolateStates(){
       }
 
       if(stop_extrapolation){
+        mStateVariables = mSafeStateVariables;
         mpModel->SetStateVariables(mSafeStateVariables);
+        mExtrapolationFits.clear();
         extrapolated=false;
       }
 
-      mOutputFile.close();
+      double scale = 1;
+      if(extrapolated && !GuardExtrapolation(scale)){
+        // Roll back, but keep the buffers so that fitting can resume straight away
+        mRejectedExtrapolations++;
+        mNextExtrapolationPace = mPaces + mRetryDelay;
+        mStateVariables = mSafeStateVariables;
+        mpModel->SetStateVariables(mSafeStateVariables);
+        AsyncWriter::Instance()->WriteToStdout("Extrapolation rejected - trying again after pace " + std::to_string(mNextExtrapolationPace) + "\n");
+        return false;
+      }
+
+      // The new value is the one used, which is damped if the full jump was rejected
+      std::ostringstream jump_parameters;
+      jump_parameters << std::setprecision(20);
+      jump_parameters << mPaces << " " << mBufferSize << " " << mExtrapolationConstant << " " << scale << "\n";
+      const std::vector<std::string>& names = mpModel->GetSystemInformation()->rGetStateVariableNames();
+      for(const ExtrapolationFit& fit : mExtrapolationFits){
+        jump_parameters << fit.state_index << " " << names[fit.state_index] << " " << fit.beta << " " << fit.alpha << " " << mStateVariables[fit.state_index] << "\n";
+      }
+      AsyncWriter::Instance()->Open(jump_parameters_path);
+      AsyncWriter::Instance()->Write(jump_parameters_path, jump_parameters.str());
+      AsyncWriter::Instance()->Close(jump_parameters_path);
 
       if(extrapolated){
         mJumps++;
         mpModel->SetStateVariables(mStateVariables);
-        std::cout << "Extrapolated \n";
-
+        RecordJump();
+        // Histories from before the jump aren't comparable with what follows
+        if(mpStoppingCriterion)
+          mpStoppingCriterion->Reset();
         // Debugging
-        std::cout << "new state variables are:\n";
+        std::ostringstream message;
+        message << "Extrapolated \nnew state variables are:\n";
         for(auto variable : mStateVariables){
-          std::cout << variable << " ";
+          message << variable << " ";
         }
-        std::cout<<"\n";
+        message << "\n";
+        AsyncWriter::Instance()->WriteToStdout(message.str());
       }
       mMrmsBuffer.clear();
       mStatesBuffer.clear();
@@ -203,3 +249,107 @@ bool SmartSimulation::ExtrapolateStates(){
     else
       return false;
   }
+
+bool SmartSimulation::GuardExtrapolation(double& scale){
+  TRACE_SCOPE("GuardExtrapolation");
+  const std::vector<double> candidate = mStateVariables;
+  scale = 1;
+  for(unsigned int attempt = 0; attempt <= mMaxDampings; attempt++){
+    std::vector<double> state = mSafeStateVariables;
+    for(unsigned int i = 0; i < state.size(); i++){
+      state[i] += scale*(candidate[i] - mSafeStateVariables[i]);
+    }
+    std::string reason;
+    if(ValidateState(state, reason)){
+      if(scale < 1)
+        AsyncWriter::Instance()->WriteToStdout("Using " + std::to_string(scale) + " of the extrapolated jump\n");
+      mStateVariables = state;
+      return true;
+    }
+    AsyncWriter::Instance()->WriteToStdout("Extrapolated state rejected: " + reason + "\n");
+    scale /= 2;
+  }
+  return false;
+}
+
+bool SmartSimulation::ValidateState(const std::vector<double>& state, std::string& reason){
+  const std::vector<std::string>& names = mpModel->GetSystemInformation()->rGetStateVariableNames();
+
+  // Physical bounds, judged by what each variable did over the buffer
+  for(unsigned int i = 0; i < state.size(); i++){
+    if(!std::isfinite(state[i])){
+      reason = names[i] + " is not finite";
+      return false;
+    }
+    const std::vector<double> history = cGetNthVariable(mStatesBuffer, i);
+    const bool positive = std::all_of(history.begin(), history.end(), [](double value){return value > 0;});
+    const bool fraction = std::all_of(history.begin(), history.end(), [](double value){return value >= 0 && value <= 1;});
+    if(fraction && (state[i] < 0 || state[i] > 1)){
+      reason = names[i] + " = " + std::to_string(state[i]) + " is outside [0, 1]";
+      return false;
+    }
+    if(positive && state[i] <= 0){
+      reason = names[i] + " = " + std::to_string(state[i]) + " is not positive";
+      return false;
+    }
+  }
+
+  // The voltage of an analytic voltage model follows from the net charge
+  // held in the concentrations, so an inconsistent jump shows up here first
+  const bool analytic_voltage = !mpModel->GetSystemInformation()->HasStateVariable("membrane_voltage") && mpModel->GetSystemInformation()->HasDerivedQuantity("membrane_voltage");
+  if(analytic_voltage){
+    const double voltage_change = GetAnalyticVoltage(state) - GetAnalyticVoltage(mSafeStateVariables);
+    if(!(std::abs(voltage_change) <= mMaxVoltageChange)){
+      reason = "resting voltage would change by " + std::to_string(voltage_change) + "mV";
+      return false;
+    }
+  }
+
+  // Finally make sure the solver can get through the start of the pace.
+  // This goes through SolveSegment, split at the end of the stimulus, so
+  // that it uses the same tolerances and retry level as the pace would.
+  // The trial isn't part of a pace, so no pace trace is recorded
+  bool solved = true;
+  const double trial_end = std::min(mTrialDuration, mPeriod);
+  const double stimulus_end = std::min(mpStimulus->GetDuration(), trial_end);
+  const double sampling_timestep = mPaceTraceSamplingTimestep;
+  mPaceTraceSamplingTimestep = DOUBLE_UNSET;
+  mpModel->SetStateVariables(state);
+  try{
+    SolveSegment(0, stimulus_end);
+    if(trial_end > stimulus_end)
+      SolveSegment(stimulus_end, trial_end);
+  }
+  catch(const Exception& e){
+    reason = "trial integration failed: " + e.GetShortMessage();
+    solved = false;
+  }
+  mPaceTraceSamplingTimestep = sampling_timestep;
+  if(solved){
+    const std::vector<double> trial_state = mpModel->GetStdVecStateVariables();
+    if(!std::all_of(trial_state.begin(), trial_state.end(), [](double value){return std::isfinite(value);})){
+      reason = "trial integration gave non-finite values";
+      solved = false;
+    }
+  }
+  mpModel->SetStateVariables(state);
+  return solved;
+}
+
+double SmartSimulation::GetAnalyticVoltage(const std::vector<double>& state){
+  N_Vector vector = nullptr;
+  CreateVectorIfEmpty(vector, state.size());
+  CopyFromStdVector(state, vector);
+  const unsigned int index = mpModel->GetSystemInformation()->GetDerivedQuantityIndex("membrane_voltage");
+  const double voltage = mpModel->ComputeDerivedQuantities(0, vector)[index];
+  DeleteVector(vector);
+  return voltage;
+}
+
+void SmartSimulation::WriteCheckpoint(boost::archive::binary_oarchive& rArchive) const{
+  rArchive << *this;
+}
+
+void SmartSimulation::ReadCheckpoint(boost::archive::binary_iarchive& rArchive){
+  rArchive >> *this;
+}
@@ -5,6 +5,7 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <string>
+#include <boost/serialization/base_object.hpp>
 #include "Simulation.hpp"
 
 
@@ -22,7 +23,7 @@ public:
     mPeriod = _period;
     mpModel->SetMaxSteps(1e5);
     mpModel->SetMaxTimestep(1000);
-    mpModel->SetTolerances(mTolAbs, mTolRel);
+    SetTolerances(_tol_abs, _tol_rel);
     mpModel->SetMinimalReset(false); //Not sure if this is needed
     mNumberOfStateVariables = mpModel->GetSystemInformation()->rGetStateVariableNames().size();
     mStateVariables = mpModel->GetStdVecStateVariables();
@@ -33,6 +34,7 @@ public:
 
     mMrmsBuffer.set_capacity(mBufferSize);
     mStatesBuffer.set_capacity(mBufferSize);
+    SetDefaultTelemetryDumpPath();
 
     if(output_dir=="")
       mOutputDir = std::string(getenv("CHASTE_TEST_OUTPUT"));
@@ -56,6 +58,28 @@ public:
   }
 
   void SetMaxJumps(unsigned int max_jumps){mMaxJumps = max_jumps;}
+
+  /* Extrapolated states are checked before they're used (see
+     ValidateState). A rejected state is halved towards the last paced state
+     up to max_dampings times before the jump is abandoned. The buffers are
+     kept after a rejection and the next fit is tried retry_delay paces later */
+  void SetExtrapolationGuard(unsigned int max_dampings, unsigned int retry_delay){
+    mMaxDampings = max_dampings;
+    mRetryDelay = retry_delay;
+  }
+
+  /* The largest change in the resting voltage of an analytic voltage model
+     allowed in one jump (mV) and how long to test integrate a new state (ms) */
+  void SetExtrapolationChecks(double max_voltage_change, double trial_duration){
+    mMaxVoltageChange = max_voltage_change;
+    mTrialDuration = trial_duration;
+  }
+
+  unsigned int GetRejectedExtrapolations(){return mRejectedExtrapolations;}
+
+  /* The number of paces held in the buffers extrapolation is fitted to */
+  unsigned int GetBufferedPaces(){return mStatesBuffer.size();}
+
   void SetOutputDir(std::string dir){
     mOutputDir = dir;
     boost::filesystem::create_directories(dir);
@@ -71,8 +95,76 @@ private:
   std::vector<double> mSafeStateVariables;
   std::ofstream errors;
 
+  /* The fit found for each extrapolated variable, written to the jump
+     parameters file along with the value actually used */
+  struct ExtrapolationFit{
+    unsigned int state_index;
+    double beta;
+    double alpha;
+  };
+  std::vector<ExtrapolationFit> mExtrapolationFits;
+
   bool ExtrapolateState(unsigned int state_index, bool& stop_extrapolation);
   bool ExtrapolateStates();
+
+  unsigned int mMaxDampings = 2;
+  unsigned int mRetryDelay = 10;
+  double mMaxVoltageChange = 5;
+  double mTrialDuration = 50;
+  unsigned int mNextExtrapolationPace = 0;
+  unsigned int mRejectedExtrapolations = 0;
+
+  /* Check an extrapolated state before committing to it: every variable must
+     be finite, stay within [0, 1] or stay positive if it did so throughout the
+     buffer, an analytic voltage model's resting voltage (i.e. its net charge)
+     mustn't move by more than mMaxVoltageChange, and CVODE must be able to
+     integrate it over the first mTrialDuration ms of a pace. Sets reason if
+     the state is rejected */
+  bool ValidateState(const std::vector<double>& state, std::string& reason);
+
+  /* Validate mStateVariables, damping the jump if necessary. Returns false if
+     no acceptable state was found, otherwise sets scale to the fraction of
+     the jump that was used */
+  bool GuardExtrapolation(double& scale);
+
+  double GetAnalyticVoltage(const std::vector<double>& state);
+
+  void WriteCheckpoint(boost::archive::binary_oarchive& rArchive) const override;
+  void ReadCheckpoint(boost::archive::binary_iarchive& rArchive) override;
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void serialize(Archive & archive, const unsigned int version){
+    archive & boost::serialization::base_object<Simulation>(*this);
+    archive & mBufferSize;
+    archive & mExtrapolationConstant;
+    archive & mJumps;
+    archive & mMaxJumps;
+    archive & mSafeStateVariables;
+
+    // circular_buffer isn't serializable so archive the buffers as vectors
+    std::vector<std::vector<double>> states_buffer(mStatesBuffer.begin(), mStatesBuffer.end());
+    std::vector<double> mrms_buffer(mMrmsBuffer.begin(), mMrmsBuffer.end());
+    archive & states_buffer;
+    archive & mrms_buffer;
+
+    archive & mMaxDampings;
+    archive & mRetryDelay;
+    archive & mMaxVoltageChange;
+    archive & mTrialDuration;
+    archive & mNextExtrapolationPace;
+    archive & mRejectedExtrapolations;
+
+    if(Archive::is_loading::value){
+      SetBufferSize(mBufferSize);
+      mStatesBuffer.clear();
+      mMrmsBuffer.clear();
+      for(auto states : states_buffer)
+        mStatesBuffer.push_back(states);
+      for(auto mrms_value : mrms_buffer)
+        mMrmsBuffer.push_back(mrms_value);
+    }
+  }
 };
 
 #endif
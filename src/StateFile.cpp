@@ -0,0 +1,195 @@
+#include "StateFile.hpp"
+#include "AsyncWriter.hpp"
+#include "Exception.hpp"
+#include <boost/algorithm/string.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+static const char STATE_FILE_MAGIC[8] = {'C', 'H', 'S', 'T', 'A', 'T', 'E', '\0'};
+static const uint32_t STATE_FILE_VERSION = 1;
+
+/* 64-bit FNV-1a hash, used to detect corrupted or truncated state files */
+static void UpdateChecksum(uint64_t& checksum, const char* data, std::size_t size){
+  for(std::size_t i = 0; i < size; i++){
+    checksum ^= (unsigned char) data[i];
+    checksum *= 1099511628211ull;
+  }
+}
+
+static const uint64_t CHECKSUM_SEED = 14695981039346656037ull;
+
+static void WriteString(std::string& bytes, uint64_t& checksum, const std::string& str){
+  const uint32_t length = str.size();
+  bytes.append((const char*) &length, sizeof(length));
+  bytes.append(str.data(), length);
+  UpdateChecksum(checksum, (const char*) &length, sizeof(length));
+  UpdateChecksum(checksum, str.data(), length);
+}
+
+void WriteStatesToBinaryFile(boost::shared_ptr<AbstractCvodeCell> p_model, std::string file_path){
+  const std::vector<double> states = p_model->GetStdVecStateVariables();
+  const std::vector<std::string>& names = p_model->GetSystemInformation()->rGetStateVariableNames();
+  const std::vector<std::string>& units = p_model->GetSystemInformation()->rGetStateVariableUnits();
+  const uint32_t N = states.size();
+
+  uint64_t checksum = CHECKSUM_SEED;
+  std::string bytes(STATE_FILE_MAGIC, sizeof(STATE_FILE_MAGIC));
+  bytes.append((const char*) &STATE_FILE_VERSION, sizeof(STATE_FILE_VERSION));
+  bytes.append((const char*) &N, sizeof(N));
+  UpdateChecksum(checksum, (const char*) &N, sizeof(N));
+
+  WriteString(bytes, checksum, p_model->GetSystemInformation()->GetSystemName());
+  for(unsigned int i = 0; i < N; i++){
+    WriteString(bytes, checksum, names[i]);
+    WriteString(bytes, checksum, units[i]);
+  }
+
+  UpdateChecksum(checksum, (const char*) states.data(), N*sizeof(double));
+  bytes.append((const char*) &checksum, sizeof(checksum));
+  bytes.append((const char*) states.data(), N*sizeof(double));
+
+  AsyncWriter::Instance()->Open(file_path);
+  AsyncWriter::Instance()->Write(file_path, std::move(bytes));
+  AsyncWriter::Instance()->Close(file_path);
+}
+
+bool IsBinaryStateFile(std::string file_path){
+  std::ifstream f_in(file_path, std::ios::binary);
+  char magic[sizeof(STATE_FILE_MAGIC)];
+  if(!f_in.read(magic, sizeof(magic)))
+    return false;
+  return std::memcmp(magic, STATE_FILE_MAGIC, sizeof(magic))==0;
+}
+
+/* Reads successive fields from a memory mapped file, checking that we don't
+   run off the end */
+class MappedFileReader{
+public:
+  MappedFileReader(const char* p_data, std::size_t size, std::string file_path) : mpData(p_data), mSize(size), mFilePath(file_path){
+  }
+
+  const char* Read(std::size_t size){
+    if(mPosition + size > mSize){
+      EXCEPTION("State file " + mFilePath + " is truncated");
+    }
+    const char* p_field = mpData + mPosition;
+    mPosition += size;
+    return p_field;
+  }
+
+  template<typename T>
+  T ReadValue(){
+    T value;
+    std::memcpy(&value, Read(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  std::string ReadString(uint64_t& checksum){
+    const uint32_t length = ReadValue<uint32_t>();
+    UpdateChecksum(checksum, (const char*) &length, sizeof(length));
+    const char* p_str = Read(length);
+    UpdateChecksum(checksum, p_str, length);
+    return std::string(p_str, length);
+  }
+
+private:
+  const char* mpData;
+  std::size_t mSize;
+  std::size_t mPosition = 0;
+  std::string mFilePath;
+};
+
+StateFileContents ReadBinaryStateFile(std::string file_path){
+  boost::interprocess::file_mapping mapping(file_path.c_str(), boost::interprocess::read_only);
+  boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+  MappedFileReader reader((const char*) region.get_address(), region.get_size(), file_path);
+
+  if(std::memcmp(reader.Read(sizeof(STATE_FILE_MAGIC)), STATE_FILE_MAGIC, sizeof(STATE_FILE_MAGIC))!=0){
+    EXCEPTION(file_path + " is not a binary state file");
+  }
+  const uint32_t version = reader.ReadValue<uint32_t>();
+  if(version != STATE_FILE_VERSION){
+    EXCEPTION("Unsupported state file version " + std::to_string(version) + " in " + file_path);
+  }
+
+  StateFileContents contents;
+  uint64_t checksum = CHECKSUM_SEED;
+  const uint32_t N = reader.ReadValue<uint32_t>();
+  UpdateChecksum(checksum, (const char*) &N, sizeof(N));
+
+  contents.model_name = reader.ReadString(checksum);
+  for(unsigned int i = 0; i < N; i++){
+    contents.names.push_back(reader.ReadString(checksum));
+    contents.units.push_back(reader.ReadString(checksum));
+  }
+
+  const uint64_t stored_checksum = reader.ReadValue<uint64_t>();
+  const char* p_values = reader.Read(N*sizeof(double));
+  UpdateChecksum(checksum, p_values, N*sizeof(double));
+  if(checksum != stored_checksum){
+    EXCEPTION("Checksum mismatch in state file " + file_path);
+  }
+
+  contents.values.resize(N);
+  std::memcpy(contents.values.data(), p_values, N*sizeof(double));
+  return contents;
+}
+
+StateFileContents ReadTextStateFile(std::string file_path){
+  std::ifstream file_in(file_path);
+  if(!file_in.is_open()){
+    EXCEPTION("Couldn't open file " + file_path);
+  }
+
+  StateFileContents contents;
+  std::string line;
+  std::vector<std::string> fields;
+
+  // The first line contains the variable names, the second the values
+  std::getline(file_in, line);
+  boost::split(fields, line, boost::is_any_of(" "), boost::token_compress_on);
+  for(auto field : fields){
+    if(field!="")
+      contents.names.push_back(field);
+  }
+
+  std::getline(file_in, line);
+  boost::split(fields, line, boost::is_any_of(" "), boost::token_compress_on);
+  for(auto field : fields){
+    if(field!="")
+      contents.values.push_back(std::stod(field));
+  }
+
+  file_in.close();
+  return contents;
+}
+
+std::vector<double> MapStatesByName(boost::shared_ptr<AbstractCvodeCell> p_model, const StateFileContents& contents){
+  const std::vector<std::string>& names = p_model->GetSystemInformation()->rGetStateVariableNames();
+  std::vector<double> states = p_model->GetStdVecStateVariables();
+
+  if(contents.names.size() != contents.values.size()){
+    EXCEPTION("State file has " + std::to_string(contents.names.size()) + " names but " + std::to_string(contents.values.size()) + " values");
+  }
+
+  unsigned int matched = 0;
+  for(unsigned int i = 0; i < names.size(); i++){
+    auto found = std::find(contents.names.begin(), contents.names.end(), names[i]);
+    if(found != contents.names.end()){
+      states[i] = contents.values[found - contents.names.begin()];
+      matched++;
+    }
+    else{
+      AsyncWriter::Instance()->WriteToStdout("State variable " + names[i] + " not found in state file - keeping current value\n");
+    }
+  }
+
+  if(matched != contents.names.size()){
+    AsyncWriter::Instance()->WriteToStdout("Ignored " + std::to_string(contents.names.size() - matched) + " variables from state file which aren't in " + p_model->GetSystemInformation()->GetSystemName() + "\n");
+  }
+  return states;
+}
@@ -0,0 +1,53 @@
+#ifndef STATE_FILE_HPP
+#define STATE_FILE_HPP
+
+#include "AbstractCvodeCell.hpp"
+#include <string>
+#include <vector>
+
+/* Reading and writing of state vectors.
+
+   The binary format (version 1) is laid out as:
+
+     "CHSTATE" followed by a null byte
+     uint32  format version
+     uint32  number of state variables, N
+     string  model name
+     N x (string variable name, string units)
+     uint64  checksum of everything above (after the version) and the values
+     N x double  state variable values
+
+   where each string is a uint32 length followed by its characters. All
+   numbers are in the native byte order of the machine the file was written on.
+
+   Values are always matched to the model's state variables by name, so that
+   states can be exchanged between variants of a model (for example the
+   original and analytic voltage versions, which differ by membrane_voltage).
+   Any variable not present in the file keeps its current value.
+ */
+
+struct StateFileContents{
+  std::string model_name;
+  std::vector<std::string> names;
+  std::vector<std::string> units;
+  std::vector<double> values;
+};
+
+/* Queue the model's current state to be written through the AsyncWriter.
+   Errors are reported by AsyncWriter::Flush */
+void WriteStatesToBinaryFile(boost::shared_ptr<AbstractCvodeCell> p_model, std::string file_path);
+
+/* Read a binary state file by memory mapping it. Throws if the file is
+   truncated or the checksum doesn't match */
+StateFileContents ReadBinaryStateFile(std::string file_path);
+
+/* Read a text state file: a line of variable names followed by a line of values */
+StateFileContents ReadTextStateFile(std::string file_path);
+
+bool IsBinaryStateFile(std::string file_path);
+
+/* Return the model's current state with any variables named in contents
+   replaced by their values from contents */
+std::vector<double> MapStatesByName(boost::shared_ptr<AbstractCvodeCell> p_model, const StateFileContents& contents);
+
+#endif
@@ -0,0 +1,246 @@
+#include "StoppingCriteria.hpp"
+#include "SimulationTools.hpp"
+#include "CellProperties.hpp"
+#include "Exception.hpp"
+#include "VectorHelperFunctions.hpp"
+#include <algorithm>
+#include <cmath>
+
+bool MrmsCriterion::Update(const PaceObservation& observation){
+  mValue = mrms(observation.rPreviousState, observation.rCurrentState);
+  return mValue < mThreshold;
+}
+
+/* Check the length of a history given back to a criterion, which only
+   differs from what GetHistory returned if the criteria were set up
+   differently when the run was resumed */
+static void CheckHistorySize(const std::vector<double>& rHistory, unsigned int size, const std::string& name){
+  if(rHistory.size() != size){
+    EXCEPTION("History for stopping criterion " + name + " has " + std::to_string(rHistory.size()) + " entries but " + std::to_string(size) + " were expected");
+  }
+}
+
+void MrmsCriterion::SetHistory(const std::vector<double>& rHistory){
+  CheckHistorySize(rHistory, 1, GetName());
+  mValue = rHistory[0];
+}
+
+bool TwoNormCriterion::Update(const PaceObservation& observation){
+  mValue = TwoNorm(observation.rPreviousState, observation.rCurrentState);
+  return mValue < mThreshold;
+}
+
+void TwoNormCriterion::SetHistory(const std::vector<double>& rHistory){
+  CheckHistorySize(rHistory, 1, GetName());
+  mValue = rHistory[0];
+}
+
+bool TraceMrmsCriterion::Update(const PaceObservation& observation){
+  if(observation.rTrace.empty()){
+    EXCEPTION("TraceMrmsCriterion needs a pace trace");
+  }
+  const bool comparable = mPreviousTrace.size() == observation.rTrace.size();
+  mValue = comparable ? mrmsTrace(observation.rTrace, mPreviousTrace) : NAN;
+  mPreviousTrace = observation.rTrace;
+  return comparable && mValue < mThreshold;
+}
+
+std::vector<double> TraceMrmsCriterion::GetHistory() const{
+  // The value, then the shape of the previous trace followed by its entries
+  std::vector<double> history = {mValue, double(mPreviousTrace.size()), double(mPreviousTrace.empty() ? 0 : mPreviousTrace.front().size())};
+  for(const auto& state : mPreviousTrace)
+    history.insert(history.end(), state.begin(), state.end());
+  return history;
+}
+
+void TraceMrmsCriterion::SetHistory(const std::vector<double>& rHistory){
+  if(rHistory.size() < 3){
+    CheckHistorySize(rHistory, 3, GetName());
+  }
+  const unsigned int rows = rHistory[1];
+  const unsigned int columns = rHistory[2];
+  CheckHistorySize(rHistory, 3 + rows*columns, GetName());
+  mValue = rHistory[0];
+  mPreviousTrace.clear();
+  for(unsigned int i = 0; i < rows; i++)
+    mPreviousTrace.emplace_back(rHistory.begin() + 3 + i*columns, rHistory.begin() + 3 + (i+1)*columns);
+}
+
+/* The membrane voltage at each point of the trace, whether it is a state
+   variable or (in the analytic voltage models) a derived quantity */
+static std::vector<double> GetVoltages(const PaceObservation& observation){
+  boost::shared_ptr<const AbstractOdeSystemInformation> p_info = observation.pModel->GetSystemInformation();
+  std::vector<double> voltages;
+  voltages.reserve(observation.rTrace.size());
+  if(p_info->HasStateVariable("membrane_voltage")){
+    const unsigned int index = p_info->GetStateVariableIndex("membrane_voltage");
+    for(const auto& state : observation.rTrace)
+      voltages.push_back(state[index]);
+  }
+  else{
+    const unsigned int index = p_info->GetDerivedQuantityIndex("membrane_voltage");
+    N_Vector state = nullptr;
+    CreateVectorIfEmpty(state, observation.rCurrentState.size());
+    for(unsigned int i = 0; i < observation.rTrace.size(); i++){
+      CopyFromStdVector(observation.rTrace[i], state);
+      voltages.push_back(observation.pModel->ComputeDerivedQuantities(observation.rTimes[i], state)[index]);
+    }
+    DeleteVector(state);
+  }
+  return voltages;
+}
+
+bool ApdChangeCriterion::Update(const PaceObservation& observation){
+  if(observation.rTrace.empty()){
+    EXCEPTION("ApdChangeCriterion needs a pace trace");
+  }
+  double apd = NAN;
+  try{
+    CellProperties cell_props(GetVoltages(observation), observation.rTimes);
+    apd = cell_props.GetAllActionPotentialDurations(mPercentage).front();
+  }
+  catch(const Exception&){
+    // No action potential this pace
+  }
+  mValue = std::abs(apd - mPreviousApd);
+  mPreviousApd = apd;
+  return mValue < mThreshold;
+}
+
+void ApdChangeCriterion::SetHistory(const std::vector<double>& rHistory){
+  CheckHistorySize(rHistory, 2, GetName());
+  mValue = rHistory[0];
+  mPreviousApd = rHistory[1];
+}
+
+bool MrmsPmccCriterion::Update(const PaceObservation& observation){
+  const double current_mrms = mrms(observation.rPreviousState, observation.rCurrentState);
+  if(current_mrms == 0){
+    // The pace changed nothing so there's no trend left to wait for
+    return true;
+  }
+  mLogMrms.push_back(log(current_mrms));
+  if(!mLogMrms.full())
+    return false;
+  mValue = CalculatePMCC(mLogMrms);
+  return mValue <= 0 && mValue > -mThreshold && current_mrms < mMaxMrms;
+}
+
+std::vector<double> MrmsPmccCriterion::GetHistory() const{
+  std::vector<double> history = {mValue};
+  history.insert(history.end(), mLogMrms.begin(), mLogMrms.end());
+  return history;
+}
+
+void MrmsPmccCriterion::SetHistory(const std::vector<double>& rHistory){
+  if(rHistory.empty() || rHistory.size() > mLogMrms.capacity() + 1){
+    EXCEPTION("History for stopping criterion " + GetName() + " doesn't fit its window");
+  }
+  mValue = rHistory[0];
+  mLogMrms.assign(mLogMrms.capacity(), rHistory.begin() + 1, rHistory.end());
+}
+
+/* A combinator's history is each child's history in turn, each preceded by
+   its length */
+static std::vector<double> GetChildHistories(double value, const std::vector<boost::shared_ptr<AbstractStoppingCriterion>>& criteria){
+  std::vector<double> history = {value};
+  for(auto p_criterion : criteria){
+    const std::vector<double> child_history = p_criterion->GetHistory();
+    history.push_back(child_history.size());
+    history.insert(history.end(), child_history.begin(), child_history.end());
+  }
+  return history;
+}
+
+static double SetChildHistories(const std::vector<double>& rHistory, const std::vector<boost::shared_ptr<AbstractStoppingCriterion>>& criteria, const std::string& name){
+  unsigned int position = 1;
+  for(auto p_criterion : criteria){
+    if(position >= rHistory.size() || position + 1 + rHistory[position] > rHistory.size()){
+      EXCEPTION("History for stopping criterion " + name + " doesn't match its children");
+    }
+    const unsigned int length = rHistory[position];
+    p_criterion->SetHistory(std::vector<double>(rHistory.begin() + position + 1, rHistory.begin() + position + 1 + length));
+    position += 1 + length;
+  }
+  CheckHistorySize(rHistory, position, name);
+  return rHistory[0];
+}
+
+bool AllOfCriterion::Update(const PaceObservation& observation){
+  mValue = 0;
+  for(auto p_criterion : mCriteria){
+    if(p_criterion->Update(observation))
+      mValue++;
+  }
+  return mValue == mCriteria.size();
+}
+
+void AllOfCriterion::Reset(){
+  for(auto p_criterion : mCriteria)
+    p_criterion->Reset();
+}
+
+std::vector<double> AllOfCriterion::GetHistory() const{
+  return GetChildHistories(mValue, mCriteria);
+}
+
+void AllOfCriterion::SetHistory(const std::vector<double>& rHistory){
+  mValue = SetChildHistories(rHistory, mCriteria, GetName());
+}
+
+/* The finest trace any of the criteria needs */
+static double GetFinestSamplingTimestep(const std::vector<boost::shared_ptr<AbstractStoppingCriterion>>& criteria){
+  double sampling_timestep = DOUBLE_UNSET;
+  for(auto p_criterion : criteria){
+    const double timestep = p_criterion->GetSamplingTimestep();
+    if(timestep != DOUBLE_UNSET && (sampling_timestep == DOUBLE_UNSET || timestep < sampling_timestep))
+      sampling_timestep = timestep;
+  }
+  return sampling_timestep;
+}
+
+double AllOfCriterion::GetSamplingTimestep() const{
+  return GetFinestSamplingTimestep(mCriteria);
+}
+
+bool AnyOfCriterion::Update(const PaceObservation& observation){
+  mValue = 0;
+  for(auto p_criterion : mCriteria){
+    if(p_criterion->Update(observation))
+      mValue++;
+  }
+  return mValue > 0;
+}
+
+void AnyOfCriterion::Reset(){
+  for(auto p_criterion : mCriteria)
+    p_criterion->Reset();
+}
+
+double AnyOfCriterion::GetSamplingTimestep() const{
+  return GetFinestSamplingTimestep(mCriteria);
+}
+
+std::vector<double> AnyOfCriterion::GetHistory() const{
+  return GetChildHistories(mValue, mCriteria);
+}
+
+void AnyOfCriterion::SetHistory(const std::vector<double>& rHistory){
+  mValue = SetChildHistories(rHistory, mCriteria, GetName());
+}
+
+bool KConsecutiveCriterion::Update(const PaceObservation& observation){
+  if(mpCriterion->Update(observation))
+    mRun++;
+  else
+    mRun = 0;
+  return mRun >= mK;
+}
+
+std::vector<double> KConsecutiveCriterion::GetHistory() const{
+  return GetChildHistories(mRun, {mpCriterion});
+}
+
+void KConsecutiveCriterion::SetHistory(const std::vector<double>& rHistory){
+  mRun = SetChildHistories(rHistory, {mpCriterion}, GetName());
+}
@@ -0,0 +1,189 @@
+#ifndef STOPPING_CRITERIA_HPP
+#define STOPPING_CRITERIA_HPP
+
+#include "AbstractCvodeCell.hpp"
+#include <boost/circular_buffer.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+/* Everything a stopping criterion is given after each pace. The trace is
+   only recorded if a criterion asks for one (see GetSamplingTimestep) and is
+   otherwise empty */
+struct PaceObservation{
+  unsigned int pace;
+  const std::vector<double>& rPreviousState;
+  const std::vector<double>& rCurrentState;
+  const std::vector<double>& rTimes;
+  const std::vector<std::vector<double>>& rTrace;
+  boost::shared_ptr<AbstractCvodeCell> pModel;
+};
+
+/* Decides when pacing has converged. Criteria are updated once per pace and
+   keep whatever history they need themselves, so nothing is recomputed */
+class AbstractStoppingCriterion{
+public:
+  virtual ~AbstractStoppingCriterion(){}
+
+  /* Take the latest pace into account and return whether we have converged */
+  virtual bool Update(const PaceObservation& observation) = 0;
+
+  /* The latest value of the measure (NAN until it can be computed) */
+  virtual double GetValue() const = 0;
+
+  /* Forget any history, for example after the state has been extrapolated */
+  virtual void Reset(){}
+
+  /* The sampling timestep of the pace trace this criterion needs, or
+     DOUBLE_UNSET if it only uses the states at the end of each pace */
+  virtual double GetSamplingTimestep() const {return DOUBLE_UNSET;}
+
+  virtual std::string GetName() const = 0;
+
+  /* The history built up so far, flattened so that it can be checkpointed
+     with the Simulation using the criterion. The criterion itself is set up
+     again by whoever resumes the run, then given its history back */
+  virtual std::vector<double> GetHistory() const {return {};}
+
+  virtual void SetHistory(const std::vector<double>& rHistory){}
+};
+
+/* Thresholds mrms(previous, current) (the default behaviour of Simulation) */
+class MrmsCriterion : public AbstractStoppingCriterion{
+public:
+  MrmsCriterion(double threshold) : mThreshold(threshold){}
+  bool Update(const PaceObservation& observation);
+  double GetValue() const {return mValue;}
+  std::string GetName() const {return "mrms";}
+  std::vector<double> GetHistory() const {return {mValue};}
+  void SetHistory(const std::vector<double>& rHistory);
+private:
+  double mThreshold;
+  double mValue = NAN;
+};
+
+/* Thresholds the 2-norm of the change in state over a pace */
+class TwoNormCriterion : public AbstractStoppingCriterion{
+public:
+  TwoNormCriterion(double threshold) : mThreshold(threshold){}
+  bool Update(const PaceObservation& observation);
+  double GetValue() const {return mValue;}
+  std::string GetName() const {return "2-norm";}
+  std::vector<double> GetHistory() const {return {mValue};}
+  void SetHistory(const std::vector<double>& rHistory);
+private:
+  double mThreshold;
+  double mValue = NAN;
+};
+
+/* Thresholds the MRMS difference between consecutive pace traces */
+class TraceMrmsCriterion : public AbstractStoppingCriterion{
+public:
+  TraceMrmsCriterion(double threshold, double sampling_timestep = 1) : mThreshold(threshold), mSamplingTimestep(sampling_timestep){}
+  bool Update(const PaceObservation& observation);
+  double GetValue() const {return mValue;}
+  void Reset(){mPreviousTrace.clear(); mValue = NAN;}
+  double GetSamplingTimestep() const {return mSamplingTimestep;}
+  std::string GetName() const {return "trace-mrms";}
+  std::vector<double> GetHistory() const;
+  void SetHistory(const std::vector<double>& rHistory);
+private:
+  double mThreshold;
+  double mSamplingTimestep;
+  double mValue = NAN;
+  std::vector<std::vector<double>> mPreviousTrace;
+};
+
+/* Thresholds the change in APD (in ms) between consecutive paces */
+class ApdChangeCriterion : public AbstractStoppingCriterion{
+public:
+  ApdChangeCriterion(double threshold, double percentage = 90, double sampling_timestep = 0.1) : mThreshold(threshold), mPercentage(percentage), mSamplingTimestep(sampling_timestep){}
+  bool Update(const PaceObservation& observation);
+  double GetValue() const {return mValue;}
+  void Reset(){mPreviousApd = NAN; mValue = NAN;}
+  double GetSamplingTimestep() const {return mSamplingTimestep;}
+  std::string GetName() const {return "APD change";}
+  std::vector<double> GetHistory() const {return {mValue, mPreviousApd};}
+  void SetHistory(const std::vector<double>& rHistory);
+private:
+  double mThreshold;
+  double mPercentage;
+  double mSamplingTimestep;
+  double mValue = NAN;
+  double mPreviousApd = NAN;
+};
+
+/* Stops once the MRMS series has stopped decreasing and is small: the PMCC
+   between pace number and log(mrms) over the last window paces lies in
+   (-threshold, 0], so what is left is noise rather than a trend either way,
+   and the latest mrms is below max_mrms. A series that is growing is never
+   converged, and an mrms of exactly zero always is */
+class MrmsPmccCriterion : public AbstractStoppingCriterion{
+public:
+  MrmsPmccCriterion(double threshold = 0.1, unsigned int window = 50, double max_mrms = 1e-5) : mThreshold(threshold), mMaxMrms(max_mrms), mLogMrms(window){}
+  bool Update(const PaceObservation& observation);
+  double GetValue() const {return mValue;}
+  void Reset(){mLogMrms.clear(); mValue = NAN;}
+  std::string GetName() const {return "mrms PMCC";}
+  std::vector<double> GetHistory() const;
+  void SetHistory(const std::vector<double>& rHistory);
+private:
+  double mThreshold;
+  double mMaxMrms;
+  boost::circular_buffer<double> mLogMrms;
+  double mValue = NAN;
+};
+
+/* Combinators. Every child is updated every pace so that their histories
+   stay complete */
+class AllOfCriterion : public AbstractStoppingCriterion{
+public:
+  AllOfCriterion(std::vector<boost::shared_ptr<AbstractStoppingCriterion>> criteria) : mCriteria(criteria){}
+  bool Update(const PaceObservation& observation);
+  /* The number of children that have converged */
+  double GetValue() const {return mValue;}
+  void Reset();
+  double GetSamplingTimestep() const;
+  std::string GetName() const {return "all of";}
+  std::vector<double> GetHistory() const;
+  void SetHistory(const std::vector<double>& rHistory);
+private:
+  std::vector<boost::shared_ptr<AbstractStoppingCriterion>> mCriteria;
+  double mValue = 0;
+};
+
+class AnyOfCriterion : public AbstractStoppingCriterion{
+public:
+  AnyOfCriterion(std::vector<boost::shared_ptr<AbstractStoppingCriterion>> criteria) : mCriteria(criteria){}
+  bool Update(const PaceObservation& observation);
+  /* The number of children that have converged */
+  double GetValue() const {return mValue;}
+  void Reset();
+  double GetSamplingTimestep() const;
+  std::string GetName() const {return "any of";}
+  std::vector<double> GetHistory() const;
+  void SetHistory(const std::vector<double>& rHistory);
+private:
+  std::vector<boost::shared_ptr<AbstractStoppingCriterion>> mCriteria;
+  double mValue = 0;
+};
+
+/* Only converged once the wrapped criterion has been met for k paces in a row */
+class KConsecutiveCriterion : public AbstractStoppingCriterion{
+public:
+  KConsecutiveCriterion(boost::shared_ptr<AbstractStoppingCriterion> p_criterion, unsigned int k) : mpCriterion(p_criterion), mK(k){}
+  bool Update(const PaceObservation& observation);
+  /* The current run of consecutive paces meeting the criterion */
+  double GetValue() const {return mRun;}
+  void Reset(){mpCriterion->Reset(); mRun = 0;}
+  double GetSamplingTimestep() const {return mpCriterion->GetSamplingTimestep();}
+  std::string GetName() const {return std::to_string(mK) + " consecutive " + mpCriterion->GetName();}
+  std::vector<double> GetHistory() const;
+  void SetHistory(const std::vector<double>& rHistory);
+private:
+  boost::shared_ptr<AbstractStoppingCriterion> mpCriterion;
+  unsigned int mK;
+  unsigned int mRun = 0;
+};
+
+#endif
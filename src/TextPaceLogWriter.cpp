@@ -0,0 +1,33 @@
+#include "TextPaceLogWriter.hpp"
+#include "Exception.hpp"
+#include <cassert>
+
+TextPaceLogWriter::TextPaceLogWriter(std::string file_path, const std::vector<std::string>& column_names, unsigned int precision) : AbstractPaceLogWriter(column_names){
+  mOutputFile.open(file_path);
+  if(!mOutputFile.is_open()){
+    EXCEPTION("Failed to open file " + file_path);
+  }
+  mOutputFile.precision(precision);
+
+  for(const std::string& name : mColumnNames){
+    mOutputFile << name << " ";
+  }
+  mOutputFile << "\n";
+}
+
+TextPaceLogWriter::~TextPaceLogWriter(){
+  Close();
+}
+
+void TextPaceLogWriter::AppendRow(const std::vector<double>& row){
+  assert(row.size()==mColumnNames.size());
+  for(double value : row){
+    mOutputFile << value << " ";
+  }
+  mOutputFile << "\n";
+}
+
+void TextPaceLogWriter::Close(){
+  if(mOutputFile.is_open())
+    mOutputFile.close();
+}
@@ -0,0 +1,22 @@
+#ifndef TEXT_PACE_LOG_WRITER_HPP
+#define TEXT_PACE_LOG_WRITER_HPP
+
+#include <fstream>
+#include "AbstractPaceLogWriter.hpp"
+
+/* Write rows as space separated text with a header line of column names */
+class TextPaceLogWriter : public AbstractPaceLogWriter{
+public:
+  TextPaceLogWriter(std::string file_path, const std::vector<std::string>& column_names, unsigned int precision = 18);
+
+  ~TextPaceLogWriter();
+
+  void AppendRow(const std::vector<double>& row);
+
+  void Close();
+
+private:
+  std::ofstream mOutputFile;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "TraceRecorder.hpp"
+#include "Exception.hpp"
+#include "PetscTools.hpp"
+#include <fstream>
+#include <iomanip>
+
+TraceRecorder* TraceRecorder::Instance(){
+  static TraceRecorder instance;
+  return &instance;
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::GetThreadBuffer(){
+  thread_local ThreadBuffer* p_buffer = nullptr;
+  if(!p_buffer){
+    std::lock_guard<std::mutex> lock(mMutex);
+    mThreadBuffers.emplace_back(new ThreadBuffer());
+    p_buffer = mThreadBuffers.back().get();
+    p_buffer->thread_index = mThreadBuffers.size() - 1;
+    p_buffer->spans.reserve(1 << 16);
+  }
+  return p_buffer;
+}
+
+void TraceRecorder::SetScenario(unsigned int scenario, std::string name){
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mScenarioNames[scenario] = name;
+  }
+  ThreadBuffer* p_buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> lock(p_buffer->mutex);
+  p_buffer->scenario = scenario;
+}
+
+void TraceRecorder::RecordSpan(const char* name, double start, double end){
+  ThreadBuffer* p_buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> lock(p_buffer->mutex);
+  p_buffer->spans.push_back({name, start, end - start, p_buffer->scenario});
+}
+
+/* Escape a string for use in JSON */
+static std::string EscapeJson(const std::string& str){
+  std::string escaped;
+  for(char c : str){
+    if(c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
+void TraceRecorder::Dump(std::string file_path){
+  std::lock_guard<std::mutex> lock(mMutex);
+  std::ofstream f_out(file_path);
+  if(!f_out.is_open()){
+    EXCEPTION("Failed to open file " + file_path);
+  }
+  f_out << std::setprecision(15);
+  f_out << "{\"traceEvents\": [\n";
+
+  // Name the tracks
+  bool first = true;
+  std::map<unsigned int, std::string> scenario_names = mScenarioNames;
+  if(scenario_names.find(0) == scenario_names.end())
+    scenario_names[0] = "main";
+  for(const auto& scenario : scenario_names){
+    f_out << (first?"":",\n") << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << scenario.first << ", \"args\": {\"name\": \"" << EscapeJson(scenario.second) << "\"}}";
+    first = false;
+  }
+  for(const auto& p_buffer : mThreadBuffers){
+    for(const auto& scenario : scenario_names){
+      f_out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << scenario.first << ", \"tid\": " << p_buffer->thread_index << ", \"args\": {\"name\": \"rank " << PetscTools::GetMyRank() << " thread " << p_buffer->thread_index << "\"}}";
+    }
+  }
+
+  for(const auto& p_buffer : mThreadBuffers){
+    // Copy the spans so the thread isn't held up while they're written
+    std::vector<Span> spans;
+    {
+      std::lock_guard<std::mutex> buffer_lock(p_buffer->mutex);
+      spans = p_buffer->spans;
+    }
+    for(const Span& span : spans){
+      f_out << ",\n{\"name\": \"" << EscapeJson(span.name) << "\", \"ph\": \"X\", \"ts\": " << span.start << ", \"dur\": " << span.duration << ", \"pid\": " << span.scenario << ", \"tid\": " << p_buffer->thread_index << "}";
+    }
+  }
+  f_out << "\n]}\n";
+  f_out.close();
+}
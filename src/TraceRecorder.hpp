@@ -0,0 +1,96 @@
+#ifndef TRACE_RECORDER_HPP
+#define TRACE_RECORDER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Records timed spans (see TRACE_SCOPE) and writes them out in the Chrome
+   trace event format, which can be opened in chrome://tracing or Perfetto.
+
+   Recording is off until Enable is called, and costs a single check of a flag
+   when it is off. Each thread appends to its own buffer, guarded by a lock
+   of its own which is only contended while Dump copies that buffer, so
+   Dump can be called while other threads are still recording. Spans are shown on one track per scenario (see
+   SetScenario) and, within that, one track per thread.
+
+   Span names must be string literals (or otherwise outlive the recorder).
+ */
+class TraceRecorder{
+public:
+  static TraceRecorder* Instance();
+
+  void Enable(){mEnabled = true;}
+  bool IsEnabled() const {return mEnabled.load(std::memory_order_relaxed);}
+
+  /* Put spans recorded on the calling thread on the track for this scenario */
+  void SetScenario(unsigned int scenario, std::string name);
+
+  /* Microseconds since the recorder was created */
+  double GetTime() const {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - mStartTime).count();
+  }
+
+  void RecordSpan(const char* name, double start, double end);
+
+  /* Write everything recorded so far. Spans still open on other threads are
+     not included. Safe to call while other threads are recording */
+  void Dump(std::string file_path);
+
+private:
+  TraceRecorder() : mEnabled(false), mStartTime(std::chrono::steady_clock::now()){
+  }
+
+  struct Span{
+    const char* name;
+    double start;
+    double duration;
+    unsigned int scenario;
+  };
+
+  struct ThreadBuffer{
+    unsigned int thread_index;
+    unsigned int scenario = 0;
+    // Held by the owning thread while appending and by Dump while copying
+    std::mutex mutex;
+    std::vector<Span> spans;
+  };
+
+  ThreadBuffer* GetThreadBuffer();
+
+  std::atomic<bool> mEnabled;
+  const std::chrono::steady_clock::time_point mStartTime;
+
+  // Guards registration of thread buffers and scenario names, not recording
+  std::mutex mMutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> mThreadBuffers;
+  std::map<unsigned int, std::string> mScenarioNames;
+};
+
+/* Times the enclosing scope */
+class TraceScope{
+public:
+  TraceScope(const char* name) : mName(name){
+    if(TraceRecorder::Instance()->IsEnabled())
+      mStart = TraceRecorder::Instance()->GetTime();
+  }
+
+  ~TraceScope(){
+    if(mStart >= 0)
+      TraceRecorder::Instance()->RecordSpan(mName, mStart, TraceRecorder::Instance()->GetTime());
+  }
+
+private:
+  const char* mName;
+  double mStart = -1;
+};
+
+#define TRACE_SCOPE_CONCATENATE_(a, b) a##b
+#define TRACE_SCOPE_CONCATENATE(a, b) TRACE_SCOPE_CONCATENATE_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_SCOPE_CONCATENATE(trace_scope_, __LINE__)(name)
+
+#endif
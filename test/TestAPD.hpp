@@ -9,6 +9,8 @@
 #include "SimulationTools.hpp"
 #include <boost/filesystem.hpp>
 #include <fstream>
+#include <cmath>
+#include <functional>
 #include <iomanip>
 #include "Simulation.hpp"
 
@@ -23,6 +25,14 @@
     This test outputs these sets of APD90s as two separate files.
  */
 
+/* Gives the test direct access to the periodicity detection, so that it can
+   be fed made up pace end states */
+class PeriodicitySimulation : public Simulation{
+public:
+  using Simulation::Simulation;
+  unsigned int RecordPaceEnd(const std::vector<double>& state){return DetectPeriodicity(state);}
+};
+
 class TestAPD : public CxxTest::TestSuite
 {
   const unsigned int paces=10;
@@ -45,6 +55,79 @@ public:
 #else
   std::cout << "Cvode is not enabled.\n";
 #endif
+
+  /* At short periods some models settle into alternans, where the mrms
+     between consecutive paces never falls below the threshold. Pacing should
+     stop once the states repeat every k paces, with one APD per beat */
+  void TestAlternans()
+  {
+#ifdef CHASTE_CVODE
+    const double period = 300;
+    const int max_paces = 5000;
+    unsigned int models_with_alternans = 0;
+    for(auto model : get_models("algebraic")){
+      Simulation simulation(model, period);
+      simulation.SetThreshold(1e-7);
+      simulation.RunPaces(max_paces);
+
+      const unsigned int k = simulation.GetPeriodicity();
+      const std::vector<double> apds = simulation.GetPerBeatApds(90);
+      std::cout << model->GetSystemInformation()->GetSystemName() << " finished after " << simulation.GetPaces() << " paces with period " << k << " and APD90s";
+      for(double apd : apds)
+        std::cout << " " << apd;
+      std::cout << "\n";
+      TS_ASSERT_EQUALS(apds.size(), k);
+      if(k > 1)
+        models_with_alternans++;
+
+      if(simulation.IsFinished() && k > 1){
+        // Another cycle of the orbit should come back to the same state
+        const std::vector<double> start = simulation.GetStateVariables();
+        for(unsigned int i = 0; i < k; i++)
+          simulation.GetPace(1, true);
+        TS_ASSERT_LESS_THAN(mrms(start, simulation.GetStateVariables()), 1e-6);
+      }
+    }
+    // Otherwise this test isn't testing anything
+    TS_ASSERT_LESS_THAN(0u, models_with_alternans);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  /* Alternans which is slowly dying away nearly repeats every 2 paces, but
+     isn't a period 2 orbit. Sustained alternans, with or without some noise,
+     is */
+  void TestDampedAlternans()
+  {
+#ifdef CHASTE_CVODE
+    const unsigned int paces = 100;
+    auto run = [&](std::function<double(unsigned int)> variable_at) -> unsigned int {
+      PeriodicitySimulation simulation(get_models("algebraic").front(), 300);
+      simulation.SetThreshold(1e-7);
+      for(unsigned int i = 0; i < paces; i++){
+        const unsigned int k = simulation.RecordPaceEnd({variable_at(i), 1});
+        if(k > 0)
+          return k;
+      }
+      return 0;
+    };
+
+    /* The difference between paces 2 apart is 1e-3*(1 - r^2)/2 = 5e-8, below
+       the threshold, while consecutive paces differ by 1e-3 */
+    const double r = 0.99995;
+    TS_ASSERT_EQUALS(run([&](unsigned int i){return 1 + 1e-3*pow(-r, i);}), 0u);
+
+    TS_ASSERT_EQUALS(run([](unsigned int i){return 1 + 1e-3*pow(-1, i);}), 2u);
+    TS_ASSERT_EQUALS(run([](unsigned int i){return 1 + 1e-3*pow(-1, i) + 1e-9*sin(i);}), 2u);
+
+    // A period 3 orbit is found as such, not as period 2
+    TS_ASSERT_EQUALS(run([](unsigned int i){return 1 + 1e-3*(i % 3);}), 3u);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
   void RunModel(boost::shared_ptr<AbstractCvodeCell> model, const double period, const double IKrBlock){
     std::stringstream dirname;
     const std::string CHASTE_TEST_OUTPUT = std::string(getenv("CHASTE_TEST_OUTPUT"));
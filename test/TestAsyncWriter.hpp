@@ -0,0 +1,89 @@
+#include <cxxtest/TestSuite.h>
+#include "FakePetscSetup.hpp"
+#include "AsyncWriter.hpp"
+#include "Exception.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <thread>
+
+/* Files written from several threads at once must be complete as soon as
+   each thread's Flush returns, and files which can't be written must be
+   reported by Flush rather than silently dropped, to the thread which wrote
+   them.
+ */
+
+class TestAsyncWriter : public CxxTest::TestSuite
+{
+public:
+  void TestConcurrentFlush()
+  {
+    const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestAsyncWriter";
+    boost::filesystem::create_directories(dir);
+    const unsigned int lines = 10000;
+
+    std::vector<unsigned int> lines_read(4, 0);
+    std::vector<std::thread> threads;
+    for(unsigned int i = 0; i < lines_read.size(); i++){
+      threads.emplace_back([&, i]{
+          const std::string path = (dir / ("thread_" + std::to_string(i) + ".dat")).string();
+          AsyncWriter::Instance()->Open(path);
+          for(unsigned int j = 0; j < lines; j++)
+            AsyncWriter::Instance()->Write(path, std::to_string(j) + "\n");
+          AsyncWriter::Instance()->Close(path);
+          AsyncWriter::Instance()->Flush();
+
+          std::ifstream f_in(path);
+          std::string line;
+          while(std::getline(f_in, line))
+            lines_read[i]++;
+        });
+    }
+    for(auto& thread : threads)
+      thread.join();
+
+    for(unsigned int count : lines_read)
+      TS_ASSERT_EQUALS(count, lines);
+  }
+
+  void TestErrorsReportedByFlush()
+  {
+    const std::string path = (boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestAsyncWriter" / "missing" / "states.dat").string();
+    AsyncWriter::Instance()->Open(path);
+    AsyncWriter::Instance()->Write(path, "lost\n");
+    AsyncWriter::Instance()->Close(path);
+    TS_ASSERT_THROWS_CONTAINS(AsyncWriter::Instance()->Flush(), "failed to open file " + path);
+
+    // Errors are only reported once
+    TS_ASSERT_THROWS_NOTHING(AsyncWriter::Instance()->Flush());
+  }
+
+  void TestErrorsReportedToWritingThread()
+  {
+    const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestAsyncWriter";
+    boost::filesystem::create_directories(dir);
+    const std::string bad_path = (dir / "missing" / "states.dat").string();
+    const std::string good_path = (dir / "other_thread.dat").string();
+
+    // Queue a failing file here, then let another thread write and flush
+    // its own file before we flush
+    AsyncWriter::Instance()->Open(bad_path);
+    bool other_thread_threw = false;
+    std::thread other([&]{
+        AsyncWriter::Instance()->Open(good_path);
+        AsyncWriter::Instance()->Write(good_path, "kept\n");
+        AsyncWriter::Instance()->Close(good_path);
+        try{
+          AsyncWriter::Instance()->Flush();
+        }
+        catch(const Exception&){
+          other_thread_threw = true;
+        }
+      });
+    other.join();
+
+    TS_ASSERT(!other_thread_threw);
+    TS_ASSERT_THROWS_CONTAINS(AsyncWriter::Instance()->Flush(), "failed to open file " + bad_path);
+    AsyncWriter::Instance()->Close(bad_path);
+    TS_ASSERT_THROWS_NOTHING(AsyncWriter::Instance()->Flush());
+  }
+};
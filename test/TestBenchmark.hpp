@@ -8,58 +8,134 @@
 #include "FakePetscSetup.hpp"
 #include "Simulation.hpp"
 #include <boost/filesystem.hpp>
-#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <memory>
 #include "SmartSimulation.hpp"
+#include "BenchmarkBaseline.hpp"
+#include "BenchmarkResultsWriter.hpp"
+#include "CommandLineArguments.hpp"
+
+/* Measure the cost of reaching a steady state with brute force pacing and
+   with SmartSimulation. For each model and scenario, each method is run
+   --repetitions times (default 3) from the same initial conditions, recording
+   the wall time and CVODE's work as well as the number of paces. The results
+   are written to TestBenchmark/results.json with the mean and variance of
+   each measure.
+
+   With --compare-baseline, the paces and RHS evaluations of each scenario
+   are compared against a stored baseline (--baseline, by default
+   test/data/benchmark_baseline.json in the source tree) and the test fails
+   on any significant regression, or if the baseline file or a scenario is
+   missing. Wall time depends on the machine, so it is only compared when
+   --compare-wall-time is also given, which only makes sense on the machine
+   the baseline was recorded on. The allowed relative increase is set by
+   --baseline-tolerance (default 0.05) and, for wall time,
+   --baseline-time-tolerance (default 0.25). Run with --update-baseline to
+   replace the baseline with the new results instead.
+ */
 
 class TestBenchmark : public CxxTest::TestSuite
 {
 private:
   const double threshold = 1.8e-07;
-  std::ofstream output_file;
   std::string username;
-  int baseline_score = 0;
+  const std::vector<std::string> baseline_measure_names = {"paces", "wall_time", "rhs_evaluations"};
+  const boost::filesystem::path default_baseline_path = boost::filesystem::path(__FILE__).parent_path() / "data" / "benchmark_baseline.json";
 
   const std::vector<unsigned int> buffer_sizes = {100};//{25, 50, 100, 150, 200, 300 ,400};
   const std::vector<double> extrapolation_constants ={1}; //{0.5, 0.75, 0.9, 1, 1.1};
   const unsigned int max_paces = 2000;
+
+  const std::vector<std::string> measure_names = {"paces", "wall_time", "steps", "rhs_evaluations", "jacobian_evaluations", "error_test_failures", "nonlinear_iterations", "nonlinear_convergence_failures"};
+
 public:
 
   void TestBenchmarkRun(){
-    boost::shared_ptr<RegularStimulus> p_stimulus;
-    boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
-
+#ifdef CHASTE_CVODE
     std::vector<double> periods = get_periods();
     std::vector<double> IKrBlocks = get_IKr_blocks();
+    const unsigned int repetitions = get_benchmark_repetitions();
 
     auto models = get_analytic_models();
 
-      const boost::filesystem::path test_dir(getenv("CHASTE_TEST_OUTPUT"));
-
-      for(auto model : models){
-        const std::string model_name = model->GetSystemInformation()->GetSystemName();
-        std::string filepath = (boost::filesystem::path(test_dir) / boost::filesystem::path("TestBenchmark/" + model_name + "_results.dat")).string();
-        boost::filesystem::create_directories(filepath);
-        std::ofstream output_file(filepath);
-
-        output_file << "model_name buffer_size extrapolation_constant period IKrBlock score";
-
-        for(auto buffer_size : buffer_sizes){
-          for(auto extrapolation_constant : extrapolation_constants){
-            for(auto period : periods){
-              for(auto IKrBlock : IKrBlocks){
-                output_file << model_name << " " << buffer_size << " " << extrapolation_constant << " " << period << " " << IKrBlock << " ";
-                output_file << RunModel(model, period, IKrBlock, buffer_size, extrapolation_constant) << "\n";
+    const boost::filesystem::path test_dir(getenv("CHASTE_TEST_OUTPUT"));
+    boost::filesystem::create_directories(test_dir / "TestBenchmark");
+    BenchmarkResultsWriter results((test_dir / "TestBenchmark" / "results.json").string(), "scenarios", {{"repetitions", repetitions}});
+
+    CommandLineArguments* p_args = CommandLineArguments::Instance();
+    const std::string baseline_path = p_args->OptionExists("--baseline") ? p_args->GetStringCorrespondingToOption("--baseline") : default_baseline_path.string();
+    const bool update_baseline = p_args->OptionExists("--update-baseline");
+    const bool compare_baseline = !update_baseline && p_args->OptionExists("--compare-baseline");
+    const bool compare_wall_time = p_args->OptionExists("--compare-wall-time");
+    BenchmarkBaseline baseline(baseline_path);
+    if(compare_baseline && !baseline.Exists()){
+      TS_FAIL("No benchmark baseline at " + baseline_path + " - run with --update-baseline to create one");
+    }
+    if(p_args->OptionExists("--baseline-tolerance"))
+      baseline.SetDefaultTolerance(p_args->GetDoubleCorrespondingToOption("--baseline-tolerance"));
+    baseline.SetTolerance("wall_time", p_args->OptionExists("--baseline-time-tolerance") ? p_args->GetDoubleCorrespondingToOption("--baseline-time-tolerance") : 0.25);
+
+    for(auto model : models){
+      for(auto buffer_size : buffer_sizes){
+        for(auto extrapolation_constant : extrapolation_constants){
+          for(auto period : periods){
+            for(auto IKrBlock : IKrBlocks){
+              for(bool smart : {false, true}){
+                std::vector<std::vector<double>> runs;
+                for(unsigned int i = 0; i < repetitions; i++){
+                  runs.push_back(RunModel(model, period, IKrBlock, buffer_size, extrapolation_constant, smart));
+                }
+                const std::string model_name = model->GetSystemInformation()->GetSystemName();
+                const std::string method = smart ? "smart" : "brute_force";
+                WriteScenario(results, model_name, method, period, IKrBlock, buffer_size, extrapolation_constant, runs);
+
+                std::stringstream scenario;
+                scenario << model_name << ":" << method << ":" << period << ":" << IKrBlock << ":" << buffer_size << ":" << extrapolation_constant;
+                std::map<std::string, BenchmarkMeasure> measures;
+                for(const std::string& measure_name : baseline_measure_names){
+                  if(measure_name == "wall_time" && !update_baseline && !compare_wall_time)
+                    continue;
+                  const unsigned int index = std::find(measure_names.begin(), measure_names.end(), measure_name) - measure_names.begin();
+                  measures[measure_name] = SummariseMeasure(GetNthVariable(runs, index));
+                }
+
+                if(update_baseline){
+                  baseline.Update(scenario.str(), measures);
+                }
+                else if(!compare_baseline || !baseline.Exists()){
+                  continue;
+                }
+                else if(!baseline.HasScenario(scenario.str())){
+                  TS_FAIL("No baseline for " + scenario.str() + " in " + baseline_path + " - run with --update-baseline to add it");
+                }
+                else{
+                  for(const BaselineComparison& comparison : baseline.Compare(scenario.str(), measures)){
+                    std::cout << comparison.scenario << " " << comparison.measure << ": " << comparison.mean << " (baseline " << comparison.baseline_mean << ", " << 100*comparison.relative_change << "%)\n";
+                    TSM_ASSERT(comparison.scenario + " " + comparison.measure + " has regressed", !comparison.regression);
+                  }
+                }
               }
             }
           }
         }
       }
+    }
+    results.Close();
+
+    if(update_baseline){
+      baseline.Save();
+      std::cout << "Updated benchmark baseline " << baseline_path << "\n";
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
   }
 
-  unsigned int RunModel(boost::shared_ptr<AbstractCvodeCell> model, double period, double IKrBlock, unsigned int buffer_size, double extrapolation_constant){
+  /* Run one method to steady state and return each of measure_names */
+  std::vector<double> RunModel(boost::shared_ptr<AbstractCvodeCell> model, double period, double IKrBlock, unsigned int buffer_size, double extrapolation_constant, bool smart){
     const boost::filesystem::path test_dir(getenv("CHASTE_TEST_OUTPUT"));
     const double default_GKr = model->GetParameter("membrane_rapid_delayed_rectifier_potassium_current_conductance");
-    model->SetParameter("membrane_rapid_delayed_rectifier_potassium_current_conductance", (1 - IKrBlock)*default_GKr);
 
     const std::string model_name = model->GetSystemInformation()->GetSystemName();
 
@@ -69,24 +145,52 @@ public:
     const double starting_period = period==1000?500:1000;
     const double starting_block  = period==0?0.5:0;
 
-    std::stringstream dirname;
-    dirname << "/" << model_name << "_" << std::to_string(int(period)) << "ms_" << int(100*IKrBlock)<<"_percent_block/";
-
     std::stringstream input_dirname_ss;
     input_dirname_ss << model_name+"_" << std::to_string(int(starting_period)) << "ms_" << int(100*starting_block)<<"_percent_block/";
-    const std::string input_dirname = (test_dir / boost::filesystem::path(input_dirname_ss.str())).string();
 
     const std::string input_path = (test_dir / boost::filesystem::path(input_dirname_ss.str()) / boost::filesystem::path("final_states.dat")).string();
 
-    SmartSimulation smart_simulation(model, period, input_path, 1e-8, 1e-8);
-    smart_simulation.SetThreshold(threshold);
-    smart_simulation.RunPaces(max_paces);
+    // Start every repetition from the same state
+    model->SetStateVariables(model->GetSystemInformation()->GetInitialConditions());
+
+    std::unique_ptr<Simulation> p_simulation;
+    if(smart)
+      p_simulation.reset(new SmartSimulation(model, period, input_path, 1e-8, 1e-8, buffer_size, extrapolation_constant, (test_dir / "TestBenchmark").string()));
+    else
+      p_simulation.reset(new Simulation(model, period, input_path, 1e-8, 1e-8));
+    p_simulation->SetThreshold(threshold);
 
-    unsigned int paces = smart_simulation.GetPaces();
-    std::cout << "took " << paces << " paces\n";
-    // TS_ASSERT(paces+2<max_paces);
+    const auto start = std::chrono::steady_clock::now();
+    p_simulation->RunPaces(max_paces);
+    const double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const unsigned int paces = p_simulation->GetPaces();
+    const CvodeCounters counters = p_simulation->GetCvodeStatistics();
+    std::cout << (smart ? "smart" : "brute force") << " took " << paces << " paces, " << counters.steps << " steps and " << wall_time << "s\n";
+    p_simulation.reset();
 
     model->SetParameter("membrane_rapid_delayed_rectifier_potassium_current_conductance", default_GKr);
-    return paces;
+    return {double(paces), wall_time, double(counters.steps), double(counters.rhs_evaluations), double(counters.jacobian_evaluations), double(counters.error_test_failures), double(counters.nonlinear_iterations), double(counters.nonlinear_convergence_failures)};
+  }
+
+  void WriteScenario(BenchmarkResultsWriter& results, std::string model_name, std::string method, double period, double IKrBlock, unsigned int buffer_size, double extrapolation_constant, const std::vector<std::vector<double>>& runs){
+    std::vector<double> means, variances;
+    for(unsigned int j = 0; j < measure_names.size(); j++){
+      const BenchmarkMeasure measure = SummariseMeasure(GetNthVariable(runs, j));
+      means.push_back(measure.mean);
+      variances.push_back(measure.variance);
+    }
+
+    results.BeginResult();
+    results.WriteField("model", model_name);
+    results.WriteField("method", method);
+    results.WriteField("period", period);
+    results.WriteField("IKrBlock", IKrBlock);
+    results.WriteField("buffer_size", buffer_size);
+    results.WriteField("extrapolation_constant", extrapolation_constant);
+    results.WriteMeasureList("runs", measure_names, runs);
+    results.WriteMeasures("mean", measure_names, means);
+    results.WriteMeasures("variance", measure_names, variances);
+    results.EndResult();
   }
 };
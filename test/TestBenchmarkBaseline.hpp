@@ -0,0 +1,105 @@
+#include <cxxtest/TestSuite.h>
+#include "FakePetscSetup.hpp"
+#include "BenchmarkBaseline.hpp"
+#include <boost/filesystem.hpp>
+
+/* Check the regression test used by TestBenchmark on made up means and
+   variances, where the right answer is known.
+ */
+
+class TestBenchmarkBaseline : public CxxTest::TestSuite
+{
+private:
+  BenchmarkMeasure MakeMeasure(double mean, double variance, unsigned int samples){
+    BenchmarkMeasure measure;
+    measure.mean = mean;
+    measure.variance = variance;
+    measure.samples = samples;
+    return measure;
+  }
+
+  std::string GetBaselinePath(){
+    const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestBenchmarkBaseline";
+    boost::filesystem::create_directories(dir);
+    return (dir / "baseline.json").string();
+  }
+
+public:
+  void TestSummariseMeasure()
+  {
+    const BenchmarkMeasure measure = SummariseMeasure({1, 2, 3, 4});
+    TS_ASSERT_DELTA(measure.mean, 2.5, 1e-12);
+    // Sample (not population) variance
+    TS_ASSERT_DELTA(measure.variance, 5.0/3.0, 1e-12);
+    TS_ASSERT_EQUALS(measure.samples, 4u);
+
+    TS_ASSERT_EQUALS(SummariseMeasure({7}).variance, 0);
+  }
+
+  void TestWelchTTest()
+  {
+    BenchmarkBaseline baseline(GetBaselinePath() + ".missing");
+    TS_ASSERT(!baseline.Exists());
+
+    /* Means 0 and 1, each with variance 1 over 10 samples: t = 1/sqrt(0.2) =
+       2.236 on 18 degrees of freedom. The one-sided critical values are
+       1.734 at 5% and 2.552 at 1% */
+    const BenchmarkMeasure reference = MakeMeasure(0, 1, 10);
+    const BenchmarkMeasure increased = MakeMeasure(1, 1, 10);
+    baseline.SetSignificanceLevel(0.05);
+    TS_ASSERT(baseline.IsSignificantIncrease(reference, increased));
+    baseline.SetSignificanceLevel(0.01);
+    TS_ASSERT(!baseline.IsSignificantIncrease(reference, increased));
+
+    // A decrease is never a significant increase
+    TS_ASSERT(!baseline.IsSignificantIncrease(increased, reference));
+
+    // With no variance there's nothing to test, so only the direction counts
+    TS_ASSERT(baseline.IsSignificantIncrease(MakeMeasure(100, 0, 3), MakeMeasure(101, 0, 3)));
+    TS_ASSERT(!baseline.IsSignificantIncrease(MakeMeasure(100, 0, 3), MakeMeasure(100, 0, 3)));
+    TS_ASSERT(!baseline.IsSignificantIncrease(MakeMeasure(100, 0, 3), MakeMeasure(99, 0, 3)));
+
+    // Likewise with a single sample
+    TS_ASSERT(baseline.IsSignificantIncrease(MakeMeasure(100, 4, 1), MakeMeasure(110, 4, 5)));
+    TS_ASSERT(!baseline.IsSignificantIncrease(MakeMeasure(100, 4, 1), MakeMeasure(90, 4, 5)));
+  }
+
+  void TestCompare()
+  {
+    const std::string path = GetBaselinePath();
+    {
+      BenchmarkBaseline baseline(path);
+      baseline.Update("model:brute_force:1000:0", {{"paces", MakeMeasure(100, 0, 3)}, {"wall_time", MakeMeasure(10, 0.01, 5)}});
+      baseline.Save();
+    }
+
+    BenchmarkBaseline baseline(path);
+    TS_ASSERT(baseline.Exists());
+    TS_ASSERT(baseline.HasScenario("model:brute_force:1000:0"));
+    TS_ASSERT(!baseline.HasScenario("model:smart:1000:0"));
+    TS_ASSERT(baseline.Compare("model:smart:1000:0", {{"paces", MakeMeasure(100, 0, 3)}}).empty());
+    baseline.SetDefaultTolerance(0.05);
+    baseline.SetTolerance("wall_time", 0.25);
+
+    auto compare = [&](const std::string& measure_name, const BenchmarkMeasure& measure){
+      const std::vector<BaselineComparison> comparisons = baseline.Compare("model:brute_force:1000:0", {{measure_name, measure}});
+      TS_ASSERT_EQUALS(comparisons.size(), 1u);
+      return comparisons.front();
+    };
+
+    // Deterministic measures are judged on the tolerance alone
+    BaselineComparison comparison = compare("paces", MakeMeasure(110, 0, 3));
+    TS_ASSERT_DELTA(comparison.relative_change, 0.1, 1e-12);
+    TS_ASSERT(comparison.regression);
+    TS_ASSERT(!compare("paces", MakeMeasure(104, 0, 3)).regression);
+    TS_ASSERT(!compare("paces", MakeMeasure(50, 0, 3)).regression);
+
+    // Wall time has its own tolerance and must also be a significant increase
+    TS_ASSERT(compare("wall_time", MakeMeasure(13, 0.01, 5)).regression);
+    TS_ASSERT(!compare("wall_time", MakeMeasure(12, 0.01, 5)).regression);
+    TS_ASSERT(!compare("wall_time", MakeMeasure(13, 100, 5)).regression);
+
+    // Measures without a baseline aren't compared
+    TS_ASSERT(baseline.Compare("model:brute_force:1000:0", {{"steps", MakeMeasure(1, 0, 1)}}).empty());
+  }
+};
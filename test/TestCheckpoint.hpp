@@ -0,0 +1,135 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+#include "SmartSimulation.hpp"
+#include "StoppingCriteria.hpp"
+#include <boost/filesystem.hpp>
+
+/* Pacing N paces, checkpointing, then resuming in a new Simulation for M more
+   paces should give exactly the same states as pacing N+M paces without
+   stopping. The stopping criterion, periodicity history, telemetry and
+   extrapolation buffers all carry over through the checkpoint.
+ */
+
+class TestCheckpoint : public CxxTest::TestSuite
+{
+private:
+  const unsigned int paces_before = 30;
+  const unsigned int paces_after = 40;
+
+  /* A criterion with some history which won't be met over the test */
+  boost::shared_ptr<AbstractStoppingCriterion> MakeCriterion(){
+    std::vector<boost::shared_ptr<AbstractStoppingCriterion>> criteria = {boost::make_shared<TraceMrmsCriterion>(1e-20, 10), boost::make_shared<MrmsPmccCriterion>(1e-3, 10)};
+    return boost::make_shared<AllOfCriterion>(criteria);
+  }
+
+  void CheckTelemetry(const PaceTelemetry& rUninterrupted, const PaceTelemetry& rResumed){
+    const std::vector<PaceRecord> records = rUninterrupted.GetRecords();
+    const std::vector<PaceRecord> resumed_records = rResumed.GetRecords();
+    TS_ASSERT_EQUALS(records.size(), resumed_records.size());
+    for(unsigned int i = 0; i < std::min(records.size(), resumed_records.size()); i++){
+      TS_ASSERT_EQUALS(records[i].pace, resumed_records[i].pace);
+      TS_ASSERT_EQUALS(records[i].jump, resumed_records[i].jump);
+      TS_ASSERT_EQUALS(records[i].state_norm, resumed_records[i].state_norm);
+    }
+  }
+
+public:
+  void TestSimulationResume()
+  {
+#ifdef CHASTE_CVODE
+    const double period = 1000;
+    const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestCheckpoint";
+    boost::filesystem::create_directories(dir);
+    const std::string checkpoint_path = (dir / "simulation.bin").string();
+
+    auto uninterrupted_models = get_models("algebraic");
+    auto first_models = get_models("algebraic");
+    auto resumed_models = get_models("algebraic");
+
+    for(unsigned int i = 0; i < uninterrupted_models.size(); i++){
+      std::cout << "Testing " << uninterrupted_models[i]->GetSystemInformation()->GetSystemName() << "\n";
+      Simulation uninterrupted_simulation(uninterrupted_models[i], period);
+      uninterrupted_simulation.SetStoppingCriterion(MakeCriterion());
+      uninterrupted_simulation.SetMaxPeriodicity(2);
+      uninterrupted_simulation.SetMaxSteps(200000);
+      uninterrupted_simulation.RunPaces(paces_before + paces_after);
+
+      {
+        Simulation simulation(first_models[i], period);
+        simulation.SetStoppingCriterion(MakeCriterion());
+        simulation.SetMaxPeriodicity(2);
+        simulation.SetMaxSteps(200000);
+        simulation.RunPaces(paces_before);
+        simulation.SaveCheckpoint(checkpoint_path);
+      }
+
+      Simulation resumed_simulation(resumed_models[i], period);
+      resumed_simulation.SetStoppingCriterion(MakeCriterion());
+      resumed_simulation.LoadCheckpoint(checkpoint_path);
+      TS_ASSERT_EQUALS(resumed_simulation.GetPaces(), paces_before);
+      TS_ASSERT_EQUALS(resumed_simulation.GetMaxSteps(), 200000);
+      resumed_simulation.RunPaces(paces_after);
+
+      TS_ASSERT_EQUALS(resumed_simulation.GetPaces(), uninterrupted_simulation.GetPaces());
+      TS_ASSERT_EQUALS(resumed_simulation.GetStateVariables(), uninterrupted_simulation.GetStateVariables());
+      TS_ASSERT_EQUALS(resumed_simulation.IsFinished(), uninterrupted_simulation.IsFinished());
+      TS_ASSERT_EQUALS(resumed_simulation.GetStoppingCriterion()->GetHistory(), uninterrupted_simulation.GetStoppingCriterion()->GetHistory());
+      TS_ASSERT_EQUALS(resumed_simulation.GetPeriodicity(), uninterrupted_simulation.GetPeriodicity());
+      TS_ASSERT_EQUALS(resumed_simulation.GetRetries(), uninterrupted_simulation.GetRetries());
+      CheckTelemetry(uninterrupted_simulation.GetTelemetry(), resumed_simulation.GetTelemetry());
+    }
+
+    // Loading without the criterion the checkpoint was made with should fail
+    auto models = get_models("algebraic");
+    Simulation simulation(models.front(), period);
+    TS_ASSERT_THROWS_CONTAINS(simulation.LoadCheckpoint(checkpoint_path), "set the same criterion before loading");
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestSmartSimulationResume()
+  {
+#ifdef CHASTE_CVODE
+    const double period = 1000;
+    const unsigned int buffer_size = 20;
+    const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestCheckpoint";
+    boost::filesystem::create_directories(dir);
+    const std::string checkpoint_path = (dir / "smart_simulation.bin").string();
+
+    auto uninterrupted_models = get_models("algebraic");
+    auto first_models = get_models("algebraic");
+    auto resumed_models = get_models("algebraic");
+
+    for(unsigned int i = 0; i < uninterrupted_models.size(); i++){
+      std::cout << "Testing " << uninterrupted_models[i]->GetSystemInformation()->GetSystemName() << "\n";
+      // The checkpoint falls part way through filling the buffer for the
+      // second jump, so the resumed run can only match if the buffers are
+      // restored
+      SmartSimulation uninterrupted_simulation(uninterrupted_models[i], period, "", 1e-8, 1e-8, buffer_size, 1, dir.string());
+      uninterrupted_simulation.RunPaces(paces_before + paces_after);
+
+      {
+        SmartSimulation simulation(first_models[i], period, "", 1e-8, 1e-8, buffer_size, 1, dir.string());
+        simulation.RunPaces(paces_before);
+        simulation.SaveCheckpoint(checkpoint_path);
+      }
+
+      SmartSimulation resumed_simulation(resumed_models[i], period, "", 1e-8, 1e-8, buffer_size, 1, dir.string());
+      resumed_simulation.LoadCheckpoint(checkpoint_path);
+      resumed_simulation.RunPaces(paces_after);
+
+      TS_ASSERT_EQUALS(resumed_simulation.GetPaces(), uninterrupted_simulation.GetPaces());
+      TS_ASSERT_EQUALS(resumed_simulation.GetStateVariables(), uninterrupted_simulation.GetStateVariables());
+      TS_ASSERT_EQUALS(resumed_simulation.GetRejectedExtrapolations(), uninterrupted_simulation.GetRejectedExtrapolations());
+      CheckTelemetry(uninterrupted_simulation.GetTelemetry(), resumed_simulation.GetTelemetry());
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
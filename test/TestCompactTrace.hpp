@@ -0,0 +1,134 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+#include "CompactTrace.hpp"
+#include <boost/filesystem.hpp>
+
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+
+/* Check that a pace recorded as CVODE's accepted steps can be resampled to
+   agree with Chaste's uniformly sampled solution, using far fewer points, and
+   that diagnostics on the same state share one cached pace.
+ */
+
+class TestCompactTrace : public CxxTest::TestSuite
+{
+public:
+  void TestHermiteInterpolation()
+  {
+    // A cubic is reproduced exactly
+    CompactTrace trace(1, {"x"});
+    for(double t : {0.0, 0.5, 2.0}){
+      const double x = t*t*t - t;
+      const double dx = 3*t*t - 1;
+      trace.AddStep(t, &x, &dx);
+    }
+    for(double t : {0.0, 0.1, 0.5, 1.3, 2.0}){
+      TS_ASSERT_DELTA(trace.Interpolate(t, 0), t*t*t - t, 1e-12);
+    }
+    TS_ASSERT_EQUALS(trace.GetSamplingTimes(0.3).size(), 8u);
+    TS_ASSERT_THROWS_CONTAINS(trace.Interpolate(2.5, 0), "outside of the trace");
+  }
+
+  void TestCompactPace()
+  {
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<RegularStimulus> p_stimulus;
+    boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
+    auto model = boost::make_shared<Cellten_tusscher_model_2004_epiFromCellMLCvode>(p_solver, p_stimulus);
+
+    const double tolerance = 1e-10;
+    Simulation simulation(model, 1000, "", tolerance, tolerance);
+    simulation.SetTerminateOnConvergence(false);
+    simulation.RunPaces(10);
+
+    const std::vector<double> initial_states = simulation.GetStateVariables();
+    CompactTrace trace = simulation.GetCompactPace();
+    TS_ASSERT_EQUALS(simulation.GetStateVariables(), initial_states);
+    // Compare with Chaste's own solver (GetPace is served from the same
+    // trace), run with much tighter tolerances so that its error is
+    // negligible
+    model->SetForceReset(true);
+    model->SetTolerances(1e-12, 1e-12);
+    OdeSolution solution = model->Compute(0, 1000, 1);
+    model->SetTolerances(tolerance, tolerance);
+    model->SetStateVariables(initial_states);
+
+    std::cout << "Compact trace has " << trace.GetNumberOfSteps() << " steps compared to " << solution.rGetTimes().size() << " samples\n";
+    TS_ASSERT_LESS_THAN(trace.GetNumberOfSteps(), solution.rGetTimes().size());
+
+    // Diastole is where CVODE's steps are longest, so that's where the
+    // interpolant is stretched furthest between steps
+    double longest_step = 0;
+    for(unsigned int i = 1; i < trace.GetNumberOfSteps(); i++){
+      if(trace.rGetTimes()[i-1] > 500)
+        longest_step = std::max(longest_step, trace.rGetTimes()[i] - trace.rGetTimes()[i-1]);
+    }
+    std::cout << "Longest step in diastole is " << longest_step << "ms\n";
+    TS_ASSERT_LESS_THAN(10, longest_step);
+
+    /* Every variable at every sample should agree to within the solver's
+       error, measured in units of the tolerance it was asked for (the
+       global error over a pace is typically a few hundred times the
+       tolerance, which bounds each step's local error) */
+    const double error_factor = 1000;
+    double largest_error = 0;
+    const std::vector<std::vector<double>> resampled = trace.Resample(solution.rGetTimes());
+    for(unsigned int i = 0; i < resampled.size(); i++){
+      for(unsigned int j = 0; j < resampled[i].size(); j++){
+        const double reference = solution.rGetSolutions()[i][j];
+        const double error = std::abs(resampled[i][j] - reference)/(tolerance + tolerance*std::abs(reference));
+        largest_error = std::max(largest_error, error);
+        TS_ASSERT_LESS_THAN(error, error_factor);
+      }
+    }
+    std::cout << "Largest error is " << largest_error << " times the tolerance\n";
+
+    const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestCompactTrace";
+    simulation.WriteCompactPaceToFile(dir, "compact_pace.dat");
+    TS_ASSERT(boost::filesystem::exists(dir / "compact_pace.dat"));
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestPaceCache()
+  {
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<RegularStimulus> p_stimulus;
+    boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
+    auto model = boost::make_shared<Cellten_tusscher_model_2004_epiFromCellMLCvode>(p_solver, p_stimulus);
+
+    Simulation simulation(model, 1000);
+    simulation.SetTerminateOnConvergence(false);
+    simulation.RunPaces(10);
+
+    // Coarser requests are resampled from the first pace solved
+    const OdeSolution fine_solution = simulation.GetPace(0.5);
+    const OdeSolution solution = simulation.GetPace(1);
+    const std::vector<double> voltages = simulation.GetVoltageTrace(1);
+    TS_ASSERT_EQUALS(solution.rGetTimes().size(), voltages.size());
+    for(unsigned int i = 0; i < solution.rGetTimes().size(); i++){
+      TS_ASSERT_EQUALS(solution.rGetSolutions()[i], fine_solution.rGetSolutions()[2*i]);
+      TS_ASSERT_EQUALS(solution.rGetSolutions()[i][0], voltages[i]);
+    }
+
+    // Changing a parameter gives a different pace
+    const double apd = simulation.GetApd(90);
+    simulation.SetIKrBlock(0.5);
+    TS_ASSERT_LESS_THAN(apd, simulation.GetApd(90));
+    simulation.SetIKrBlock(0);
+    TS_ASSERT_EQUALS(apd, simulation.GetApd(90));
+
+    // Updating the state moves on to the end of the cached pace
+    const std::vector<double> end_state = simulation.GetCompactPace().GetFinalState();
+    simulation.GetPace(1, true);
+    TS_ASSERT_EQUALS(simulation.GetStateVariables(), end_state);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
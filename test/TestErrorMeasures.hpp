@@ -8,6 +8,7 @@
 #include "Shannon2004Cvode.hpp"
 #include "FakePetscSetup.hpp"
 #include "SimulationTools.hpp"
+#include "TraceRecorder.hpp"
 #include <boost/filesystem.hpp>
 #include <fstream>
 
@@ -31,12 +32,24 @@ public:
     boost::shared_ptr<RegularStimulus> p_stimulus;
     boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
 
+    // Record a timeline of the run with --trace <path>
+    const std::string trace_path = get_trace_path();
+    if(trace_path != "")
+      TraceRecorder::Instance()->Enable();
+
+    unsigned int scenario = 0;
     for(auto model : models){
       for(auto period : periods){
         for(auto IKrBlock : IKrBlocks){
+          std::stringstream scenario_name;
+          scenario_name << model->GetSystemInformation()->GetSystemName() << " " << period << "ms " << IKrBlock << " IKr block";
+          TraceRecorder::Instance()->SetScenario(++scenario, scenario_name.str());
           compare_error_measures(paces, model, period, IKrBlock, tolerance, filename_suffix);
         }
       }
     }
+
+    if(trace_path != "")
+      TraceRecorder::Instance()->Dump(trace_path);
   }
 };
@@ -8,11 +8,14 @@
 #include "FakePetscSetup.hpp"
 #include "Simulation.hpp"
 #include "SmartSimulation.hpp"
+#include "AsyncWriter.hpp"
+#include "TraceRecorder.hpp"
 #include "CellProperties.hpp"
 
 #include <boost/filesystem.hpp>
 #include <fstream>
 #include <iomanip>
+#include <sstream>
 
 class TestExtrapolationMethod : public CxxTest::TestSuite
 {
@@ -36,24 +39,25 @@ private:
     // Setup directories for output
     std::cout << "-------------------------------\n\n\nTesting " << model_name  << "\n";
 
-    //Open files to output states to at the start/end of each pace
-    std::ofstream smart_output_file, brute_output_file;
-    smart_output_file.open("/home/"+username+"/testoutput/"+model_name+"/TestExtrapolationMethod/smart.dat");
-    brute_output_file.open("/home/"+username+"/testoutput/"+model_name+"/TestExtrapolationMethod/bruteforce.dat");
-    smart_output_file << std::setprecision(20);
-    brute_output_file << std::setprecision(20);
+    //Open files to output states to at the start/end of each pace. These are
+    //written by the AsyncWriter so pacing doesn't wait on the disk
+    AsyncWriter* p_writer = AsyncWriter::Instance();
+    const std::string smart_path = dirname + "/smart.dat";
+    const std::string brute_path = dirname + "/bruteforce.dat";
+    p_writer->Open(smart_path);
+    p_writer->Open(brute_path);
 
     std::vector<std::string> state_names = smart_model->rGetStateVariableNames();
 
     // Set up header line
-    smart_output_file << "pace mrms ";
-    brute_output_file << "pace mrms ";
+    std::ostringstream header;
+    header << "pace mrms ";
     for(unsigned int i = 0; i < state_names.size(); i++){
-      smart_output_file << state_names[i] << " ";
-      brute_output_file << state_names[i] << " ";
+      header << state_names[i] << " ";
     }
-    smart_output_file << "\n";
-    brute_output_file << "\n";
+    header << "\n";
+    p_writer->Write(smart_path, header.str());
+    p_writer->Write(brute_path, header.str());
 
     // Run the simulations until they finish
     bool brute_finished = false;
@@ -61,36 +65,46 @@ private:
     for(int j = 0; j < paces; j++){
       if(!smart_finished){
         if(smart_simulation.RunPace()){
-          std::cout << "Model " << model_name << " period " << period << " extrapolation method finished after " << j << " paces \n";
+          p_writer->WriteToStdout("Model " + model_name + " period " + std::to_string(period) + " extrapolation method finished after " + std::to_string(j) + " paces \n");
           smart_finished = true;
         }
         std::vector<double> state_vars = smart_model->GetStdVecStateVariables();
-        smart_output_file << j << " ";
-        smart_output_file << smart_simulation.GetMrms() << " ";
+        std::ostringstream line;
+        line << std::setprecision(20);
+        line << j << " ";
+        line << smart_simulation.GetMrms() << " ";
         for(unsigned int i = 0; i < state_vars.size(); i++){
-          smart_output_file << state_vars[i] << " ";
+          line << state_vars[i] << " ";
         }
-        smart_output_file << "\n";
+        line << "\n";
+        p_writer->Write(smart_path, line.str());
       }
 
       if(!brute_finished){
         if(simulation.RunPace()){
-          std::cout << "Model " << model_name << " period " << period << " brute force method finished after " << j << " paces \n";
+          p_writer->WriteToStdout("Model " + model_name + " period " + std::to_string(period) + " brute force method finished after " + std::to_string(j) + " paces \n");
           brute_finished = true;
         }
         std::vector<double> state_vars = brute_force_model->GetStdVecStateVariables();
-        brute_output_file << j << " ";
-        brute_output_file << simulation.GetMrms() << " ";
+        std::ostringstream line;
+        line << std::setprecision(20);
+        line << j << " ";
+        line << simulation.GetMrms() << " ";
         //Don't print membrane_voltage (usually the first state variable)
         for(unsigned int i = 1; i < state_vars.size(); i++){
-          brute_output_file << state_vars[i] << " ";
+          line << state_vars[i] << " ";
         }
-        brute_output_file << "\n";
+        line << "\n";
+        p_writer->Write(brute_path, line.str());
       }
       if(smart_finished && brute_finished)
         break;
     }
 
+    p_writer->Close(smart_path);
+    p_writer->Close(brute_path);
+    p_writer->Flush();
+
     std::vector<double> brute_states = simulation.GetStateVariables();
     std::vector<double> smart_states = smart_simulation.GetStateVariables();
 
@@ -159,6 +173,9 @@ private:
     smart_simulation.SetIKrBlock(0.5);
 
     simulation.RunPaces(paces);
+    // RunPace is virtual, so this uses the extrapolation method. Before it
+    // was made virtual both simulations were paced by brute force here, and
+    // the comparison below was between two identical methods
     smart_simulation.RunPaces(paces);
 
     std::vector<double> brute_states = simulation.GetStateVariables();
@@ -184,6 +201,7 @@ private:
     simulation.WritePaceToFile(output_dir+"/brute", "brute_pace");
     smart_simulation.WritePaceToFile(output_dir+"/smart", "smart_pace");
 
+    // The extrapolated run should reach the same limit cycle as brute force
     TS_ASSERT_LESS_THAN(mrms_difference, 1e-3);
     TS_ASSERT(smart_simulation.IsFinished() && simulation.IsFinished());
 
@@ -191,6 +209,40 @@ private:
   }
 
 public:
+  /* Overshooting jumps should be caught before they're used, leaving
+     SmartSimulation to carry on pacing from the last good state with its
+     buffers intact. A huge extrapolation constant makes every jump overshoot,
+     even after damping */
+  void TestGuardedExtrapolation()
+  {
+#ifdef CHASTE_CVODE
+    const unsigned int buffer_size = 100;
+    const int max_paces = 5000;
+    auto model = get_models("algebraic").front();
+    const std::string model_name = model->GetSystemInformation()->GetSystemName();
+    SmartSimulation smart_simulation(model, 1000, "", 1e-8, 1e-8, buffer_size, 1e6);
+    smart_simulation.SetThreshold(1e-6);
+
+    bool converged = false;
+    unsigned int rejections_checked = 0;
+    while(!converged && smart_simulation.GetPaces() < (unsigned int) max_paces){
+      const unsigned int rejected_before = smart_simulation.GetRejectedExtrapolations();
+      converged = smart_simulation.RunPace();
+      if(smart_simulation.GetRejectedExtrapolations() > rejected_before){
+        // The fit can be tried again without refilling the buffers
+        TS_ASSERT_EQUALS(smart_simulation.GetBufferedPaces(), buffer_size);
+        rejections_checked++;
+      }
+    }
+    std::cout << model_name << ": " << smart_simulation.GetRejectedExtrapolations() << " extrapolations rejected, finished after " << smart_simulation.GetPaces() << " paces\n";
+    TS_ASSERT_LESS_THAN(0u, smart_simulation.GetRejectedExtrapolations());
+    TS_ASSERT_EQUALS(rejections_checked, smart_simulation.GetRejectedExtrapolations());
+    TS_ASSERT(converged);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
   void TestTusscherSimulation()
   {
 #ifdef CHASTE_CVODE
@@ -201,6 +253,11 @@ public:
       buffer_size = CommandLineArguments::Instance()->GetIntCorrespondingToOption("--buffer-size");
     }
 
+    // Record a timeline of the run with --trace <path>
+    const std::string trace_path = get_trace_path();
+    if(trace_path != "")
+      TraceRecorder::Instance()->Enable();
+
     std::cout << "Running each scenario for " << paces << " paces.\n";
     boost::shared_ptr<RegularStimulus> p_stimulus;
     boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
@@ -213,10 +270,14 @@ public:
     TS_ASSERT(original_models.size()==algebraic_models.size());
 
     for(unsigned int i = 0; i < original_models.size(); i++){
+      TraceRecorder::Instance()->SetScenario(i + 1, algebraic_models[i]->GetSystemInformation()->GetSystemName());
       CompareMethodsPeriod(paces, original_models[i], algebraic_models[i]);
       // CompareMethodsIKrBlock(original_models[i], algebraic_models[i]);
     }
 
+    if(trace_path != "")
+      TraceRecorder::Instance()->Dump(trace_path);
+
 #else
     std::cout << "Cvode is not enabled.\n";
 #endif
@@ -5,7 +5,7 @@
 #include "RegularStimulus.hpp"
 #include "EulerIvpOdeSolver.hpp"
 #include "Shannon2004Cvode.hpp"
-#include "FakePetscSetup.hpp"
+#include "PetscSetupAndFinalize.hpp"
 #include "SimulationTools.hpp"
 #include <boost/filesystem.hpp>
 #include <fstream>
@@ -13,6 +13,9 @@
 #include "CommandLineArguments.hpp"
 
 #include "Simulation.hpp"
+#include "ScenarioSweep.hpp"
+#include "AsyncWriter.hpp"
+#include "TraceRecorder.hpp"
 
 /* Run the models under different scenarios with fine tolerances and lots of
    paces. Then output:
@@ -22,6 +25,15 @@
    - Terminal state variables,
 
    all to separate files.
+
+   The scenarios are shared between processes when run in parallel, and an
+   index of every scenario is written to GroundTruthSweep/index.dat. On three
+   or more processes, process 0 only hands out scenarios, so use one more
+   process than the number of scenarios to run at once (see ScenarioSweep).
+
+   This test is in the Continuous pack as well as the Parallel pack because
+   TestAPD, TestErrorMeasures and TestTolerances start from the final_states
+   files it writes, so it must run before them.
  */
 
 class TestGroundTruthSimulation : public CxxTest::TestSuite
@@ -50,22 +62,40 @@ public:
     auto IKrBlocks = get_IKr_blocks();
     auto periods = get_periods();
 
+    std::vector<std::string> model_names;
+    std::vector<std::vector<double>> initial_states;
     for(auto model : models){
-      const N_Vector initial_states = model->GetStateVariables();
-      for(double period : periods){
-        for(double IKrBlock : IKrBlocks){
-          ComputeGroundTruth(paces, model, period, IKrBlock);
-          model->SetStateVariables(initial_states);
-        }
-      }
+      model_names.push_back(model->GetSystemInformation()->GetSystemName());
+      initial_states.push_back(model->GetStdVecStateVariables());
     }
 
+    // Record a timeline of the run with --trace <path>. Each process writes its own file
+    const std::string trace_path = get_trace_path();
+    if(trace_path != "")
+      TraceRecorder::Instance()->Enable();
+
+    const std::string CHASTE_TEST_OUTPUT = std::string(getenv("CHASTE_TEST_OUTPUT"));
+    ScenarioSweep sweep(model_names, periods, IKrBlocks, CHASTE_TEST_OUTPUT + "/GroundTruthSweep");
+
+    sweep.Run([&](const Scenario& scenario) -> std::string {
+        TraceRecorder::Instance()->SetScenario(scenario.index + 1, scenario.model_name + " " + std::to_string(int(scenario.period)) + "ms " + std::to_string(scenario.IKrBlock) + " IKr block");
+        TRACE_SCOPE("ComputeGroundTruth");
+        auto model = models[scenario.model_index];
+        model->SetStateVariables(initial_states[scenario.model_index]);
+        return ComputeGroundTruth(paces, model, scenario.period, scenario.IKrBlock);
+      });
+
+    TS_ASSERT_EQUALS(sweep.GetNumberOfFailures(), 0u);
+
+    if(trace_path != "")
+      TraceRecorder::Instance()->Dump(PetscTools::IsParallel() ? trace_path + "." + std::to_string(PetscTools::GetMyRank()) : trace_path);
+
 #else
     std::cout << "Cvode is not enabled.\n";
 #endif
   }
 #ifdef CHASTE_CVODE
-  void ComputeGroundTruth(int paces, boost::shared_ptr<AbstractCvodeCell> model, double period, double IKrBlock){
+  std::string ComputeGroundTruth(int paces, boost::shared_ptr<AbstractCvodeCell> model, double period, double IKrBlock){
     const std::string username = std::string(getenv("USER"));
     const std::string CHASTE_TEST_OUTPUT = std::string(getenv("CHASTE_TEST_OUTPUT"));
     const std::string model_name = model->GetSystemInformation()->GetSystemName();
@@ -83,9 +113,28 @@ public:
     // Turn off convergence criteria
     simulation.SetTerminateOnConvergence(false);
 
+    // Optionally keep CVODE alive between paces
+    if(CommandLineArguments::Instance()->OptionExists("--persistent-integrator"))
+      simulation.SetPersistentIntegrator(true);
+
+    // Checkpoint regularly so that an interrupted run can be continued with --resume
+    boost::filesystem::create_directories(dir);
+    const std::string checkpoint_path = (dir / "checkpoint.bin").string();
+    unsigned int checkpoint_interval = 1000;
+    if(CommandLineArguments::Instance()->OptionExists("--checkpoint-interval"))
+      checkpoint_interval = CommandLineArguments::Instance()->GetUnsignedCorrespondingToOption("--checkpoint-interval");
+
+    if(CommandLineArguments::Instance()->OptionExists("--resume") && boost::filesystem::exists(checkpoint_path))
+      simulation.LoadCheckpoint(checkpoint_path);
+    simulation.SetCheckpointing(checkpoint_path, checkpoint_interval);
+
+    // If pacing fails, keep a record of the paces leading up to it
+    simulation.SetTelemetryDumpPath((dir / "telemetry.dat").string());
+
     try{
       // Run the simulation for a large number of paces
-      simulation.RunPaces(paces);
+      if(int(simulation.GetPaces()) < paces)
+        simulation.RunPaces(paces - simulation.GetPaces());
     }
     catch(const Exception &ex){
       std::cout << "caught an exception after " << simulation.GetPaces() << " paces\n";
@@ -97,16 +146,26 @@ public:
 
     simulation.WritePaceToFile(dirname.str(), pace_filename);
 
-    // Output the APD90 of the final pace
+    // Output the APD90 of the final pace, or of each beat if the model has
+    // settled into alternans (or some other period k rhythm)
     const std::string apd_filename = "final_apd90.dat";
     std::ofstream apd_file(dirname.str() + apd_filename);
-    apd_file << simulation.GetApd(90) << "\n";
+    if(simulation.GetPeriodicity() > 1)
+      std::cout << "final paces form a period " << simulation.GetPeriodicity() << " orbit\n";
+    for(double apd : simulation.GetPerBeatApds(90))
+      apd_file << apd << "\n";
     apd_file.close();
 
     // Print final mrms
     std::cout << "final mrms is " << simulation.GetMrms(false) << "\n";
 
     simulation.WriteStatesToFile(dir, "final_states.dat");
+    simulation.WriteStatesToBinaryFile(dir, "final_states.bin");
+    // Per-variable absolute tolerance scales learned from the limit cycle
+    simulation.WriteToleranceProfile(dir, "tolerance_profile.dat");
+    // Fail the scenario if any of its output couldn't be written
+    AsyncWriter::Instance()->Flush();
+    return dir.string();
   }
 #endif
 };
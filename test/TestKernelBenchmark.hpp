@@ -0,0 +1,210 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+#include "CommandLineArguments.hpp"
+#include "VectorHelperFunctions.hpp"
+#include "BenchmarkBaseline.hpp"
+#include "BenchmarkResultsWriter.hpp"
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+#ifdef CHASTE_CVODE
+#if CHASTE_SUNDIALS_VERSION >= 30000
+#include <sunmatrix/sunmatrix_dense.h>
+#else
+#include <sundials/sundials_direct.h>
+#endif
+#if CHASTE_SUNDIALS_VERSION >= 60000
+#include "CvodeContextManager.hpp"
+#endif
+#endif
+
+/* Time the generated model code on its own: the right hand side
+   (EvaluateYDerivatives), the analytic Jacobian where the model has one,
+   GetIIonic and the derived quantities. CalculateAnalyticVoltage is a file
+   static function in the analytic voltage models, so it is timed through
+   ComputeDerivedQuantities, which calls it to get membrane_voltage.
+
+   Each kernel is evaluated at states spread across a pace on the limit
+   cycle. The pace starts from the converged states written by
+   TestGroundTruthSimulation (final_states.bin or final_states.dat in
+   <model>_1000ms_0_percent_block) when they exist, and otherwise from the
+   state reached by pacing for --warmup-paces (default 100). After a warm-up,
+   --kernel-evaluations calls (default one million) are timed per repetition
+   (--repetitions, default 3). The results are written to
+   TestKernelBenchmark/results.json as evaluations per second and
+   nanoseconds per evaluation per state variable.
+ */
+
+class TestKernelBenchmark : public CxxTest::TestSuite
+{
+private:
+  const unsigned int number_of_states = 100;
+  const double period = 1000;
+
+public:
+  void TestKernels()
+  {
+#ifdef CHASTE_CVODE
+    CommandLineArguments* p_args = CommandLineArguments::Instance();
+    const unsigned int warmup_paces = p_args->OptionExists("--warmup-paces") ? p_args->GetUnsignedCorrespondingToOption("--warmup-paces") : 100;
+    const unsigned int evaluations = p_args->OptionExists("--kernel-evaluations") ? p_args->GetUnsignedCorrespondingToOption("--kernel-evaluations") : 1000000;
+    const unsigned int repetitions = get_benchmark_repetitions();
+
+    const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestKernelBenchmark";
+    boost::filesystem::create_directories(dir);
+    BenchmarkResultsWriter results((dir / "results.json").string(), "results", {{"evaluations", evaluations}, {"repetitions", repetitions}});
+
+    for(auto model : get_models()){
+      const std::string model_name = model->GetSystemInformation()->GetSystemName();
+      const unsigned int N = model->GetNumberOfStateVariables();
+      std::cout << "Benchmarking " << model_name << "\n";
+
+      // Sample states across a pace on (or near) the limit cycle
+      std::vector<double> times;
+      std::vector<N_Vector> states;
+      std::vector<N_Vector> derivatives;
+      {
+        const boost::filesystem::path ground_truth_dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / (model_name + "_" + std::to_string(int(period)) + "ms_0_percent_block");
+        std::string input_path = "";
+        for(const std::string filename : {"final_states.bin", "final_states.dat"}){
+          if(input_path == "" && boost::filesystem::exists(ground_truth_dir / filename))
+            input_path = (ground_truth_dir / filename).string();
+        }
+        if(input_path == "")
+          std::cout << "No ground truth states in " << ground_truth_dir.string() << " - pacing " << warmup_paces << " paces from the initial conditions instead\n";
+
+        Simulation simulation(model, period, input_path);
+        simulation.SetTerminateOnConvergence(false);
+        // One pace is enough to record the trace from converged states
+        simulation.RunPaces(input_path == "" ? warmup_paces : 1);
+        const CompactTrace trace = simulation.GetCompactPace();
+        for(unsigned int i = 0; i < number_of_states; i++){
+          const double time = i*period/number_of_states;
+          times.push_back(time);
+          N_Vector state = nullptr, derivative = nullptr;
+          CreateVectorIfEmpty(state, N);
+          CreateVectorIfEmpty(derivative, N);
+          CopyFromStdVector(trace.Interpolate(time), state);
+          model->EvaluateYDerivatives(time, state, derivative);
+          states.push_back(state);
+          derivatives.push_back(derivative);
+        }
+      }
+
+      std::vector<std::vector<double>> state_vectors;
+      for(N_Vector state : states){
+        std::vector<double> state_vector;
+        CopyToStdVector(state, state_vector);
+        state_vectors.push_back(state_vector);
+      }
+
+      N_Vector dy = nullptr;
+      CreateVectorIfEmpty(dy, N);
+      double checksum = 0;
+
+      TimeKernel(results, model_name, "EvaluateYDerivatives", N, evaluations, repetitions, [&](unsigned int i){
+        model->EvaluateYDerivatives(times[i], states[i], dy);
+        checksum += NV_Ith_S(dy, 0);
+      }, nullptr);
+
+      TimeKernel(results, model_name, "GetIIonic", N, evaluations, repetitions, [&](unsigned int i){
+        checksum += model->GetIIonic();
+      }, [&](unsigned int i){model->SetStateVariables(state_vectors[i]);});
+
+      if(!model->rGetDerivedQuantityNames().empty()){
+        TimeKernel(results, model_name, "ComputeDerivedQuantities", N, evaluations, repetitions, [&](unsigned int i){
+          checksum += model->ComputeDerivedQuantities(times[i], states[i]).front();
+        }, nullptr);
+      }
+
+      if(model->HasAnalyticJacobian()){
+#if CHASTE_SUNDIALS_VERSION >= 60000
+        CHASTE_CVODE_DENSE_MATRIX jacobian = SUNDenseMatrix(N, N, CvodeContextManager::Instance()->GetSundialsContext());
+#elif CHASTE_SUNDIALS_VERSION >= 30000
+        CHASTE_CVODE_DENSE_MATRIX jacobian = SUNDenseMatrix(N, N);
+#else
+        CHASTE_CVODE_DENSE_MATRIX jacobian = NewDenseMat(N, N);
+#endif
+        N_Vector tmp1 = nullptr, tmp2 = nullptr, tmp3 = nullptr;
+        CreateVectorIfEmpty(tmp1, N);
+        CreateVectorIfEmpty(tmp2, N);
+        CreateVectorIfEmpty(tmp3, N);
+
+        TimeKernel(results, model_name, "EvaluateAnalyticJacobian", N, evaluations, repetitions, [&](unsigned int i){
+          model->EvaluateAnalyticJacobian(times[i], states[i], derivatives[i], jacobian, tmp1, tmp2, tmp3);
+        }, nullptr);
+
+        DeleteVector(tmp1);
+        DeleteVector(tmp2);
+        DeleteVector(tmp3);
+#if CHASTE_SUNDIALS_VERSION >= 30000
+        SUNMatDestroy(jacobian);
+#else
+        DestroyMat(jacobian);
+#endif
+      }
+
+      // Stop the calls being optimised away
+      std::cout << "checksum " << checksum << "\n";
+
+      DeleteVector(dy);
+      for(unsigned int i = 0; i < number_of_states; i++){
+        DeleteVector(states[i]);
+        DeleteVector(derivatives[i]);
+      }
+    }
+
+    results.Close();
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  /* Call kernel evaluations times per repetition, cycling through the
+     sampled states. set_state (if given) is called untimed before each block
+     of calls at a new state */
+  void TimeKernel(BenchmarkResultsWriter& results, std::string model_name, std::string kernel_name, unsigned int N, unsigned int evaluations, unsigned int repetitions, std::function<void(unsigned int)> kernel, std::function<void(unsigned int)> set_state){
+    const unsigned int calls_per_state = std::max(1u, evaluations/number_of_states);
+
+    auto run = [&]() -> double {
+      double seconds = 0;
+      for(unsigned int i = 0; i < number_of_states; i++){
+        if(set_state)
+          set_state(i);
+        const auto start = std::chrono::steady_clock::now();
+        for(unsigned int j = 0; j < calls_per_state; j++){
+          kernel(i);
+        }
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      }
+      return seconds;
+    };
+
+    // Warm up caches and branch predictors
+    run();
+
+    std::vector<double> evaluations_per_second;
+    for(unsigned int r = 0; r < repetitions; r++){
+      evaluations_per_second.push_back(calls_per_state*number_of_states/run());
+    }
+
+    const BenchmarkMeasure rate = SummariseMeasure(evaluations_per_second);
+    const double ns_per_variable = 1e9/(rate.mean*N);
+
+    std::cout << model_name << " " << kernel_name << ": " << rate.mean << " evaluations/s, " << ns_per_variable << " ns per state variable\n";
+    results.BeginResult();
+    results.WriteField("model", model_name);
+    results.WriteField("kernel", kernel_name);
+    results.WriteField("state_variables", N);
+    results.WriteField("evaluations_per_second", rate.mean);
+    results.WriteField("evaluations_per_second_variance", rate.variance);
+    results.WriteField("ns_per_state_variable", ns_per_variable);
+    results.EndResult();
+  }
+};
@@ -0,0 +1,51 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+
+/* Calling GetMrms before every pace when not terminating on convergence
+   should solve each pace once, and give the same states as pacing without
+   calling it.
+ */
+
+class TestLookAheadPace : public CxxTest::TestSuite
+{
+private:
+  const unsigned int paces = 20;
+
+public:
+  void TestGetMrmsReusesPace()
+  {
+#ifdef CHASTE_CVODE
+    const double period = 1000;
+
+    auto plain_models = get_models("algebraic");
+    auto look_ahead_models = get_models("algebraic");
+
+    for(unsigned int i = 0; i < plain_models.size(); i++){
+      std::cout << "Testing " << plain_models[i]->GetSystemInformation()->GetSystemName() << "\n";
+      Simulation simulation(plain_models[i], period);
+      Simulation look_ahead_simulation(look_ahead_models[i], period);
+      simulation.SetTerminateOnConvergence(false);
+      look_ahead_simulation.SetTerminateOnConvergence(false);
+
+      for(unsigned int j = 0; j < paces; j++){
+        const double mrms_before = look_ahead_simulation.GetMrms();
+        // A second call is served from the same look-ahead pace
+        TS_ASSERT_EQUALS(look_ahead_simulation.GetMrms(), mrms_before);
+        const std::vector<double> states_before = look_ahead_simulation.GetStateVariables();
+        look_ahead_simulation.RunPace();
+        TS_ASSERT_EQUALS(mrms(states_before, look_ahead_simulation.GetStateVariables()), mrms_before);
+        simulation.RunPace();
+      }
+
+      TS_ASSERT_EQUALS(simulation.GetStateVariables(), look_ahead_simulation.GetStateVariables());
+      TS_ASSERT_EQUALS(simulation.GetCvodeStatistics().rhs_evaluations, look_ahead_simulation.GetCvodeStatistics().rhs_evaluations);
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -0,0 +1,115 @@
+#include <cxxtest/TestSuite.h>
+#include "FakePetscSetup.hpp"
+#include "TextPaceLogWriter.hpp"
+#include "Hdf5PaceLogWriter.hpp"
+#include <boost/filesystem.hpp>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+/* Write a few paces with each pace log writer and check that exactly what
+   was written is read back, including rows left over from a partly filled
+   HDF5 chunk.
+ */
+
+class TestPaceLogWriter : public CxxTest::TestSuite
+{
+private:
+  const std::vector<std::string> column_names = {"pace", "mrms", "2-norm"};
+
+  std::vector<std::vector<double>> GetRows(){
+    std::vector<std::vector<double>> rows;
+    for(unsigned int i = 0; i < 5; i++){
+      rows.push_back({double(i), 1.0/(3.0 + i), exp(-0.7*i)*M_PI});
+    }
+    return rows;
+  }
+
+  boost::filesystem::path GetOutputDir(){
+    const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestPaceLogWriter";
+    boost::filesystem::create_directories(dir);
+    return dir;
+  }
+
+public:
+  void TestTextPaceLogWriter()
+  {
+    const std::string path = (GetOutputDir() / "paces.dat").string();
+    const std::vector<std::vector<double>> rows = GetRows();
+    {
+      TextPaceLogWriter writer(path, column_names);
+      for(const auto& row : rows)
+        writer.AppendRow(row);
+      writer.Close();
+    }
+
+    std::ifstream f_in(path);
+    TS_ASSERT(f_in.is_open());
+    std::string line;
+    std::getline(f_in, line);
+    std::stringstream header(line);
+    for(const std::string& name : column_names){
+      std::string read_name;
+      header >> read_name;
+      TS_ASSERT_EQUALS(read_name, name);
+    }
+    for(const auto& row : rows){
+      TS_ASSERT(std::getline(f_in, line));
+      std::stringstream line_ss(line);
+      for(double value : row){
+        double read_value;
+        line_ss >> read_value;
+        TS_ASSERT_EQUALS(read_value, value);
+      }
+    }
+  }
+
+  void TestHdf5PaceLogWriter()
+  {
+    const std::string path = (GetOutputDir() / "paces.h5").string();
+    const std::vector<std::vector<double>> rows = GetRows();
+    {
+      // 5 rows in chunks of 2 leaves one row to be written by the destructor
+      Hdf5PaceLogWriter writer(path, column_names, 2);
+      for(const auto& row : rows)
+        writer.AppendRow(row);
+    }
+
+    hid_t file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    TS_ASSERT(file >= 0);
+    for(unsigned int j = 0; j < column_names.size(); j++){
+      hid_t dataset = H5Dopen2(file, column_names[j].c_str(), H5P_DEFAULT);
+      TS_ASSERT(dataset >= 0);
+      hid_t dataspace = H5Dget_space(dataset);
+      hsize_t size;
+      H5Sget_simple_extent_dims(dataspace, &size, nullptr);
+      TS_ASSERT_EQUALS(size, rows.size());
+
+      std::vector<double> column(size);
+      H5Dread(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, column.data());
+      for(unsigned int i = 0; i < std::min<hsize_t>(size, rows.size()); i++){
+        TS_ASSERT_EQUALS(column[i], rows[i][j]);
+      }
+      H5Sclose(dataspace);
+      H5Dclose(dataset);
+    }
+
+    // Columns are stored in creation order
+    for(unsigned int j = 0; j < column_names.size(); j++){
+      char name[64];
+      H5Lget_name_by_idx(file, ".", H5_INDEX_CRT_ORDER, H5_ITER_INC, j, name, sizeof(name), H5P_DEFAULT);
+      TS_ASSERT_EQUALS(std::string(name), column_names[j]);
+    }
+    H5Fclose(file);
+
+    // A file that can't be created is reported straight away
+    TS_ASSERT_THROWS_CONTAINS(Hdf5PaceLogWriter((GetOutputDir() / "missing" / "paces.h5").string(), column_names), "Failed to create HDF5 file");
+
+    // A repeated column name can't be created. The file must still be
+    // closed, or HDF5 wouldn't let us truncate it again
+    const std::string repeated_path = (GetOutputDir() / "repeated.h5").string();
+    const std::vector<std::string> repeated_names = {"APD", "MRMS", "APD"};
+    TS_ASSERT_THROWS_CONTAINS(Hdf5PaceLogWriter(repeated_path, repeated_names).Close(), "Failed to create dataset APD");
+    TS_ASSERT_THROWS_NOTHING(Hdf5PaceLogWriter(repeated_path, column_names).Close());
+  }
+};
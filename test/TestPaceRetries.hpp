@@ -0,0 +1,47 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+
+/* A pace which CVODE can't solve with the normal settings should be retried
+   with escalated settings, and the normal settings restored afterwards. The
+   failure is forced by allowing only a quarter of the steps a pace needs, so
+   the first retry (10x max steps) succeeds.
+ */
+
+class TestPaceRetries : public CxxTest::TestSuite
+{
+public:
+  void TestRetryLadder()
+  {
+#ifdef CHASTE_CVODE
+    auto model = get_models("algebraic").front();
+    Simulation simulation(model, 1000);
+    simulation.SetTerminateOnConvergence(false);
+    TS_ASSERT_THROWS_CONTAINS(simulation.SetMaxRetries(4), "at most 3");
+
+    simulation.RunPace();
+    TS_ASSERT_EQUALS(simulation.GetRetries(), 0u);
+    const long steps = simulation.GetLastPaceStats().steps;
+    simulation.SetMaxSteps(steps/4);
+
+    // Succeeds after one retry
+    TS_ASSERT_THROWS_NOTHING(simulation.RunPace());
+    TS_ASSERT_EQUALS(simulation.GetRetries(), 1u);
+    TS_ASSERT_LESS_THAN(steps/4, simulation.GetLastPaceStats().steps);
+
+    // Back to the normal settings, so the next pace fails the first time too
+    TS_ASSERT_THROWS_NOTHING(simulation.RunPace());
+    TS_ASSERT_EQUALS(simulation.GetRetries(), 2u);
+
+    // Without retries the failure is passed on
+    simulation.SetMaxRetries(0);
+    TS_ASSERT_THROWS_ANYTHING(simulation.RunPace());
+    TS_ASSERT_EQUALS(simulation.GetRetries(), 2u);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
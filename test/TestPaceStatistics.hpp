@@ -0,0 +1,75 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+#include "AsyncWriter.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+
+/* The statistics recorded for each pace should add up to CVODE's totals, and
+   the statistics log should hold one row per pace matching them.
+ */
+
+class TestPaceStatistics : public CxxTest::TestSuite
+{
+public:
+  void TestPaceStatisticsLog()
+  {
+#ifdef CHASTE_CVODE
+    const double period = 1000;
+    const unsigned int paces = 5;
+    const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestPaceStatistics";
+    boost::filesystem::create_directories(dir);
+    const std::string log_path = (dir / "pace_statistics.dat").string();
+
+    auto model = get_models("algebraic").front();
+    Simulation simulation(model, period);
+    simulation.SetTerminateOnConvergence(false);
+    simulation.SetPaceStatisticsLog(log_path);
+
+    std::vector<PaceStatistics> statistics;
+    for(unsigned int i = 0; i < paces; i++){
+      simulation.RunPace();
+      statistics.push_back(simulation.GetLastPaceStats());
+    }
+    simulation.SetPaceStatisticsLog("");
+    AsyncWriter::Instance()->Flush();
+
+    long steps = 0;
+    long rhs_evaluations = 0;
+    for(unsigned int i = 0; i < paces; i++){
+      TS_ASSERT_EQUALS(statistics[i].pace, i + 1);
+      TS_ASSERT_LESS_THAN(0, statistics[i].steps);
+      TS_ASSERT_LESS_THAN_EQUALS(statistics[i].steps, statistics[i].rhs_evaluations);
+      TS_ASSERT_DELTA(statistics[i].time_per_step, period/statistics[i].steps, 1e-12);
+      steps += statistics[i].steps;
+      rhs_evaluations += statistics[i].rhs_evaluations;
+    }
+    TS_ASSERT_EQUALS(steps, simulation.GetCvodeStatistics().steps);
+    TS_ASSERT_EQUALS(rhs_evaluations, simulation.GetCvodeStatistics().rhs_evaluations);
+
+    // One header line followed by one row per pace
+    std::ifstream log_file(log_path);
+    TS_ASSERT(log_file.is_open());
+    std::string line;
+    std::getline(log_file, line);
+    TS_ASSERT_EQUALS(line.substr(0, 10), "pace steps");
+    for(unsigned int i = 0; i < paces; i++){
+      TS_ASSERT(std::getline(log_file, line));
+      std::stringstream line_ss(line);
+      unsigned int pace;
+      long pace_steps, pace_rhs_evaluations;
+      line_ss >> pace >> pace_steps >> pace_rhs_evaluations;
+      TS_ASSERT_EQUALS(pace, statistics[i].pace);
+      TS_ASSERT_EQUALS(pace_steps, statistics[i].steps);
+      TS_ASSERT_EQUALS(pace_rhs_evaluations, statistics[i].rhs_evaluations);
+    }
+    TS_ASSERT(!std::getline(log_file, line));
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -0,0 +1,105 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+#include "PaceTelemetry.hpp"
+#include "AsyncWriter.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+/* The telemetry ring should keep the most recent records in the order they
+   were made once it wraps around, and a run which fails should leave them
+   on disk without being asked to.
+ */
+
+class TestPaceTelemetry : public CxxTest::TestSuite
+{
+private:
+  PaceRecord MakeRecord(unsigned int pace){
+    PaceRecord record;
+    record.pace = pace;
+    return record;
+  }
+
+public:
+  void TestRingWrapAround()
+  {
+    PaceTelemetry telemetry(4);
+    TS_ASSERT_EQUALS(telemetry.GetNumberOfRecords(), 0u);
+    TS_ASSERT(telemetry.GetRecords().empty());
+
+    // Before the ring is full
+    telemetry.Record(MakeRecord(1));
+    telemetry.Record(MakeRecord(2));
+    std::vector<PaceRecord> records = telemetry.GetRecords();
+    TS_ASSERT_EQUALS(records.size(), 2u);
+    TS_ASSERT_EQUALS(records[0].pace, 1u);
+    TS_ASSERT_EQUALS(records[1].pace, 2u);
+
+    // After wrapping around more than once, only the last 4 are kept, oldest first
+    for(unsigned int pace = 3; pace <= 10; pace++)
+      telemetry.Record(MakeRecord(pace));
+    TS_ASSERT_EQUALS(telemetry.GetNumberOfRecords(), 4u);
+    records = telemetry.GetRecords();
+    TS_ASSERT_EQUALS(records.size(), 4u);
+    for(unsigned int i = 0; i < records.size(); i++)
+      TS_ASSERT_EQUALS(records[i].pace, 7 + i);
+
+    // The latest record can be filled in after it was made
+    TS_ASSERT_EQUALS(telemetry.rGetLatest().pace, 10u);
+    telemetry.rGetLatest().apd = 300;
+    TS_ASSERT_EQUALS(telemetry.GetRecords().back().apd, 300);
+
+    telemetry.Clear();
+    TS_ASSERT_EQUALS(telemetry.GetNumberOfRecords(), 0u);
+    TS_ASSERT_THROWS_CONTAINS(telemetry.SetCapacity(0), "at least 1");
+  }
+
+  void TestDumpOnException()
+  {
+#ifdef CHASTE_CVODE
+    auto model = get_models("algebraic").front();
+    Simulation simulation(model, 1000);
+    simulation.SetTerminateOnConvergence(false);
+    simulation.SetTelemetryCapacity(3);
+    simulation.SetMaxRetries(0);
+
+    // Dumped to the default path, which nobody asked for
+    const std::string dump_path = (boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "telemetry" / (model->GetSystemInformation()->GetSystemName() + "_1000ms.dat")).string();
+    TS_ASSERT_EQUALS(simulation.GetTelemetryDumpPath(), dump_path);
+    boost::filesystem::remove(dump_path);
+
+    simulation.RunPaces(5);
+    const long steps = simulation.GetLastPaceStats().steps;
+    simulation.SetMaxSteps(steps/4);
+    TS_ASSERT_THROWS_ANYTHING(simulation.RunPaces(5));
+    AsyncWriter::Instance()->Flush();
+
+    // The header, the last two good paces and the failed one
+    std::ifstream f_in(dump_path);
+    TS_ASSERT(f_in.is_open());
+    std::vector<std::string> lines;
+    std::string line;
+    while(std::getline(f_in, line))
+      lines.push_back(line);
+    TS_ASSERT_EQUALS(lines.size(), 4u);
+    if(lines.size() == 4){
+      TS_ASSERT_EQUALS(lines[0].substr(0, 10), "pace event");
+      TS_ASSERT_EQUALS(lines[1].substr(0, 7), "4 pace ");
+      TS_ASSERT_EQUALS(lines[2].substr(0, 7), "5 pace ");
+      TS_ASSERT_EQUALS(lines[3].substr(0, 9), "6 failed ");
+    }
+
+    // An empty path turns the dump off
+    boost::filesystem::remove(dump_path);
+    simulation.SetTelemetryDumpPath("");
+    TS_ASSERT_THROWS_ANYTHING(simulation.RunPaces(5));
+    AsyncWriter::Instance()->Flush();
+    TS_ASSERT(!boost::filesystem::exists(dump_path));
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -0,0 +1,107 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+#include "PararealSimulation.hpp"
+#include "StoppingCriteria.hpp"
+#include "CommandLineArguments.hpp"
+#include <chrono>
+
+#include "ten_tusscher_2004_epi_analytic_voltageCvode.hpp"
+
+/* Pace to the limit cycle with Parareal on --threads threads (default 4) and
+   check that it agrees with serial pacing, taking fewer iterations per
+   window than it has paces. Then check that Parareal paces are checked by
+   trace stopping criteria, that windows stop at the maximum number of paces
+   and that unsupported settings are rejected.
+ */
+
+class TestParareal : public CxxTest::TestSuite
+{
+private:
+  const double threshold = 1e-7;
+  const int default_paces = 5000;
+
+public:
+  void TestPararealPacing()
+  {
+#ifdef CHASTE_CVODE
+    CommandLineArguments* p_args = CommandLineArguments::Instance();
+    const unsigned int threads = p_args->OptionExists("--threads") ? p_args->GetUnsignedCorrespondingToOption("--threads") : 4;
+    int paces = get_max_paces();
+    paces = paces==INT_UNSET?default_paces:paces;
+
+    auto make_model = [](){
+      boost::shared_ptr<RegularStimulus> p_stimulus;
+      boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
+      return boost::shared_ptr<AbstractCvodeCell>(new Cellten_tusscher_2004_epi_analytic_voltageFromCellMLCvode(p_solver, p_stimulus));
+    };
+
+    Simulation simulation(make_model(), 1000);
+    PararealSimulation parareal_simulation(make_model(), make_model, 1000, threads);
+    simulation.SetThreshold(threshold);
+    parareal_simulation.SetThreshold(threshold);
+
+    auto start = std::chrono::steady_clock::now();
+    TS_ASSERT(simulation.RunPaces(paces));
+    const double serial_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    TS_ASSERT(parareal_simulation.RunPaces(paces));
+    const double parareal_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    unsigned int iterations = 0;
+    for(unsigned int window_iterations : parareal_simulation.rGetIterations())
+      iterations += window_iterations;
+    std::cout << "Serial pacing took " << simulation.GetPaces() << " paces and " << serial_time << "s\n";
+    std::cout << "Parareal took " << parareal_simulation.GetPaces() << " paces in " << parareal_simulation.rGetIterations().size() << " windows (" << iterations << " iterations) and " << parareal_time << "s\n";
+
+    const double mrms_difference = mrms(simulation.GetStateVariables(), parareal_simulation.GetStateVariables());
+    std::cout << "MRMS between solutions is " << mrms_difference << "\n";
+    TS_ASSERT_LESS_THAN(mrms_difference, 1e-3);
+
+    // Taking all K iterations would be no faster than serial pacing
+    TS_ASSERT_LESS_THAN(double(iterations)/parareal_simulation.rGetIterations().size(), double(threads));
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestPararealSettings()
+  {
+#ifdef CHASTE_CVODE
+    auto make_model = [](){
+      boost::shared_ptr<RegularStimulus> p_stimulus;
+      boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
+      return boost::shared_ptr<AbstractCvodeCell>(new Cellten_tusscher_2004_epi_analytic_voltageFromCellMLCvode(p_solver, p_stimulus));
+    };
+
+    // Criteria which need a pace trace get the trace of each accepted pace
+    PararealSimulation parareal_simulation(make_model(), make_model, 1000, 2);
+    auto p_criterion = boost::make_shared<TraceMrmsCriterion>(1e-20);
+    parareal_simulation.SetStoppingCriterion(p_criterion);
+    TS_ASSERT(!parareal_simulation.RunPaces(4));
+    TS_ASSERT_EQUALS(parareal_simulation.GetPaces(), 4u);
+    TS_ASSERT(std::isfinite(p_criterion->GetValue()));
+
+    // The last window is cut short at max_paces
+    PararealSimulation window_simulation(make_model(), make_model, 1000, 3);
+    window_simulation.SetTerminateOnConvergence(false);
+    TS_ASSERT(!window_simulation.RunPaces(4));
+    TS_ASSERT_EQUALS(window_simulation.GetPaces(), 4u);
+    TS_ASSERT_EQUALS(window_simulation.rGetIterations().size(), 2u);
+
+    // Settings the fine models can't honour are rejected
+    const std::string log_path = std::string(getenv("CHASTE_TEST_OUTPUT")) + "/TestPararealStatistics.dat";
+    parareal_simulation.SetPaceStatisticsLog(log_path);
+    TS_ASSERT_THROWS_CONTAINS(parareal_simulation.RunPace(), "per-pace statistics");
+    parareal_simulation.SetPaceStatisticsLog("");
+    parareal_simulation.SetToleranceProfile(std::vector<double>(parareal_simulation.GetStateVariables().size(), 1));
+    TS_ASSERT_THROWS_CONTAINS(parareal_simulation.RunPace(), "tolerance profiles");
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
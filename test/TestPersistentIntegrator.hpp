@@ -0,0 +1,83 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+
+/* Pacing with one CVODE instance kept alive across paces should follow the
+   same trajectory as resetting CVODE at every pace (to within the solver
+   tolerances) while taking fewer steps, as the step size isn't thrown away
+   at the start of each pace.
+ */
+
+class TestPersistentIntegrator : public CxxTest::TestSuite
+{
+private:
+  const unsigned int paces = 100;
+
+public:
+  void TestPersistentPacingMatchesDefault()
+  {
+#ifdef CHASTE_CVODE
+    const double period = 1000;
+
+    auto default_models = get_models("algebraic");
+    auto persistent_models = get_models("algebraic");
+
+    for(unsigned int i = 0; i < default_models.size(); i++){
+      std::cout << "Testing " << default_models[i]->GetSystemInformation()->GetSystemName() << "\n";
+      Simulation simulation(default_models[i], period);
+      Simulation persistent_simulation(persistent_models[i], period);
+      simulation.SetTerminateOnConvergence(false);
+      persistent_simulation.SetTerminateOnConvergence(false);
+      persistent_simulation.SetPersistentIntegrator(true);
+      TS_ASSERT(persistent_simulation.GetPersistentIntegrator());
+
+      simulation.RunPaces(paces);
+      persistent_simulation.RunPaces(paces);
+
+      const double difference = mrms(simulation.GetStateVariables(), persistent_simulation.GetStateVariables());
+      const long default_steps = simulation.GetCvodeStatistics().steps;
+      const long persistent_steps = persistent_simulation.GetCvodeStatistics().steps;
+      std::cout << "mrms difference " << difference << ", steps " << default_steps << " (default) " << persistent_steps << " (persistent)\n";
+
+      // Both runs are solved to 1e-8, so they can only drift apart by a small
+      // multiple of that
+      TS_ASSERT_LESS_THAN(difference, 1e-6);
+      TS_ASSERT_LESS_THAN(persistent_steps, default_steps);
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestModifiedStateResetsSolver()
+  {
+#ifdef CHASTE_CVODE
+    const double period = 1000;
+
+    // Setting the state between paces must restart CVODE from the new state
+    // rather than carry on from where the last pace ended
+    auto default_models = get_models("algebraic");
+    auto persistent_models = get_models("algebraic");
+
+    for(unsigned int i = 0; i < default_models.size(); i++){
+      Simulation simulation(default_models[i], period);
+      Simulation persistent_simulation(persistent_models[i], period);
+      simulation.SetTerminateOnConvergence(false);
+      persistent_simulation.SetTerminateOnConvergence(false);
+      persistent_simulation.SetPersistentIntegrator(true);
+
+      persistent_simulation.RunPaces(10);
+      persistent_simulation.SetStateVariables(simulation.GetStateVariables());
+      simulation.RunPaces(10);
+      persistent_simulation.RunPaces(10);
+
+      TS_ASSERT_LESS_THAN(mrms(simulation.GetStateVariables(), persistent_simulation.GetStateVariables()), 1e-6);
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
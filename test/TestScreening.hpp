@@ -0,0 +1,99 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+#include "ScreeningSimulation.hpp"
+#include <algorithm>
+#include <chrono>
+
+#include "ten_tusscher_2004_epi_analytic_voltageCvode.hpp"
+#include "ohara_rudy_cipa_2017_epi_analytic_voltageCvode.hpp"
+
+/* Screen a scan over IKr block at a fixed timestep, refine the parameter
+   sets whose APD90 is prolonged, and check the refined states against pacing
+   with CVODE alone, which should take more CVODE steps than refining. The
+   wall times are printed but not compared, as they vary from run to run.
+ */
+
+class TestScreening : public CxxTest::TestSuite
+{
+private:
+  const double threshold = 1e-7;
+  const int max_paces = 5000;
+
+public:
+  void TestScreeningScan()
+  {
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<RegularStimulus> p_stimulus;
+    boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
+    auto screening_model = boost::make_shared<Cellten_tusscher_2004_epi_analytic_voltageFromCellMLCvode>(p_solver, p_stimulus);
+    auto model = boost::make_shared<Cellten_tusscher_2004_epi_analytic_voltageFromCellMLCvode>(p_solver, p_stimulus);
+    const std::vector<double> initial_conditions = model->GetSystemInformation()->GetInitialConditions();
+
+    const double control_apd = [&](){
+      Simulation simulation(model, 1000);
+      simulation.SetThreshold(threshold);
+      simulation.RunPaces(max_paces);
+      return simulation.GetApd(90);
+    }();
+
+    for(double IKrBlock : {0.0, 0.25, 0.5, 0.75}){
+      screening_model->SetStateVariables(initial_conditions);
+      model->SetStateVariables(initial_conditions);
+
+      ScreeningSimulation screening_simulation(screening_model, 1000);
+      screening_simulation.SetIKrBlock(IKrBlock);
+      screening_simulation.SetThreshold(threshold);
+      screening_simulation.SetPromotionCriterion([&](ScreeningSimulation& simulation){
+        return simulation.GetApd(90) > 1.1*control_apd;
+      });
+      auto start = std::chrono::steady_clock::now();
+      TS_ASSERT(screening_simulation.RunPaces(max_paces));
+      const double screening_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::cout << "IKr block " << IKrBlock << ": screened for " << screening_simulation.GetScreeningPaces() << " paces, " << (screening_simulation.IsPromoted() ? "refined for " + std::to_string(screening_simulation.GetPaces() - screening_simulation.GetScreeningPaces()) + " paces\n" : "not refined\n");
+
+      if(screening_simulation.IsPromoted()){
+        Simulation simulation(model, 1000);
+        simulation.SetIKrBlock(IKrBlock);
+        simulation.SetThreshold(threshold);
+        start = std::chrono::steady_clock::now();
+        simulation.RunPaces(max_paces);
+        const double cvode_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "CVODE alone took " << simulation.GetPaces() << " paces and " << cvode_time << "s, screening and refining took " << screening_time << "s\n";
+        TS_ASSERT_LESS_THAN(screening_simulation.GetCvodeStatistics().steps, simulation.GetCvodeStatistics().steps);
+        TS_ASSERT_LESS_THAN(mrms(simulation.GetStateVariables(), screening_simulation.GetStateVariables()), 1e-3);
+        TS_ASSERT_LESS_THAN(screening_simulation.GetPaces() - screening_simulation.GetScreeningPaces(), simulation.GetPaces());
+      }
+    }
+    TS_ASSERT_THROWS_CONTAINS(ScreeningSimulation(model, 1000, "", 100), "screening timestep");
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  /* Hodgkin-Huxley gates are stepped with Rush-Larsen, but the states of the
+     CiPA IKr Markov chain depend on each other so aren't */
+  void TestGateClassification()
+  {
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<RegularStimulus> p_stimulus;
+    boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
+    auto model = boost::make_shared<Cellohara_rudy_cipa_2017_epi_analytic_voltageFromCellMLCvode>(p_solver, p_stimulus);
+    ScreeningSimulation simulation(model, 1000);
+    const std::vector<std::string>& names = model->GetSystemInformation()->rGetStateVariableNames();
+    std::vector<std::string> gates;
+    for(unsigned int i : simulation.rGetGateIndices())
+      gates.push_back(names[i]);
+
+    for(const std::string& gate : {"INa__m", "INa__hf", "ICaL__d", "IKs__xs1", "IK1__xk1"})
+      TS_ASSERT(std::find(gates.begin(), gates.end(), gate) != gates.end());
+    for(const std::string& markov_state : {"IKr__IC1", "IKr__IC2", "IKr__C1", "IKr__C2", "IKr__O", "IKr__IO"})
+      TS_ASSERT(std::find(gates.begin(), gates.end(), markov_state) == gates.end());
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
@@ -0,0 +1,120 @@
+#include <cxxtest/TestSuite.h>
+#include "CellProperties.hpp"
+#include "SteadyStateRunner.hpp"
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "Shannon2004Cvode.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+#include "SlowManifoldSimulation.hpp"
+#include "StoppingCriteria.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+/* Compare the number of paces taken to reach the limit cycle using brute
+   force pacing and a Newton iteration on the slow variables. Both should
+   converge to the same state. Every pace, including the finite difference
+   paces, should be counted, checked by the stopping criterion and kept
+   within the maximum number of paces.
+ */
+
+/* Met from a given pace on, recording every pace it is shown */
+class PaceCountCriterion : public AbstractStoppingCriterion{
+public:
+  PaceCountCriterion(unsigned int stop_pace) : mStopPace(stop_pace){}
+  bool Update(const PaceObservation& observation){
+    mPaces.push_back(observation.pace);
+    return observation.pace >= mStopPace;
+  }
+  double GetValue() const {return mPaces.empty() ? NAN : mPaces.back();}
+  std::string GetName() const {return "pace count";}
+  std::vector<unsigned int> mPaces;
+private:
+  unsigned int mStopPace;
+};
+
+class TestSlowManifold : public CxxTest::TestSuite
+{
+private:
+  const double threshold = 1e-7;
+  const int default_paces = 5000;
+
+public:
+  void TestSlowManifoldSimulation()
+  {
+#ifdef CHASTE_CVODE
+    int paces = get_max_paces();
+    paces = paces==INT_UNSET?default_paces:paces;
+
+    const double period = 1000;
+
+    // Use two separate instances of each model
+    auto brute_models = get_models("algebraic");
+    auto newton_models = get_models("algebraic");
+
+    for(unsigned int i = 0; i < brute_models.size(); i++){
+      const std::string model_name = brute_models[i]->GetSystemInformation()->GetSystemName();
+      std::cout << "Testing " << model_name << "\n";
+
+      Simulation simulation(brute_models[i], period);
+      SlowManifoldSimulation newton_simulation(newton_models[i], period);
+
+      simulation.SetThreshold(threshold);
+      newton_simulation.SetThreshold(threshold);
+
+      simulation.RunPaces(paces);
+      newton_simulation.RunPaces(paces);
+
+      std::cout << "brute force took " << simulation.GetPaces() << " paces, slow manifold Newton took " << newton_simulation.GetPaces() << " paces\n";
+
+      const double mrms_difference = mrms(simulation.GetStateVariables(), newton_simulation.GetStateVariables());
+      std::cout << "MRMS between solutions is " << mrms_difference << "\n";
+
+      TS_ASSERT(newton_simulation.IsFinished());
+      TS_ASSERT_LESS_THAN(mrms_difference, 1e-3);
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  void TestSlowManifoldPaceAccounting()
+  {
+#ifdef CHASTE_CVODE
+    const double period = 1000;
+    const unsigned int classification_paces = 10;
+    // Part way through the first finite difference Jacobian
+    const unsigned int max_paces = classification_paces + 3;
+
+    auto models = get_models("algebraic");
+    auto criterion_models = get_models("algebraic");
+    for(unsigned int i = 0; i < models.size(); i++){
+      std::cout << "Testing " << models[i]->GetSystemInformation()->GetSystemName() << "\n";
+      SlowManifoldSimulation simulation(models[i], period);
+      simulation.SetClassificationPaces(classification_paces);
+      simulation.SetThreshold(1e-20);
+      TS_ASSERT(!simulation.RunPaces(max_paces));
+      TS_ASSERT_EQUALS(simulation.GetPaces(), max_paces);
+      unsigned int last_pace = 0;
+      for(const PaceRecord& record : simulation.GetTelemetry().GetRecords())
+        last_pace = std::max(last_pace, record.pace);
+      TS_ASSERT_EQUALS(last_pace, max_paces);
+
+      // Every pace is shown to the criterion once, in order
+      boost::shared_ptr<PaceCountCriterion> p_criterion = boost::make_shared<PaceCountCriterion>(max_paces);
+      SlowManifoldSimulation criterion_simulation(criterion_models[i], period);
+      criterion_simulation.SetClassificationPaces(classification_paces);
+      criterion_simulation.SetStoppingCriterion(p_criterion);
+      TS_ASSERT(criterion_simulation.RunPaces(2*max_paces));
+      TS_ASSERT_EQUALS(criterion_simulation.GetPaces(), max_paces);
+      TS_ASSERT_EQUALS(p_criterion->mPaces.size(), max_paces);
+      for(unsigned int j = 0; j < p_criterion->mPaces.size(); j++)
+        TS_ASSERT_EQUALS(p_criterion->mPaces[j], j + 1);
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
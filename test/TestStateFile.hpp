@@ -0,0 +1,84 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+#include "StateFile.hpp"
+#include "AsyncWriter.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+#include "ten_tusscher_model_2004_epiCvode.hpp"
+#include "ten_tusscher_2004_epi_analytic_voltageCvode.hpp"
+
+/* Check that states written in the binary format can be read back exactly,
+   and that states are matched by name between the original and analytic
+   voltage versions of a model.
+ */
+
+class TestStateFile : public CxxTest::TestSuite
+{
+public:
+  void TestBinaryStateFile()
+  {
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<RegularStimulus> p_stimulus;
+    boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
+
+    auto original_model = boost::make_shared<Cellten_tusscher_model_2004_epiFromCellMLCvode>(p_solver, p_stimulus);
+    auto analytic_model = boost::make_shared<Cellten_tusscher_2004_epi_analytic_voltageFromCellMLCvode>(p_solver, p_stimulus);
+
+    const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestStateFile";
+    boost::filesystem::create_directories(dir);
+
+    // Move the analytic model away from its initial conditions
+    {
+      Simulation simulation(analytic_model, 1000);
+      simulation.SetTerminateOnConvergence(false);
+      simulation.RunPaces(5);
+      simulation.WriteStatesToBinaryFile(dir, "states.bin");
+      simulation.WriteStatesToFile(dir, "states.dat");
+    }
+    // Both files are written in the background
+    AsyncWriter::Instance()->Flush();
+    const std::vector<double> analytic_states = analytic_model->GetStdVecStateVariables();
+
+    // Binary round trip should be exact
+    const std::string binary_path = (dir / "states.bin").string();
+    TS_ASSERT(IsBinaryStateFile(binary_path));
+    TS_ASSERT(!IsBinaryStateFile((dir / "states.dat").string()));
+    StateFileContents contents = ReadBinaryStateFile(binary_path);
+    TS_ASSERT_EQUALS(contents.model_name, analytic_model->GetSystemInformation()->GetSystemName());
+    TS_ASSERT_EQUALS(contents.names.size(), analytic_states.size());
+    for(unsigned int i = 0; i < analytic_states.size(); i++){
+      TS_ASSERT_EQUALS(contents.values[i], analytic_states[i]);
+    }
+
+    // Loading into the original model should keep its voltage and map everything else by name
+    const double original_voltage = original_model->GetStdVecStateVariables()[0];
+    TS_ASSERT_EQUALS(LoadStatesFromFile(original_model, binary_path), 0);
+    std::vector<double> original_states = original_model->GetStdVecStateVariables();
+    TS_ASSERT_EQUALS(original_model->rGetStateVariableNames()[0], "membrane_voltage");
+    TS_ASSERT_EQUALS(original_states[0], original_voltage);
+    original_states.erase(original_states.begin());
+    TS_ASSERT_EQUALS(mrms(original_states, analytic_states), 0);
+
+    // Text files are mapped by name too
+    TS_ASSERT_EQUALS(LoadStatesFromFile(original_model, (dir / "states.dat").string()), 0);
+    original_states = original_model->GetStdVecStateVariables();
+    original_states.erase(original_states.begin());
+    TS_ASSERT_LESS_THAN(mrms(original_states, analytic_states), 1e-15);
+
+    // Corrupt one of the values and check that the checksum catches it
+    {
+      std::fstream f(binary_path, std::ios::in | std::ios::out | std::ios::binary);
+      f.seekp(-1, std::ios::end);
+      f.put(0x7f);
+    }
+    TS_ASSERT_THROWS_CONTAINS(ReadBinaryStateFile(binary_path), "Checksum mismatch");
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
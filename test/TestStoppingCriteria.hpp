@@ -0,0 +1,151 @@
+#include <cxxtest/TestSuite.h>
+#include "AbstractCvodeCell.hpp"
+#include "RegularStimulus.hpp"
+#include "FakePetscSetup.hpp"
+#include "SimulationTools.hpp"
+#include "Simulation.hpp"
+#include "StoppingCriteria.hpp"
+#include <cmath>
+#include <functional>
+
+#include "ten_tusscher_2004_epi_analytic_voltageCvode.hpp"
+
+/* Check the error measures and the stopping criteria built on them against
+   values worked out by hand, then the combinators, then pace a model until
+   its APD and its state have both converged.
+ */
+
+class TestStoppingCriteria : public CxxTest::TestSuite
+{
+public:
+  void TestErrorMeasures()
+  {
+    TS_ASSERT_DELTA(TwoNorm({1, 2, 3}, {1, 5, 7}), 5, 1e-12);
+    TS_ASSERT_DELTA(TwoNorm({1, 2, 3}, {1, 5, 7}, 2), 4, 1e-12);
+
+    // Each difference is scaled by 1 + |a| where a is from the first state
+    TS_ASSERT_DELTA(mrms({2.5, -3}, {3, -1}), sqrt((pow(0.5/3.5, 2) + pow(2.0/4, 2))/2), 1e-12);
+
+    TS_ASSERT_DELTA(CalculatePMCC(std::vector<double>{1, 2, 3, 4}), 1, 1e-12);
+    TS_ASSERT_DELTA(CalculatePMCC(std::vector<double>{4, 3, 2, 1}), -1, 1e-12);
+    TS_ASSERT_DELTA(CalculatePMCC(std::vector<double>{1, 3, 2, 4}), 0.8, 1e-12);
+    TS_ASSERT_DELTA(CalculatePMCC(std::vector<double>{0, 1, 2, 3}, std::vector<double>{1, 3, 2, 4}), 0.8, 1e-12);
+  }
+
+  void TestTraceMrms()
+  {
+    const std::vector<double> times = {0, 1};
+    const std::vector<double> state;
+    boost::shared_ptr<AbstractCvodeCell> p_model;
+    TraceMrmsCriterion criterion(1);
+
+    // Nothing to compare the first trace with
+    TS_ASSERT(!criterion.Update({1, state, state, times, {{2.5, -3}, {0, 0}}, p_model}));
+    TS_ASSERT(std::isnan(criterion.GetValue()));
+
+    // Differences (0.5/4, 2/2, 1/2, 0), scaled by the new trace
+    TS_ASSERT(criterion.Update({2, state, state, times, {{3, -1}, {1, 0}}, p_model}));
+    TS_ASSERT_DELTA(criterion.GetValue(), 0.5625, 1e-12);
+  }
+
+  void TestMrmsPmcc()
+  {
+    const std::vector<double> times;
+    const std::vector<std::vector<double>> trace;
+    boost::shared_ptr<AbstractCvodeCell> p_model;
+    const std::vector<double> zero = {0};
+    const unsigned int window = 20;
+
+    // With a previous state of zero the mrms is the new state
+    auto run = [&](MrmsPmccCriterion& criterion, std::function<double(unsigned int)> mrms_at){
+      bool converged = false;
+      for(unsigned int i = 0; i < window; i++)
+        converged = criterion.Update({i + 1, zero, {mrms_at(i)}, times, trace, p_model});
+      return converged;
+    };
+
+    // Still decreasing
+    MrmsPmccCriterion decreasing(0.1, window);
+    TS_ASSERT(!run(decreasing, [](unsigned int i){return 1e-6*exp(-double(i));}));
+    TS_ASSERT_DELTA(decreasing.GetValue(), -1, 1e-9);
+
+    // Growing, however slowly, is never converged
+    MrmsPmccCriterion increasing(0.1, window);
+    TS_ASSERT(!run(increasing, [](unsigned int i){return 1e-8*(1 + 1e-3*i);}));
+    TS_ASSERT_LESS_THAN(0, increasing.GetValue());
+
+    /* Alternating between two small values leaves a weak downward trend
+       (PMCC -0.087 over 20 paces) */
+    MrmsPmccCriterion noise(0.1, window);
+    TS_ASSERT(run(noise, [](unsigned int i){return i % 2 ? 1e-8 : 2e-8;}));
+    TS_ASSERT_DELTA(noise.GetValue(), -200/sqrt(13300.0*400.0), 1e-9);
+
+    // The same noise far from the limit cycle isn't converged
+    MrmsPmccCriterion large_noise(0.1, window);
+    TS_ASSERT(!run(large_noise, [](unsigned int i){return i % 2 ? 1e-2 : 2e-2;}));
+
+    // A pace which changes nothing has converged, whatever the window holds
+    MrmsPmccCriterion exact(0.1, window);
+    TS_ASSERT(!exact.Update({1, zero, {1e-3}, times, trace, p_model}));
+    TS_ASSERT(exact.Update({2, zero, zero, times, trace, p_model}));
+  }
+
+  void TestCombinators()
+  {
+    const std::vector<double> times;
+    const std::vector<std::vector<double>> trace;
+    boost::shared_ptr<AbstractCvodeCell> p_model;
+
+    auto p_mrms = boost::make_shared<MrmsCriterion>(1e-3);
+    auto p_two_norm = boost::make_shared<TwoNormCriterion>(1e-6);
+    auto p_consecutive = boost::make_shared<KConsecutiveCriterion>(p_mrms, 2);
+    AllOfCriterion all_of({p_consecutive, p_two_norm});
+    AnyOfCriterion any_of({p_mrms, p_two_norm});
+
+    const std::vector<double> a = {1, 1}, b = {1, 1.0001}, c = {1, 5};
+
+    // Only mrms is met, and only once in a row
+    TS_ASSERT(!all_of.Update({1, a, b, times, trace, p_model}));
+    TS_ASSERT_EQUALS(p_consecutive->GetValue(), 1);
+    TS_ASSERT_EQUALS(all_of.GetValue(), 0);
+
+    TS_ASSERT(!all_of.Update({2, a, c, times, trace, p_model}));
+    TS_ASSERT_EQUALS(p_consecutive->GetValue(), 0);
+
+    TS_ASSERT(!all_of.Update({3, a, a, times, trace, p_model}));
+    TS_ASSERT(all_of.Update({4, a, a, times, trace, p_model}));
+    TS_ASSERT_EQUALS(all_of.GetValue(), 2);
+
+    TS_ASSERT(any_of.Update({5, a, b, times, trace, p_model}));
+    TS_ASSERT(!any_of.Update({6, a, c, times, trace, p_model}));
+
+    all_of.Reset();
+    TS_ASSERT_EQUALS(p_consecutive->GetValue(), 0);
+
+    // Trace criteria need a trace
+    TraceMrmsCriterion trace_mrms(1e-3);
+    TS_ASSERT_THROWS_CONTAINS(trace_mrms.Update({7, a, a, times, trace, p_model}), "needs a pace trace");
+    TS_ASSERT_EQUALS(AllOfCriterion({p_mrms, boost::make_shared<ApdChangeCriterion>(0.1), boost::make_shared<TraceMrmsCriterion>(1e-3)}).GetSamplingTimestep(), 0.1);
+  }
+
+  void TestApdConvergence()
+  {
+#ifdef CHASTE_CVODE
+    boost::shared_ptr<RegularStimulus> p_stimulus;
+    boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
+    auto model = boost::make_shared<Cellten_tusscher_2004_epi_analytic_voltageFromCellMLCvode>(p_solver, p_stimulus);
+
+    Simulation simulation(model, 1000);
+    auto p_apd_criterion = boost::make_shared<ApdChangeCriterion>(0.01);
+    auto p_mrms_criterion = boost::make_shared<MrmsCriterion>(1e-6);
+    simulation.SetStoppingCriterion(boost::make_shared<KConsecutiveCriterion>(boost::make_shared<AllOfCriterion>(std::vector<boost::shared_ptr<AbstractStoppingCriterion>>{p_apd_criterion, p_mrms_criterion}), 3));
+    TS_ASSERT(simulation.RunPaces(5000));
+
+    std::cout << "Converged after " << simulation.GetPaces() << " paces with APD change " << p_apd_criterion->GetValue() << "ms\n";
+    TS_ASSERT_LESS_THAN(p_apd_criterion->GetValue(), 0.01);
+    TS_ASSERT_LESS_THAN(p_mrms_criterion->GetValue(), 1e-6);
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+};
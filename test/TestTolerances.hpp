@@ -8,6 +8,7 @@
 #include "Shannon2004Cvode.hpp"
 #include "FakePetscSetup.hpp"
 #include "SimulationTools.hpp"
+#include "Simulation.hpp"
 #include <boost/filesystem.hpp>
 #include <fstream>
 
@@ -38,4 +39,88 @@ public:
       }
     }
   }
+
+  /* Scale each variable's absolute tolerance by its range over a converged
+     pace. The APD90 should be as accurate as with a single absolute
+     tolerance, using fewer steps. The profile is kept in checkpoints */
+  void TestToleranceProfile(){
+#ifdef CHASTE_CVODE
+    const int max_paces = 5000;
+    auto models = get_models("algebraic");
+    auto resumed_models = get_models("algebraic");
+    for(unsigned int m = 0; m < models.size(); m++){
+      auto model = models[m];
+      const std::string model_name = model->GetSystemInformation()->GetSystemName();
+      Simulation simulation(model, 1000);
+      simulation.RunPaces(max_paces);
+      const std::vector<double> state = simulation.GetStateVariables();
+
+      // Reference APD from very tight tolerances
+      simulation.SetTolerances(1e-12, 1e-12);
+      const double reference_apd = simulation.GetApd(90);
+      simulation.SetTolerances(1e-8, 1e-8);
+      const std::vector<double> profile = simulation.ComputeToleranceProfile();
+
+      simulation.SetTerminateOnConvergence(false);
+      simulation.ResetCvodeStatistics();
+      simulation.RunPace();
+      const unsigned int scalar_steps = simulation.GetCvodeStatistics().steps;
+      const double scalar_apd = simulation.GetApd(90);
+
+      const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestToleranceProfile" / model_name;
+      simulation.SetStateVariables(state);
+      simulation.WriteToleranceProfile(dir, "tolerance_profile.dat");
+      simulation.LoadToleranceProfile((dir / "tolerance_profile.dat").string());
+      TS_ASSERT_EQUALS(simulation.rGetToleranceProfile().size(), profile.size());
+      for(unsigned int i = 0; i < profile.size(); i++)
+        TS_ASSERT_DELTA(simulation.rGetToleranceProfile()[i], profile[i], 1e-12*profile[i]);
+
+      simulation.ResetCvodeStatistics();
+      simulation.RunPace();
+      const unsigned int profile_steps = simulation.GetCvodeStatistics().steps;
+      const double profile_apd = simulation.GetApd(90);
+
+      std::cout << model_name << ": scalar tolerance took " << scalar_steps << " steps (APD90 error " << scalar_apd - reference_apd << "ms), tolerance profile took " << profile_steps << " steps (APD90 error " << profile_apd - reference_apd << "ms)\n";
+      TS_ASSERT_DELTA(profile_apd, reference_apd, std::max(0.01, 2*std::abs(scalar_apd - reference_apd)));
+      TS_ASSERT_LESS_THAN(profile_steps, scalar_steps);
+
+      const std::string checkpoint_path = (dir / "simulation.bin").string();
+      simulation.SaveCheckpoint(checkpoint_path);
+      Simulation resumed_simulation(resumed_models[m], 1000);
+      resumed_simulation.LoadCheckpoint(checkpoint_path);
+      TS_ASSERT_EQUALS(resumed_simulation.rGetToleranceProfile(), simulation.rGetToleranceProfile());
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
+
+  /* Converge at loose tolerances first and tighten them step by step. This
+     should reach the same limit cycle as pacing at the tightest tolerance,
+     with most of the paces run at the loosest */
+  void TestToleranceLadder(){
+#ifdef CHASTE_CVODE
+    const std::vector<double> tolerances = {1e-6, 1e-8, 1e-10, 1e-12};
+    const int max_paces_per_rung = 5000;
+
+    auto ladder_models = get_models("algebraic");
+    auto direct_models = get_models("algebraic");
+
+    for(unsigned int i = 0; i < ladder_models.size(); i++){
+      std::cout << "Testing " << ladder_models[i]->GetSystemInformation()->GetSystemName() << "\n";
+      Simulation ladder_simulation(ladder_models[i], 1000);
+      Simulation direct_simulation(direct_models[i], 1000, "", 1e-12, 1e-12);
+      TS_ASSERT(ladder_simulation.RunToleranceLadder(tolerances, max_paces_per_rung));
+      TS_ASSERT(direct_simulation.RunPaces(max_paces_per_rung));
+
+      const std::vector<unsigned int>& rung_paces = ladder_simulation.rGetToleranceLadderPaces();
+      TS_ASSERT_EQUALS(rung_paces.size(), tolerances.size());
+      std::cout << "Ladder took " << rung_paces.back() << " paces at 1e-12 compared to " << direct_simulation.GetPaces() << "\n";
+      TS_ASSERT_LESS_THAN(rung_paces.back(), direct_simulation.GetPaces());
+      TS_ASSERT_LESS_THAN(mrms(ladder_simulation.GetStateVariables(), direct_simulation.GetStateVariables()), 1e-3);
+    }
+#else
+    std::cout << "Cvode is not enabled.\n";
+#endif
+  }
 };
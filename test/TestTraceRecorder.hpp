@@ -0,0 +1,113 @@
+#include <cxxtest/TestSuite.h>
+#include "FakePetscSetup.hpp"
+#include "TraceRecorder.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <atomic>
+#include <map>
+#include <set>
+#include <thread>
+
+/* Dump must produce valid JSON with one track per scenario and thread, even
+   when it is called while other threads are still recording.
+ */
+
+class TestTraceRecorder : public CxxTest::TestSuite
+{
+private:
+  /* Parse a dump, returning the thread ids of the test spans for each
+     scenario (pid) and counting them */
+  std::map<unsigned int, std::set<unsigned int>> ReadTracks(std::string path, std::set<unsigned int>& rNamedProcesses, unsigned int& rSpans){
+    boost::property_tree::ptree tree;
+    TS_ASSERT_THROWS_NOTHING(boost::property_tree::read_json(path, tree));
+
+    std::map<unsigned int, std::set<unsigned int>> tracks;
+    rSpans = 0;
+    for(const auto& event : tree.get_child("traceEvents")){
+      const std::string name = event.second.get<std::string>("name");
+      const std::string phase = event.second.get<std::string>("ph");
+      if(phase == "M" && name == "process_name"){
+        rNamedProcesses.insert(event.second.get<unsigned int>("pid"));
+      }
+      else if(phase == "X" && name == "TestTraceRecorder span"){
+        TS_ASSERT_LESS_THAN_EQUALS(0, event.second.get<double>("dur"));
+        tracks[event.second.get<unsigned int>("pid")].insert(event.second.get<unsigned int>("tid"));
+        rSpans++;
+      }
+    }
+    return tracks;
+  }
+
+public:
+  void TestDumpWhileRecording()
+  {
+    const boost::filesystem::path dir = boost::filesystem::path(getenv("CHASTE_TEST_OUTPUT")) / "TestTraceRecorder";
+    boost::filesystem::create_directories(dir);
+    TraceRecorder::Instance()->Enable();
+
+    const unsigned int number_of_threads = 3;
+    std::atomic<bool> stop(false);
+    std::vector<std::atomic<unsigned int>> spans(number_of_threads);
+    std::vector<std::thread> threads;
+    for(unsigned int i = 0; i < number_of_threads; i++){
+      spans[i] = 0;
+      threads.emplace_back([&, i]{
+          // Scenario 0 is the main track, so start from 1
+          TraceRecorder::Instance()->SetScenario(i + 1, "scenario \"" + std::to_string(i + 1) + "\"");
+          while(!stop){
+            TRACE_SCOPE("TestTraceRecorder span");
+            spans[i]++;
+          }
+        });
+    }
+
+    // Wait until every thread has recorded 100 spans (the count goes up
+    // before each span is recorded), then dump while they carry on
+    for(unsigned int i = 0; i < number_of_threads; i++){
+      while(spans[i] <= 100)
+        std::this_thread::yield();
+    }
+    const std::string during_path = (dir / "during.json").string();
+    TraceRecorder::Instance()->Dump(during_path);
+
+    stop = true;
+    for(auto& thread : threads)
+      thread.join();
+    const std::string after_path = (dir / "after.json").string();
+    TraceRecorder::Instance()->Dump(after_path);
+
+    unsigned int total_spans = 0;
+    for(unsigned int i = 0; i < number_of_threads; i++)
+      total_spans += spans[i];
+
+    std::set<unsigned int> named_processes;
+    unsigned int spans_during = 0;
+    const std::map<unsigned int, std::set<unsigned int>> tracks_during = ReadTracks(during_path, named_processes, spans_during);
+    TS_ASSERT_LESS_THAN_EQUALS(number_of_threads*100, spans_during);
+    TS_ASSERT_LESS_THAN_EQUALS(spans_during, total_spans);
+
+    named_processes.clear();
+    unsigned int spans_after = 0;
+    const std::map<unsigned int, std::set<unsigned int>> tracks_after = ReadTracks(after_path, named_processes, spans_after);
+    TS_ASSERT_EQUALS(spans_after, total_spans);
+
+    // Each scenario is named and its spans are all on the thread which set it,
+    // with a different thread for each scenario
+    for(const auto& tracks : {tracks_during, tracks_after}){
+      TS_ASSERT_EQUALS(tracks.size(), number_of_threads);
+      std::set<unsigned int> thread_ids;
+      for(unsigned int i = 0; i < number_of_threads; i++){
+        TS_ASSERT_EQUALS(tracks.count(i + 1), 1u);
+        if(tracks.count(i + 1) == 1){
+          TS_ASSERT_EQUALS(tracks.at(i + 1).size(), 1u);
+          thread_ids.insert(*tracks.at(i + 1).begin());
+        }
+      }
+      TS_ASSERT_EQUALS(thread_ids.size(), number_of_threads);
+    }
+    for(unsigned int i = 0; i <= number_of_threads; i++){
+      TS_ASSERT_EQUALS(named_processes.count(i), 1u);
+    }
+  }
+};